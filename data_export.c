@@ -0,0 +1,500 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <jansson.h>
+
+#include "data_export.h"
+
+/* Size of the blocks handed to the C library */
+#define EXPORT_BUFFER_SIZE (1 << 20)
+
+/* How often, in rows, the progress is published and cancel is checked */
+#define EXPORT_ROWS_PER_STEP 4096
+
+/* Powers of ten that are exact in a double */
+static const double pow10_exact[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+#define POW10_EXACT_MAX 22
+
+static unsigned int uint_to_text(uint32_t value, char *buf)
+{
+	char tmp[10];
+	unsigned int i = 0, len;
+
+	do {
+		tmp[i++] = '0' + value % 10;
+		value /= 10;
+	} while (value);
+
+	for (len = 0; i; len++)
+		buf[len] = tmp[--i];
+
+	return len;
+}
+
+/* Values beyond the exact powers of ten: find the shortest precision that
+ * reads back the same. Only tiny and huge values get here. The g_ascii_
+ * functions always use a '.', whatever the locale. */
+static unsigned int float_to_text_slow(float value, char *buf)
+{
+	static const char * const formats[] = {
+		"%.1g", "%.2g", "%.3g", "%.4g", "%.5g",
+		"%.6g", "%.7g", "%.8g", "%.9g",
+	};
+	unsigned int i;
+
+	for (i = 0; i < G_N_ELEMENTS(formats); i++) {
+		g_ascii_formatd(buf, FLOAT_TEXT_MAX, formats[i], value);
+		if ((float)g_ascii_strtod(buf, NULL) == value)
+			break;
+	}
+
+	return strlen(buf);
+}
+
+/*
+ * Write the shortest decimal that reads back as @value, without the locale,
+ * in the style of "%g": plain notation unless the exponent is below -4 or
+ * beyond the 9 digits a float may need. @buf holds FLOAT_TEXT_MAX chars;
+ * the length is returned and the text is NUL terminated.
+ */
+unsigned int float_to_text(float value, char *buf)
+{
+	char digits[10];
+	unsigned int len = 0, n, i;
+	uint32_t mantissa = 0;
+	double d, scaled, back;
+	int e10, p;
+
+	if (isnan(value)) {
+		strcpy(buf, "nan");
+		return 3;
+	}
+	if (signbit(value)) {
+		buf[len++] = '-';
+		value = -value;
+	}
+	if (isinf(value)) {
+		strcpy(buf + len, "inf");
+		return len + 3;
+	}
+
+	/* Raw samples are integer codes, which need no search */
+	if (value < 16777216.0f && value == (float)(int32_t)value) {
+		len += uint_to_text((uint32_t)value, buf + len);
+		buf[len] = '\0';
+		return len;
+	}
+
+	d = value;
+	e10 = (int)floor(log10(d));
+	if (e10 < -POW10_EXACT_MAX + 8 || e10 >= POW10_EXACT_MAX)
+		return len + float_to_text_slow(value, buf + len);
+
+	/* log10() may be off by one around the powers of ten */
+	scaled = e10 >= 0 ? d / pow10_exact[e10] : d * pow10_exact[-e10];
+	if (scaled < 1.0)
+		e10--;
+	else if (scaled >= 10.0)
+		e10++;
+
+	/* Scaling by an exact power of ten rounds once, and so does the way
+	 * back, so the candidate with n digits is checked exactly */
+	for (n = 1; n <= 9; n++) {
+		p = n - 1 - e10;
+		if (p > POW10_EXACT_MAX || p < -POW10_EXACT_MAX)
+			return len + float_to_text_slow(value, buf + len);
+
+		scaled = p >= 0 ? d * pow10_exact[p] : d / pow10_exact[-p];
+		mantissa = (uint32_t)nearbyint(scaled);
+		back = p >= 0 ? mantissa / pow10_exact[p] :
+			mantissa * pow10_exact[-p];
+		if ((float)back == value)
+			break;
+	}
+	if (n > 9)
+		return len + float_to_text_slow(value, buf + len);
+
+	/* Rounded up to the next power of ten */
+	if (mantissa == pow10_exact[n]) {
+		mantissa /= 10;
+		e10++;
+	}
+	while (n > 1 && mantissa % 10 == 0) {
+		mantissa /= 10;
+		n--;
+	}
+	for (i = n; i; i--) {
+		digits[i - 1] = '0' + mantissa % 10;
+		mantissa /= 10;
+	}
+
+	if (e10 < -4 || e10 >= 9) {
+		buf[len++] = digits[0];
+		if (n > 1) {
+			buf[len++] = '.';
+			memcpy(buf + len, digits + 1, n - 1);
+			len += n - 1;
+		}
+		buf[len++] = 'e';
+		buf[len++] = e10 < 0 ? '-' : '+';
+		if (abs(e10) < 10)
+			buf[len++] = '0';
+		len += uint_to_text(abs(e10), buf + len);
+	} else if (e10 >= 0) {
+		for (i = 0; i <= (unsigned int)e10; i++)
+			buf[len++] = i < n ? digits[i] : '0';
+		if (n > (unsigned int)e10 + 1) {
+			buf[len++] = '.';
+			memcpy(buf + len, digits + e10 + 1, n - e10 - 1);
+			len += n - e10 - 1;
+		}
+	} else {
+		buf[len++] = '0';
+		buf[len++] = '.';
+		for (i = 1; i < (unsigned int)-e10; i++)
+			buf[len++] = '0';
+		memcpy(buf + len, digits, n);
+		len += n;
+	}
+
+	buf[len] = '\0';
+	return len;
+}
+
+struct data_export * data_export_new(const char *filename,
+		unsigned int num_columns, unsigned int num_rows)
+{
+	struct data_export *exp;
+
+	exp = g_new0(struct data_export, 1);
+	exp->filename = g_strdup(filename);
+	exp->columns = g_new0(float *, num_columns);
+	exp->num_columns = num_columns;
+	exp->num_rows = num_rows;
+
+	return exp;
+}
+
+static void data_export_release_raw(struct data_export *exp)
+{
+	if (!exp->raw_borrowed)
+		g_free(exp->raw);
+	else if (exp->raw_release)
+		exp->raw_release(exp->raw_release_data);
+	exp->raw = NULL;
+	exp->raw_size = 0;
+	exp->raw_borrowed = false;
+	exp->raw_release = NULL;
+}
+
+void data_export_free(struct data_export *exp)
+{
+	unsigned int i;
+
+	if (!exp)
+		return;
+
+	if (exp->fp)
+		fclose(exp->fp);
+	for (i = 0; i < exp->num_columns; i++)
+		g_free(exp->columns[i]);
+	g_free(exp->columns);
+	g_free(exp->header);
+	data_export_release_raw(exp);
+	g_free(exp->sidecar_filename);
+	g_free(exp->sidecar);
+	g_free(exp->filename);
+	g_free(exp);
+}
+
+void data_export_set_column(struct data_export *exp, unsigned int column,
+		const float *data)
+{
+	g_free(exp->columns[column]);
+	exp->columns[column] = g_malloc(exp->num_rows * sizeof(float));
+	memcpy(exp->columns[column], data, exp->num_rows * sizeof(float));
+}
+
+/* Takes ownership of @data, which must come from the glib allocator */
+void data_export_set_raw(struct data_export *exp, void *data, size_t size)
+{
+	data_export_release_raw(exp);
+	exp->raw = data;
+	exp->raw_size = size;
+}
+
+/* Writes @data in place; @release is called once it is not read any more,
+ * whether the export completed or not */
+void data_export_set_raw_ref(struct data_export *exp, const void *data,
+		size_t size, void (*release)(void *data), void *release_data)
+{
+	data_export_release_raw(exp);
+	exp->raw = (void *)data;
+	exp->raw_size = size;
+	exp->raw_borrowed = true;
+	exp->raw_release = release;
+	exp->raw_release_data = release_data;
+}
+
+static gboolean data_export_finish(gpointer data)
+{
+	struct data_export *exp = data;
+
+	g_thread_join(exp->thread);
+	exp->thread = NULL;
+
+	if (fclose(exp->fp) && !exp->error)
+		exp->error = errno;
+	exp->fp = NULL;
+	if (exp->error) {
+		remove(exp->filename);
+		if (exp->sidecar_filename)
+			remove(exp->sidecar_filename);
+	}
+
+	if (exp->done)
+		exp->done(exp, exp->done_data);
+	else
+		data_export_free(exp);
+
+	return FALSE;
+}
+
+static gpointer data_export_thread(gpointer data)
+{
+	struct data_export *exp = data;
+	int ret;
+
+	ret = exp->writer(exp);
+	if (ret < 0)
+		exp->error = -ret;
+	data_export_release_raw(exp);
+
+	g_idle_add(data_export_finish, exp);
+
+	return NULL;
+}
+
+/* The file is opened right away, so that a bad path is reported to the
+ * caller; returns 0 or a negative errno value */
+int data_export_start(struct data_export *exp, data_export_writer writer,
+		data_export_done done, void *done_data)
+{
+	exp->fp = fopen(exp->filename, "w");
+	if (!exp->fp)
+		return -errno;
+
+	/* The writers hand over large blocks already */
+	setvbuf(exp->fp, NULL, _IONBF, 0);
+
+	exp->writer = writer;
+	exp->done = done;
+	exp->done_data = done_data;
+	exp->thread = g_thread_new("Data export", data_export_thread, exp);
+
+	return 0;
+}
+
+/* The done callback still runs, with error set to ECANCELED */
+void data_export_cancel(struct data_export *exp)
+{
+	g_atomic_int_set(&exp->cancel, 1);
+}
+
+double data_export_progress(struct data_export *exp)
+{
+	if (!exp->num_rows)
+		return 1.0;
+
+	return (double)g_atomic_int_get(&exp->rows_done) / exp->num_rows;
+}
+
+static int data_export_flush(struct data_export *exp, const char *buf,
+		size_t len)
+{
+	if (len && fwrite(buf, 1, len, exp->fp) != len)
+		return errno ? -errno : -EIO;
+
+	return 0;
+}
+
+/* One line per sample, each value followed by the separator */
+int data_export_write_text(struct data_export *exp)
+{
+	size_t sep_len = strlen(exp->separator);
+	size_t row_max = exp->num_columns * (FLOAT_TEXT_MAX + sep_len) + 1;
+	size_t size = MAX(EXPORT_BUFFER_SIZE, 2 * row_max);
+	size_t pos = 0;
+	unsigned int row, col;
+	char *buf;
+	int ret;
+
+	buf = g_try_malloc(size);
+	if (!buf)
+		return -ENOMEM;
+
+	if (exp->header) {
+		ret = data_export_flush(exp, exp->header, strlen(exp->header));
+		if (ret < 0)
+			goto out;
+	}
+
+	for (row = 0; row < exp->num_rows; row++) {
+		if (row % EXPORT_ROWS_PER_STEP == 0) {
+			if (g_atomic_int_get(&exp->cancel)) {
+				ret = -ECANCELED;
+				goto out;
+			}
+			g_atomic_int_set(&exp->rows_done, row);
+		}
+
+		if (pos + row_max > size) {
+			ret = data_export_flush(exp, buf, pos);
+			if (ret < 0)
+				goto out;
+			pos = 0;
+		}
+
+		for (col = 0; col < exp->num_columns; col++) {
+			pos += float_to_text(exp->columns[col][row], buf + pos);
+			memcpy(buf + pos, exp->separator, sep_len);
+			pos += sep_len;
+		}
+		buf[pos++] = '\n';
+	}
+
+	ret = data_export_flush(exp, buf, pos);
+	if (ret == 0 && exp->trailer)
+		ret = data_export_flush(exp, exp->trailer, strlen(exp->trailer));
+	if (ret == 0)
+		g_atomic_int_set(&exp->rows_done, exp->num_rows);
+out:
+	g_free(buf);
+	return ret;
+}
+
+int data_export_write_sidecar(struct data_export *exp)
+{
+	GError *err = NULL;
+	int ret = 0;
+
+	if (!exp->sidecar_filename)
+		return 0;
+
+	if (!g_file_set_contents(exp->sidecar_filename, exp->sidecar, -1, &err)) {
+		fprintf(stderr, "%s\n", err->message);
+		g_error_free(err);
+		ret = -EIO;
+	}
+
+	return ret;
+}
+
+/* The raw samples, in blocks, followed by the sidecar file if any */
+int data_export_write_raw(struct data_export *exp)
+{
+	const char *data = exp->raw;
+	size_t pos, len;
+	int ret;
+
+	for (pos = 0; pos < exp->raw_size; pos += len) {
+		if (g_atomic_int_get(&exp->cancel))
+			return -ECANCELED;
+		g_atomic_int_set(&exp->rows_done,
+				(double)pos / exp->raw_size * exp->num_rows);
+
+		len = MIN(exp->raw_size - pos, EXPORT_BUFFER_SIZE);
+		ret = data_export_flush(exp, data + pos, len);
+		if (ret < 0)
+			return ret;
+	}
+
+	ret = data_export_write_sidecar(exp);
+	if (ret == 0)
+		g_atomic_int_set(&exp->rows_done, exp->num_rows);
+
+	return ret;
+}
+
+/* ISO 8601 in UTC, as SigMF wants it */
+static json_t * sigmf_datetime(gint64 time)
+{
+	GDateTime *date;
+	char *text, *full;
+	json_t *ret;
+
+	date = g_date_time_new_from_unix_utc(time / G_USEC_PER_SEC);
+	text = g_date_time_format(date, "%Y-%m-%dT%H:%M:%S");
+	full = g_strdup_printf("%s.%06uZ", text,
+			(unsigned int)(time % G_USEC_PER_SEC));
+	ret = json_string(full);
+	g_free(full);
+	g_free(text);
+	g_date_time_unref(date);
+
+	return ret;
+}
+
+char * sigmf_meta_to_json(const struct sigmf_meta *meta)
+{
+	json_t *root, *global, *captures, *capture, *annotations;
+	char *text, *ret;
+	unsigned int i;
+
+	global = json_object();
+	json_object_set_new(global, "core:datatype",
+			json_string(meta->datatype));
+	if (meta->sample_rate > 0)
+		json_object_set_new(global, "core:sample_rate",
+				json_real(meta->sample_rate));
+	json_object_set_new(global, "core:version", json_string("1.0.0"));
+	json_object_set_new(global, "core:num_channels",
+			json_integer(meta->num_channels));
+	if (meta->hw)
+		json_object_set_new(global, "core:hw", json_string(meta->hw));
+	json_object_set_new(global, "core:recorder",
+			json_string("IIO Oscilloscope"));
+
+	captures = json_array();
+	for (i = 0; i < meta->num_captures; i++) {
+		capture = json_object();
+		json_object_set_new(capture, "core:sample_start",
+				json_integer(meta->captures[i].sample_start));
+		if (meta->frequency)
+			json_object_set_new(capture, "core:frequency",
+					json_real(meta->frequency));
+		json_object_set_new(capture, "core:datetime",
+				sigmf_datetime(meta->captures[i].time));
+		json_array_append_new(captures, capture);
+	}
+
+	annotations = json_array();
+	if (meta->label)
+		json_array_append_new(annotations, json_pack("{s:I, s:I, s:s}",
+				"core:sample_start", (json_int_t)meta->label_start,
+				"core:sample_count", (json_int_t)meta->label_count,
+				"core:label", meta->label));
+
+	root = json_object();
+	json_object_set_new(root, "global", global);
+	json_object_set_new(root, "captures", captures);
+	json_object_set_new(root, "annotations", annotations);
+
+	text = json_dumps(root, JSON_INDENT(4) | JSON_PRESERVE_ORDER);
+	json_decref(root);
+	ret = g_strdup(text);
+	free(text);
+
+	return ret;
+}
@@ -0,0 +1,112 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __DATA_EXPORT_H__
+#define __DATA_EXPORT_H__
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <glib.h>
+
+/* Longest text float_to_text() produces, with the terminating NUL */
+#define FLOAT_TEXT_MAX 16
+
+unsigned int float_to_text(float value, char *buf);
+
+/* Saving a capture to a file on a worker thread. The channels are copied
+ * when the export is set up, so capturing can go on while it runs, unless
+ * the raw samples are borrowed; the callback is invoked from the main loop
+ * once the file is complete, failed or was cancelled (in which case it is
+ * removed).
+ */
+struct data_export;
+
+typedef int (*data_export_writer)(struct data_export *exp);
+typedef void (*data_export_done)(struct data_export *exp, void *data);
+
+struct data_export {
+	char *filename;
+	FILE *fp;
+
+	/* Snapshot of the channels; all of them hold num_rows samples */
+	float **columns;
+	unsigned int num_columns;
+	unsigned int num_rows;
+
+	/* Text formats: the header, the string after each value and the one
+	 * after the last row */
+	char *header;
+	const char *separator;
+	const char *trailer;
+
+	/* Binary formats: the samples as they go to the file. Borrowed ones
+	 * are handed back through raw_release, from the worker thread, as soon
+	 * as they are written */
+	void *raw;
+	size_t raw_size;
+	bool raw_borrowed;
+	void (*raw_release)(void *data);
+	void *raw_release_data;
+
+	/* Written next to the data once it is complete, e.g. the metadata */
+	char *sidecar_filename;
+	char *sidecar;
+
+	data_export_writer writer;
+	void *writer_data;
+	data_export_done done;
+	void *done_data;
+	GThread *thread;
+
+	/* Shared with the main loop */
+	volatile gint rows_done;
+	volatile gint cancel;
+
+	/* 0, or the errno value the export failed with */
+	int error;
+};
+
+struct data_export * data_export_new(const char *filename,
+		unsigned int num_columns, unsigned int num_rows);
+void data_export_free(struct data_export *exp);
+void data_export_set_column(struct data_export *exp, unsigned int column,
+		const float *data);
+void data_export_set_raw(struct data_export *exp, void *data, size_t size);
+void data_export_set_raw_ref(struct data_export *exp, const void *data,
+		size_t size, void (*release)(void *data), void *release_data);
+int data_export_start(struct data_export *exp, data_export_writer writer,
+		data_export_done done, void *done_data);
+void data_export_cancel(struct data_export *exp);
+double data_export_progress(struct data_export *exp);
+
+int data_export_write_text(struct data_export *exp);
+int data_export_write_raw(struct data_export *exp);
+int data_export_write_sidecar(struct data_export *exp);
+
+/* SigMF metadata. A recording made of several captures lists where each
+ * one starts; the optional annotation marks a span of samples. */
+struct sigmf_capture {
+	unsigned long long sample_start;
+	gint64 time;		/* microseconds since the epoch */
+};
+
+struct sigmf_meta {
+	const char *datatype;
+	double sample_rate;	/* 0 if unknown */
+	unsigned int num_channels;
+	const char *hw;
+	double frequency;	/* 0 if unknown */
+	const struct sigmf_capture *captures;
+	unsigned int num_captures;
+	const char *label;	/* NULL for no annotation */
+	unsigned long long label_start;
+	unsigned long long label_count;
+};
+
+char * sigmf_meta_to_json(const struct sigmf_meta *meta);
+
+#endif /* __DATA_EXPORT_H__ */
@@ -15,6 +15,11 @@
 
 #include <iio.h>
 
+#include "sample_ops.h"
+#include "density_plot.h"
+#include "zoom_fft.h"
+#include "tone_dft.h"
+
 #define FORCE_UPDATE TRUE
 #define NORMAL_UPDATE FALSE
 
@@ -65,6 +70,15 @@ struct extra_dev_info {
 	gfloat **channels_data_copy;
 	GSList *plots_sample_counts;
 	gfloat plugin_fft_corr;
+	/* Incremented every time new samples are demuxed into the channels */
+	unsigned long capture_generation;
+	/* The buffer still holds the samples of the last capture */
+	bool buffer_holds_capture;
+	/* Exports writing straight from the buffer; while there are any, it
+	 * is neither refilled nor destroyed */
+	volatile gint buffer_exports;
+	/* Keeps the last seconds of raw samples, NULL when disabled */
+	struct flight_recorder *recorder;
 };
 
 struct buffer {
@@ -122,6 +136,8 @@ struct _time_settings {
 	gboolean apply_add_funct;
 	gfloat multiply_value;
 	gfloat add_value;
+	sample_op_kernel post_process;
+	struct sample_op_params post_process_params;
 };
 
 struct _fft_settings {
@@ -135,12 +151,24 @@ struct _fft_settings {
 	struct marker_type **markers_copy;
 	GMutex *marker_lock;
 	enum marker_types *marker_type;
+	unsigned int zoom;
+	double zoom_center;
+	struct zoom_fft *zoom_fft;
+	gfloat *zoom_data;
+	gfloat *zoom_source_i;
+	gfloat *zoom_source_q;
+	bool markers_only;
+	struct tone_dft *tone_dft;
 };
 
 struct _constellation_settings {
 	gfloat *x_source;
 	gfloat *y_source;
 	unsigned int num_samples;
+	bool density_mode;
+	gfloat density_decay;
+	struct density_map *density;
+	GSList *density_graphs;
 };
 
 struct _cross_correlation_settings {
@@ -172,6 +200,9 @@ struct _freq_spectrum_settings {
 	unsigned fft_count;
 	double freq_sweep_start;
 	double filter_bandwidth;
+	double freq_step;
+	unsigned fft_step_bins;
+	gfloat *blend;
 	unsigned int fft_size;
 	unsigned int fft_avg;
 	gfloat fft_pwr_off;
@@ -0,0 +1,223 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "density_plot.h"
+
+/* Number of samples that get their bin index computed in one go */
+#define DENSITY_CHUNK 1024
+
+struct density_map * density_map_new(unsigned int width, unsigned int height,
+		unsigned int levels)
+{
+	struct density_map *map;
+	unsigned int i, cells = width * height;
+
+	if (!cells || !levels)
+		return NULL;
+
+	map = calloc(1, sizeof(*map));
+	if (!map)
+		return NULL;
+
+	map->width = width;
+	map->height = height;
+	map->levels = levels;
+	map->bins = calloc(cells, sizeof(*map->bins));
+	map->index = malloc(DENSITY_CHUNK * sizeof(*map->index));
+	map->level_x = calloc(levels, sizeof(*map->level_x));
+	map->level_y = calloc(levels, sizeof(*map->level_y));
+	map->level_len = calloc(levels, sizeof(*map->level_len));
+	if (!map->bins || !map->index || !map->level_x || !map->level_y ||
+			!map->level_len)
+		goto err;
+
+	for (i = 0; i < levels; i++) {
+		map->level_x[i] = calloc(cells, sizeof(float));
+		map->level_y[i] = calloc(cells, sizeof(float));
+		if (!map->level_x[i] || !map->level_y[i])
+			goto err;
+	}
+
+	return map;
+err:
+	density_map_destroy(map);
+	return NULL;
+}
+
+void density_map_destroy(struct density_map *map)
+{
+	unsigned int i;
+
+	if (!map)
+		return;
+
+	for (i = 0; map->level_x && i < map->levels; i++)
+		free(map->level_x[i]);
+	for (i = 0; map->level_y && i < map->levels; i++)
+		free(map->level_y[i]);
+	free(map->level_x);
+	free(map->level_y);
+	free(map->level_len);
+	free(map->index);
+	free(map->bins);
+	free(map);
+}
+
+void density_map_set_decay(struct density_map *map, float decay)
+{
+	if (decay < 0.0f)
+		decay = 0.0f;
+	else if (decay > 0.99f)
+		decay = 0.99f;
+
+	map->decay = decay;
+}
+
+void density_map_clear(struct density_map *map)
+{
+	memset(map->bins, 0, map->width * map->height * sizeof(*map->bins));
+}
+
+/* Non-finite samples are ignored; returns false if there are none left */
+static bool find_extent(const float *data, unsigned int count,
+		float *min, float *max)
+{
+	float lo = INFINITY, hi = -INFINITY;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (!isfinite(data[i]))
+			continue;
+		lo = (data[i] < lo) ? data[i] : lo;
+		hi = (data[i] > hi) ? data[i] : hi;
+	}
+
+	*min = lo;
+	*max = hi;
+
+	return lo <= hi;
+}
+
+/* Make the grid cover [min, max] with some margin around it */
+static void fit_range(float min, float max, float *lo, float *hi)
+{
+	float margin = (max - min) * 0.1f;
+
+	if (margin == 0.0f)
+		margin = 1.0f;
+
+	*lo = min - margin;
+	*hi = max + margin;
+}
+
+void density_map_accumulate(struct density_map *map,
+		const float *x, const float *y, unsigned int count)
+{
+	float x_min, x_max, y_min, y_max;
+	float x_scale, y_scale, x_off, y_off;
+	float x_last = map->width - 1, y_last = map->height - 1;
+	unsigned int width = map->width;
+	unsigned int i, j, n, cells = map->width * map->height;
+	float *bins = map->bins;
+	unsigned int *index = map->index;
+
+	if (!count)
+		return;
+
+	/* Re-fit the grid when data falls outside of it. The old frames
+	 * don't map onto the new grid, so they are dropped. */
+	if (!find_extent(x, count, &x_min, &x_max) ||
+			!find_extent(y, count, &y_min, &y_max))
+		return;
+	if (!map->range_valid ||
+			x_min < map->x_min || x_max > map->x_max ||
+			y_min < map->y_min || y_max > map->y_max) {
+		fit_range(x_min, x_max, &map->x_min, &map->x_max);
+		fit_range(y_min, y_max, &map->y_min, &map->y_max);
+		map->range_valid = true;
+		density_map_clear(map);
+	} else if (map->decay > 0.0f) {
+		const float decay = map->decay;
+
+		for (i = 0; i < cells; i++)
+			bins[i] *= decay;
+	} else {
+		density_map_clear(map);
+	}
+
+	x_scale = map->width / (map->x_max - map->x_min);
+	y_scale = map->height / (map->y_max - map->y_min);
+	x_off = -map->x_min * x_scale;
+	y_off = -map->y_min * y_scale;
+
+	/* The cell indexes are computed in a vectorizable loop; only the
+	 * scatter into the bins is done one sample at a time. Non-finite
+	 * samples get the out of range index "cells" and are skipped, since
+	 * casting them to an unsigned int is undefined. */
+	for (i = 0; i < count; i += n) {
+		n = count - i;
+		if (n > DENSITY_CHUNK)
+			n = DENSITY_CHUNK;
+
+		for (j = 0; j < n; j++) {
+			float cx = x[i + j] * x_scale + x_off;
+			float cy = y[i + j] * y_scale + y_off;
+
+			cx = (cx > x_last) ? x_last : cx;
+			cy = (cy > y_last) ? y_last : cy;
+			cx = (cx < 0.0f) ? 0.0f : cx;
+			cy = (cy < 0.0f) ? 0.0f : cy;
+			if (isfinite(cx) && isfinite(cy))
+				index[j] = (unsigned int)cy * width + (unsigned int)cx;
+			else
+				index[j] = cells;
+		}
+
+		for (j = 0; j < n; j++)
+			if (index[j] < cells)
+				bins[index[j]] += 1.0f;
+	}
+}
+
+void density_map_update_levels(struct density_map *map)
+{
+	unsigned int i, lvl, cells = map->width * map->height;
+	float x_step, y_step, peak = 0.0f, norm;
+
+	for (i = 0; i < cells; i++)
+		peak = (map->bins[i] > peak) ? map->bins[i] : peak;
+
+	for (lvl = 0; lvl < map->levels; lvl++)
+		map->level_len[lvl] = 0;
+
+	if (peak == 0.0f)
+		return;
+
+	/* Levels follow the log of the hit count, so sparse trajectories
+	 * stay visible next to a dense constellation point */
+	norm = map->levels / log1pf(peak);
+	x_step = (map->x_max - map->x_min) / map->width;
+	y_step = (map->y_max - map->y_min) / map->height;
+
+	for (i = 0; i < cells; i++) {
+		unsigned int n;
+
+		if (map->bins[i] < 0.5f)
+			continue;
+
+		lvl = (unsigned int)(log1pf(map->bins[i]) * norm);
+		if (lvl >= map->levels)
+			lvl = map->levels - 1;
+
+		n = map->level_len[lvl]++;
+		map->level_x[lvl][n] = map->x_min + ((i % map->width) + 0.5f) * x_step;
+		map->level_y[lvl][n] = map->y_min + ((i / map->width) + 0.5f) * y_step;
+	}
+}
@@ -0,0 +1,52 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __DENSITY_PLOT_H__
+#define __DENSITY_PLOT_H__
+
+#include <stdbool.h>
+
+#define DENSITY_GRID_SIZE	128
+#define DENSITY_LEVELS		8
+
+/* A 2D histogram of (x, y) points, rendered as a set of intensity levels.
+ * Each level holds the centers of the grid cells whose hit count falls in
+ * that level, so drawing costs depend on the grid size only.
+ */
+struct density_map {
+	unsigned int width;
+	unsigned int height;
+	unsigned int levels;
+
+	/* Area covered by the grid; adjusted automatically to the data */
+	float x_min, x_max;
+	float y_min, y_max;
+	bool range_valid;
+
+	/* Weight of the previous frames (0 - no persistence, < 1) */
+	float decay;
+
+	float *bins;
+	unsigned int *index;
+
+	/* Output: cell centers of each level; arrays hold width * height
+	 * points, of which the first level_len[level] are in use */
+	float **level_x;
+	float **level_y;
+	unsigned int *level_len;
+};
+
+struct density_map * density_map_new(unsigned int width, unsigned int height,
+		unsigned int levels);
+void density_map_destroy(struct density_map *map);
+void density_map_set_decay(struct density_map *map, float decay);
+void density_map_clear(struct density_map *map);
+void density_map_accumulate(struct density_map *map,
+		const float *x, const float *y, unsigned int count);
+void density_map_update_levels(struct density_map *map);
+
+#endif /* __DENSITY_PLOT_H__ */
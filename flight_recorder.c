@@ -0,0 +1,353 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+
+#include "flight_recorder.h"
+#include "data_export.h"
+
+/* Number of refills whose position and time are remembered */
+#define FLIGHT_RECORDER_SEGMENTS 1024
+
+/* Size of the blocks the dump hands to the C library */
+#define FLIGHT_RECORDER_CHUNK (1 << 20)
+
+/* An event goes through these states. Only a reporter that moved it from
+ * IDLE to CLAIMED writes the event fields; it publishes them with PENDING.
+ * Only the capture loop moves it from PENDING to DUMPING, and only the end
+ * of the dump back to IDLE. */
+enum flight_recorder_event_state {
+	FLIGHT_RECORDER_IDLE,
+	FLIGHT_RECORDER_CLAIMED,
+	FLIGHT_RECORDER_PENDING,
+	FLIGHT_RECORDER_DUMPING,
+};
+
+struct flight_recorder {
+	char *ring;
+	size_t frame_size;
+	unsigned long long capacity;
+	unsigned long long pre, post;
+
+	/* Frames stored so far, and the end of the frames being stored. The
+	 * slots between written and writing_end (minus the capacity) are
+	 * not to be trusted by the dump thread. */
+	unsigned long long written;
+	unsigned long long writing_end;
+
+	/* Every refill is a separate capture, with a gap before it */
+	struct sigmf_capture segments[FLIGHT_RECORDER_SEGMENTS];
+	unsigned int num_segments;
+
+	char *dir;
+	char *name;
+	char *datatype;
+	unsigned int num_channels;
+	double sample_rate;
+	char *hw;
+	double frequency;
+
+	/* Events may be reported from other threads than the capture loop,
+	 * e.g. by the FFT of a plot */
+	int event_state;
+	unsigned long long event_frame;
+	char *event_reason;
+	bool level_above;
+
+	/* Saving in progress, frames [dump_start, dump_end) */
+	unsigned long long dump_start, dump_end;
+
+	/* Held by the owner and by a dump in progress */
+	int refs;
+};
+
+struct flight_recorder * flight_recorder_new(
+		const struct flight_recorder_params *params)
+{
+	struct flight_recorder *rec;
+	unsigned long long capacity = params->capacity;
+
+	/* The progress of a dump is counted in an int */
+	if (capacity > G_MAXINT)
+		capacity = G_MAXINT;
+	if (!params->frame_size || !capacity)
+		return NULL;
+
+	rec = g_new0(struct flight_recorder, 1);
+	rec->ring = g_try_malloc((size_t)capacity * params->frame_size);
+	if (!rec->ring) {
+		fprintf(stderr, "Flight recorder: unable to allocate %llu bytes\n",
+				capacity * params->frame_size);
+		g_free(rec);
+		return NULL;
+	}
+
+	rec->frame_size = params->frame_size;
+	rec->capacity = capacity;
+	rec->pre = params->pre;
+	rec->post = params->post;
+
+	/* Leave a quarter of the ring to the capture running meanwhile */
+	if (rec->pre + rec->post > capacity / 4 * 3) {
+		rec->pre = rec->pre * (capacity / 4 * 3) / (rec->pre + rec->post);
+		rec->post = capacity / 4 * 3 - rec->pre;
+	}
+
+	rec->dir = g_strdup(params->dir);
+	rec->name = g_strdup(params->name);
+	rec->datatype = g_strdup(params->datatype);
+	rec->num_channels = params->num_channels;
+	rec->sample_rate = params->sample_rate;
+	rec->hw = g_strdup(params->hw);
+	rec->frequency = params->frequency;
+	rec->refs = 1;
+
+	return rec;
+}
+
+static void flight_recorder_free(struct flight_recorder *rec)
+{
+	g_free(rec->ring);
+	g_free(rec->dir);
+	g_free(rec->name);
+	g_free(rec->datatype);
+	g_free(rec->hw);
+	g_free(rec->event_reason);
+	g_free(rec);
+}
+
+static void flight_recorder_unref(struct flight_recorder *rec)
+{
+	if (__atomic_sub_fetch(&rec->refs, 1, __ATOMIC_ACQ_REL) == 0)
+		flight_recorder_free(rec);
+}
+
+/* A dump in progress is completed first */
+void flight_recorder_destroy(struct flight_recorder *rec)
+{
+	if (rec)
+		flight_recorder_unref(rec);
+}
+
+unsigned long long flight_recorder_position(const struct flight_recorder *rec)
+{
+	return __atomic_load_n(&rec->written, __ATOMIC_RELAXED);
+}
+
+static int flight_recorder_write(struct data_export *exp)
+{
+	struct flight_recorder *rec = exp->writer_data;
+	unsigned long long frame, end = rec->dump_end, pos, n, limit;
+	size_t chunk = MAX(FLIGHT_RECORDER_CHUNK / rec->frame_size, 1);
+
+	for (frame = rec->dump_start; frame < end; frame += n) {
+		if (g_atomic_int_get(&exp->cancel))
+			return -ECANCELED;
+		g_atomic_int_set(&exp->rows_done, frame - rec->dump_start);
+
+		pos = frame % rec->capacity;
+		n = MIN(MIN(end - frame, rec->capacity - pos), chunk);
+		if (fwrite(rec->ring + pos * rec->frame_size, rec->frame_size,
+					n, exp->fp) != n)
+			return errno ? -errno : -EIO;
+
+		/* Pairs with the fence in flight_recorder_append(): if any of
+		 * the frames was overwritten, writing_end says so */
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		limit = __atomic_load_n(&rec->writing_end, __ATOMIC_RELAXED);
+		if (limit > rec->capacity && frame < limit - rec->capacity) {
+			fprintf(stderr, "Flight recorder: the capture overtook "
+					"the dump of %s\n", exp->filename);
+			return -EOVERFLOW;
+		}
+	}
+
+	return data_export_write_sidecar(exp);
+}
+
+static void flight_recorder_dump_done(struct data_export *exp, void *data)
+{
+	struct flight_recorder *rec = data;
+
+	if (exp->error)
+		fprintf(stderr, "Flight recorder: failed to save %s: %s\n",
+				exp->filename, strerror(exp->error));
+	else
+		printf("Flight recorder: saved %s\n", exp->filename);
+
+	data_export_free(exp);
+	__atomic_store_n(&rec->event_state, FLIGHT_RECORDER_IDLE,
+			__ATOMIC_RELEASE);
+	flight_recorder_unref(rec);
+}
+
+static char * flight_recorder_meta(struct flight_recorder *rec)
+{
+	struct sigmf_capture *captures;
+	struct sigmf_meta meta = { 0 };
+	unsigned int i, first, num = 0, count;
+	char *text;
+
+	count = MIN(rec->num_segments, FLIGHT_RECORDER_SEGMENTS);
+	captures = g_new(struct sigmf_capture, count + 1);
+
+	/* Oldest to newest; the one the window starts in is pulled back to
+	 * the start of the window */
+	first = rec->num_segments - count;
+	for (i = first; i < rec->num_segments; i++) {
+		struct sigmf_capture *seg =
+			&rec->segments[i % FLIGHT_RECORDER_SEGMENTS];
+
+		if (seg->sample_start >= rec->dump_end)
+			break;
+		if (seg->sample_start <= rec->dump_start)
+			num = 0;
+		captures[num] = *seg;
+		captures[num].sample_start = seg->sample_start <= rec->dump_start ?
+			0 : seg->sample_start - rec->dump_start;
+		num++;
+	}
+
+	meta.datatype = rec->datatype;
+	meta.sample_rate = rec->sample_rate;
+	meta.num_channels = rec->num_channels;
+	meta.hw = rec->hw;
+	meta.frequency = rec->frequency;
+	meta.captures = captures;
+	meta.num_captures = num;
+	meta.label = rec->event_reason;
+	meta.label_start = rec->event_frame - rec->dump_start;
+	meta.label_count = 1;
+
+	text = sigmf_meta_to_json(&meta);
+	g_free(captures);
+
+	return text;
+}
+
+/* From the capture loop, once the pending event is complete */
+static void flight_recorder_dump(struct flight_recorder *rec)
+{
+	struct data_export *exp;
+	GDateTime *now;
+	char *stamp, *base, *path;
+	unsigned long long oldest;
+	int ret;
+
+	__atomic_store_n(&rec->event_state, FLIGHT_RECORDER_DUMPING,
+			__ATOMIC_RELAXED);
+
+	oldest = rec->written > rec->capacity ? rec->written - rec->capacity : 0;
+	rec->dump_start = rec->event_frame > rec->pre ?
+		rec->event_frame - rec->pre : 0;
+	rec->dump_start = MAX(rec->dump_start, oldest);
+	rec->dump_end = MIN(rec->event_frame + rec->post, rec->written);
+
+	now = g_date_time_new_now_local();
+	stamp = g_date_time_format(now, "%Y%m%d-%H%M%S");
+	g_date_time_unref(now);
+	base = g_strdup_printf("%s-%s", rec->name, stamp);
+	g_free(stamp);
+	g_strdelimit(base, G_DIR_SEPARATOR_S " ", '_');
+	path = g_build_filename(rec->dir, base, NULL);
+	g_free(base);
+
+	base = g_strdup_printf("%s.sigmf-data", path);
+	exp = data_export_new(base, 0, rec->dump_end - rec->dump_start);
+	g_free(base);
+	if (rec->datatype) {
+		exp->sidecar_filename = g_strdup_printf("%s.sigmf-meta", path);
+		exp->sidecar = flight_recorder_meta(rec);
+	}
+	g_free(path);
+
+	exp->writer_data = rec;
+	__atomic_add_fetch(&rec->refs, 1, __ATOMIC_RELAXED);
+	ret = data_export_start(exp, flight_recorder_write,
+			flight_recorder_dump_done, rec);
+	if (ret < 0) {
+		fprintf(stderr, "Flight recorder: unable to create %s: %s\n",
+				exp->filename, strerror(-ret));
+		data_export_free(exp);
+		__atomic_store_n(&rec->event_state, FLIGHT_RECORDER_IDLE,
+				__ATOMIC_RELEASE);
+		flight_recorder_unref(rec);
+	}
+}
+
+/* Called by the capture loop with every buffer it receives */
+void flight_recorder_append(struct flight_recorder *rec,
+		const void *data, size_t frames)
+{
+	const char *src = data;
+	unsigned long long written = rec->written;
+	unsigned long long pos, first;
+	struct sigmf_capture *seg;
+
+	if (frames > rec->capacity) {
+		src += (frames - rec->capacity) * rec->frame_size;
+		written += frames - rec->capacity;
+		frames = rec->capacity;
+	}
+
+	/* Announce the slots about to be overwritten before touching them */
+	__atomic_store_n(&rec->writing_end, written + frames, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+
+	pos = written % rec->capacity;
+	first = MIN(frames, rec->capacity - pos);
+	memcpy(rec->ring + pos * rec->frame_size, src, first * rec->frame_size);
+	memcpy(rec->ring, src + first * rec->frame_size,
+			(frames - first) * rec->frame_size);
+
+	seg = &rec->segments[rec->num_segments++ % FLIGHT_RECORDER_SEGMENTS];
+	seg->sample_start = written;
+	seg->time = g_get_real_time();
+
+	__atomic_store_n(&rec->written, written + frames, __ATOMIC_RELAXED);
+
+	/* Pairs with the release in flight_recorder_event() */
+	if (__atomic_load_n(&rec->event_state, __ATOMIC_ACQUIRE) ==
+			FLIGHT_RECORDER_PENDING &&
+			written + frames >= rec->event_frame + rec->post)
+		flight_recorder_dump(rec);
+}
+
+/* Save the frames around @frame, a position of the ring; returns -EBUSY
+ * while the previous event is still being handled */
+int flight_recorder_event(struct flight_recorder *rec,
+		unsigned long long frame, const char *reason)
+{
+	int idle = FLIGHT_RECORDER_IDLE;
+
+	if (!__atomic_compare_exchange_n(&rec->event_state, &idle,
+				FLIGHT_RECORDER_CLAIMED, false,
+				__ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+		return -EBUSY;
+
+	g_free(rec->event_reason);
+	rec->event_reason = g_strdup(reason);
+	rec->event_frame = frame;
+	__atomic_store_n(&rec->event_state, FLIGHT_RECORDER_PENDING,
+			__ATOMIC_RELEASE);
+
+	return 0;
+}
+
+/* Report an event when the level goes above a threshold */
+void flight_recorder_level(struct flight_recorder *rec, bool above,
+		const char *reason)
+{
+	bool was_above = __atomic_exchange_n(&rec->level_above, above,
+			__ATOMIC_RELAXED);
+
+	if (above && !was_above)
+		flight_recorder_event(rec, flight_recorder_position(rec),
+				reason);
+}
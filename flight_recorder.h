@@ -0,0 +1,52 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __FLIGHT_RECORDER_H__
+#define __FLIGHT_RECORDER_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Flight recorder: a ring that keeps the most recent frames a device
+ * captured, as the hardware delivered them. When an event is reported, the
+ * frames around it are saved as a SigMF recording once the frames that
+ * follow it have arrived.
+ *
+ * The capture loop is the only writer and never waits; the file is written
+ * from the ring on a worker thread, which notices if the writer overtook
+ * it and then fails the dump instead of saving damaged data.
+ */
+struct flight_recorder;
+
+struct flight_recorder_params {
+	size_t frame_size;		/* bytes */
+	unsigned long long capacity;	/* frames */
+	unsigned long long pre, post;	/* frames saved around an event */
+	const char *dir;
+	const char *name;		/* used in the file names */
+
+	/* SigMF description; only the samples are saved without datatype */
+	const char *datatype;
+	unsigned int num_channels;
+	double sample_rate;
+	const char *hw;
+	double frequency;
+};
+
+struct flight_recorder * flight_recorder_new(
+		const struct flight_recorder_params *params);
+void flight_recorder_destroy(struct flight_recorder *rec);
+
+unsigned long long flight_recorder_position(const struct flight_recorder *rec);
+void flight_recorder_append(struct flight_recorder *rec,
+		const void *data, size_t frames);
+int flight_recorder_event(struct flight_recorder *rec,
+		unsigned long long frame, const char *reason);
+void flight_recorder_level(struct flight_recorder *rec, bool above,
+		const char *reason);
+
+#endif /* __FLIGHT_RECORDER_H__ */
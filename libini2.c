@@ -16,63 +16,68 @@
 
 struct load_store_params {
 	const struct iio_device *dev;
-	const char * const *whitelist;
-	size_t list_len;
+	GHashTable *whitelist;	/* of the whitelisted keys */
 	bool is_debug;
 	FILE *f;
-	struct INI *ini;
-	const void *section_top;
+	GHashTable *values;	/* key to value, of the driver's section */
 };
 
-static bool attr_matches(const char *dev_name, size_t dev_len,
-		const char *attr, size_t attr_len,
-		const char *key, size_t len, bool debug)
+/* The key of an attribute in the INI file: [debug.]<device>.<attribute> */
+static char * attr_key(const char *dev_name, const char *attr, bool is_debug)
 {
-	return (!debug && (len == dev_len + 1 + attr_len) &&
-			!strncmp(key, dev_name, dev_len) &&
-			!strncmp(key + dev_len + 1, attr, attr_len)) ||
-		(debug && (len == dev_len + sizeof("debug.") + attr_len) &&
-			!strncmp(key, "debug.", sizeof("debug.") - 1) &&
-			!strncmp(key + sizeof("debug.") - 1, dev_name, dev_len) &&
-			!strncmp(key + sizeof("debug.") + dev_len, attr, attr_len));
+	return g_strdup_printf("%s%s.%s", is_debug ? "debug." : "",
+			dev_name ? dev_name : "", attr);
 }
 
-static bool attr_in_whitelist(const char *attr,
-		const char *dev_name, size_t dev_len, bool is_debug,
-		const char * const *whitelist, size_t list_len)
+/* The whitelist is looked up for every attribute of the device */
+static GHashTable * whitelist_new(const char * const *whitelist,
+		size_t list_len)
 {
+	GHashTable *set = g_hash_table_new(g_str_hash, g_str_equal);
 	unsigned int i;
+
 	for (i = 0; i < list_len && whitelist[i]; i++)
-		if ((!is_debug && !strncmp(whitelist[i], dev_name, dev_len) &&
-					!strcmp(whitelist[i] + dev_len + 1, attr)) ||
-				(is_debug && !strncmp(whitelist[i], "debug.", sizeof("debug.") - 1) &&
-					!strncmp(whitelist[i] + sizeof("debug.") - 1, dev_name, dev_len) &&
-					!strcmp(whitelist[i] + sizeof("debug.") + dev_len, attr)))
-			return true;
-	return false;
+		g_hash_table_insert(set, (gpointer) whitelist[i], NULL);
+	return set;
 }
 
-static ssize_t read_from_ini(struct load_store_params *params,
-		const char *dev_name, size_t name_len,
-		const char *attr, void *buf, size_t len)
+/* The pairs of the current section of @ini, parsed once. The first one of
+ * a key wins, like it did when the section was scanned for each attribute. */
+static GHashTable * section_values_new(struct INI *ini)
 {
-	bool found = false;
+	GHashTable *values = g_hash_table_new_full(g_str_hash, g_str_equal,
+			g_free, g_free);
 	const char *key, *value;
 	size_t klen, vlen;
+	char *k;
+
+	while (ini_read_pair(ini, &key, &klen, &value, &vlen) > 0) {
+		k = g_strndup(key, klen);
+		if (g_hash_table_lookup_extended(values, k, NULL, NULL))
+			g_free(k);
+		else
+			g_hash_table_insert(values, k, g_strndup(value, vlen));
+	}
+	return values;
+}
 
-	if (!len)
-		return 0;
-
-	/* Rewind to the beginning of the section */
-	ini_set_read_pointer(params->ini, params->section_top);
-
-	while (!found && ini_read_pair(params->ini,
-				&key, &klen, &value, &vlen) > 0)
-		found = attr_matches(dev_name, name_len, attr, strlen(attr),
-				key, klen, params->is_debug);
-	if (!found)
+/* The value of the attribute, if it's whitelisted */
+static ssize_t read_from_ini(struct load_store_params *params,
+		const char *dev_name, const char *attr, bool is_debug,
+		void *buf, size_t len)
+{
+	char *key = attr_key(dev_name, attr, is_debug);
+	const char *value = NULL;
+	size_t vlen;
+
+	if (len && g_hash_table_lookup_extended(params->whitelist, key,
+				NULL, NULL))
+		value = g_hash_table_lookup(params->values, key);
+	g_free(key);
+	if (!value)
 		return 0;
 
+	vlen = strlen(value);
 	if (len > vlen)
 		len = vlen;
 	memcpy(buf, value, len);
@@ -83,14 +88,9 @@ static ssize_t update_from_ini_dev_cb(struct iio_device *dev,
 		const char *attr, void *buf, size_t len, void *d)
 {
 	struct load_store_params *params = (struct load_store_params *) d;
-	const char *dev_name = iio_device_get_name(dev);
-	size_t name_len = dev_name ? strlen(dev_name) : 0;
 
-	if (attr_in_whitelist(attr, dev_name, name_len, params->is_debug,
-				params->whitelist, params->list_len))
-		return read_from_ini(params,
-				dev_name, name_len, attr, buf, len);
-	return 0;
+	return read_from_ini(params, iio_device_get_name(dev), attr,
+			params->is_debug, buf, len);
 }
 
 static ssize_t update_from_ini_chn_cb(struct iio_channel *chn,
@@ -98,25 +98,20 @@ static ssize_t update_from_ini_chn_cb(struct iio_channel *chn,
 {
 	struct load_store_params *params = (struct load_store_params *) d;
 	const char *dev_name = iio_device_get_name(params->dev);
-	size_t name_len = dev_name ? strlen(dev_name) : 0;
 	bool is_hardwaregain = !strncmp(attr, "hardwaregain", len);
+	ssize_t ret;
 
 	attr = iio_channel_attr_get_filename(chn, attr);
-	if (attr_in_whitelist(attr, dev_name, name_len, false,
-				params->whitelist, params->list_len)) {
-		ssize_t ret = read_from_ini(params,
-				dev_name, name_len, attr, buf, len);
-
-		/* Dirty workaround that strips the "dB" suffix of
-		 * hardwaregain value. Fix me when possible. */
-		if (is_hardwaregain) {
-			char *tmp = strstr((char *) buf, " dB");
-			if (tmp)
-				*tmp = '\0';
-		}
-		return ret;
+	ret = read_from_ini(params, dev_name, attr, false, buf, len);
+
+	/* Dirty workaround that strips the "dB" suffix of
+	 * hardwaregain value. Fix me when possible. */
+	if (ret > 0 && is_hardwaregain) {
+		char *tmp = strstr((char *) buf, " dB");
+		if (tmp)
+			*tmp = '\0';
 	}
-	return 0;
+	return ret;
 }
 
 void update_from_ini(const char *ini_file,
@@ -130,10 +125,7 @@ void update_from_ini(const char *ini_file,
 	struct INI *ini = ini_open(ini_file);
 	struct load_store_params params = {
 		.dev = dev,
-		.whitelist = whitelist,
-		.list_len = list_len,
 		.is_debug = false,
-		.ini = ini,
 	};
 
 	if (!ini) {
@@ -155,7 +147,8 @@ void update_from_ini(const char *ini_file,
 		return;
 	}
 
-	params.section_top = name + nlen + 1;
+	params.whitelist = whitelist_new(whitelist, list_len);
+	params.values = section_values_new(ini);
 
 	for (i = 0; i < iio_device_get_channels_count(dev); i++)
 		iio_channel_attr_write_all(iio_device_get_channel(dev, i),
@@ -167,6 +160,8 @@ void update_from_ini(const char *ini_file,
 	params.is_debug = true;
 	iio_device_debug_attr_write_all(dev, update_from_ini_dev_cb, &params);
 
+	g_hash_table_destroy(params.values);
+	g_hash_table_destroy(params.whitelist);
 	ini_close(ini);
 }
 
@@ -200,30 +195,27 @@ char * read_token_from_ini(const char *ini_file,
 }
 
 static void write_to_ini(struct load_store_params *params, const char *dev_name,
-		size_t name_len, const char *attr, const char *val, size_t len)
+		const char *attr, bool is_debug, const char *val, size_t len)
 {
+	char *key = attr_key(dev_name, attr, is_debug);
 	FILE *f = params->f;
 
-	if (params->is_debug)
-		fwrite("debug.", 1, sizeof("debug.") - 1, f);
-	fwrite(dev_name, 1, name_len, f);
-	fwrite(".", 1, 1, f);
-	fwrite(attr, 1, strlen(attr), f);
-	fwrite(" = ", 1, sizeof(" = ") - 1, f);
-	fwrite(val, 1, len - 1, f);
-	fwrite("\n", 1, 1, f);
+	if (g_hash_table_lookup_extended(params->whitelist, key, NULL, NULL)) {
+		fwrite(key, 1, strlen(key), f);
+		fwrite(" = ", 1, sizeof(" = ") - 1, f);
+		fwrite(val, 1, len - 1, f);
+		fwrite("\n", 1, 1, f);
+	}
+	g_free(key);
 }
 
 static int save_to_ini_dev_cb(struct iio_device *dev,
 		const char *attr, const char *val, size_t len, void *d)
 {
 	struct load_store_params *params = (struct load_store_params *) d;
-	const char *dev_name = iio_device_get_name(dev);
-	size_t name_len = dev_name ? strlen(dev_name) : 0;
 
-	if (attr_in_whitelist(attr, dev_name, name_len, params->is_debug,
-				params->whitelist, params->list_len))
-		write_to_ini(params, dev_name, name_len, attr, val, len);
+	write_to_ini(params, iio_device_get_name(dev), attr, params->is_debug,
+			val, len);
 	return 0;
 }
 
@@ -231,13 +223,10 @@ static int save_to_ini_chn_cb(struct iio_channel *chn,
 		const char *attr, const char *val, size_t len, void *d)
 {
 	struct load_store_params *params = (struct load_store_params *) d;
-	const char *dev_name = iio_device_get_name(params->dev);
-	size_t name_len = dev_name ? strlen(dev_name) : 0;
 
 	attr = iio_channel_attr_get_filename(chn, attr);
-	if (attr_in_whitelist(attr, dev_name, name_len, false,
-				params->whitelist, params->list_len))
-		write_to_ini(params, dev_name, name_len, attr, val, len);
+	write_to_ini(params, iio_device_get_name(params->dev), attr, false,
+			val, len);
 	return 0;
 }
 
@@ -247,8 +236,7 @@ void save_to_ini(FILE *f, const char *driver_name, struct iio_device *dev,
 	unsigned int i;
 	struct load_store_params params = {
 		.dev = dev,
-		.whitelist = whitelist,
-		.list_len = list_len,
+		.whitelist = whitelist_new(whitelist, list_len),
 		.is_debug = false,
 		.f = f,
 	};
@@ -266,6 +254,8 @@ void save_to_ini(FILE *f, const char *driver_name, struct iio_device *dev,
 
 	params.is_debug = true;
 	iio_device_debug_attr_read_all(dev, save_to_ini_dev_cb, &params);
+
+	g_hash_table_destroy(params.whitelist);
 }
 
 int foreach_in_ini(const char *ini_file,
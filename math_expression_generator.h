@@ -22,11 +22,21 @@
 #include <unistd.h>
 #endif
 
+#include "math_expression_vm.h"
+
 #define MATH_OBJECT_FILES_DIR "math_expressions"
 #define MATH_EXPRESSION_BASE_FILE "math_expression"
 #define MATH_FUNCTION_NAME "expression_function"
+#define MATH_FUSED_FUNCTION_NAME "expression_function_fused"
+#define MATH_COMPILE_FLAGS "-O3 -march=native -fno-math-errno -fno-trapping-math " \
+	"-Wall -Werror -fpic"
+
+/* Bump when the generated source changes, so stale libraries aren't reused */
+#define MATH_CACHE_VERSION "2"
 
 typedef void (*math_function)(float ***channels_data, float *out_data, unsigned long long chn_sample_cnt);
+/* Evaluates several expressions of one device in a single pass */
+typedef void (*math_fused_function)(float ***channels_data, float **out_data, unsigned long long chn_sample_cnt);
 
 #ifdef linux
 static int remove_cb(const char *fpath, const struct stat *sb, int typeflag, struct FTW *ftwbuf)
@@ -40,12 +50,15 @@ static int recursive_remove(char *dirpath)
 	return nftw(dirpath, remove_cb, 64, FTW_DEPTH | FTW_PHYS);
 }
 
+/* Channel references become the pointers hoisted out of the loop; the
+ * indexes used are collected in @data so only those get declared. */
 static gboolean eval(const GMatchInfo *info, GString *res, gpointer data)
 {
+	GArray *used = data;
 	gchar *match;
-	gchar *replace;
 	int index;
 	char *pos;
+	guint i;
 
 	match = g_match_info_fetch(info, 0);
 	if (!match)
@@ -60,23 +73,28 @@ static gboolean eval(const GMatchInfo *info, GString *res, gpointer data)
 	else
 		index = 0;
 
-	replace = g_strdup_printf("(*channels_data[%d])[i]", index);
-	g_string_append(res, replace);
-	g_free(replace);
+	g_string_append_printf(res, "chn_%d[i]", index);
 	g_free(match);
 
+	for (i = 0; i < used->len; i++)
+		if (g_array_index(used, int, i) == index)
+			break;
+	if (i == used->len)
+		g_array_append_val(used, index);
+
 	return FALSE;
 }
 
 static char * string_replace(const char * string, const char *pattern,
-			const char *replacement, GRegexEvalCallback eval)
+			const char *replacement, GRegexEvalCallback eval,
+			gpointer data)
 {
 	GRegex *rex;
 	gchar *result;
 
 	rex = g_regex_new(pattern, 0, 0, NULL);
 	if (eval)
-		result = g_regex_replace_eval(rex, string, -1, 0, 0, eval, NULL, NULL);
+		result = g_regex_replace_eval(rex, string, -1, 0, 0, eval, data, NULL);
 	else
 		result = g_regex_replace_literal(rex, string, -1, 0, replacement, 0, NULL);
 	g_regex_unref(rex);
@@ -84,56 +102,140 @@ static char * string_replace(const char * string, const char *pattern,
 	return result;
 }
 
-static char * c_file_create(const char *user_expression, GSList *basenames)
+/* Compiled expressions are kept per user and reused across sessions */
+static char * math_cache_dir(void)
 {
-	char *base_filename, *open_path;
-	FILE *fp;
-	struct stat st;
-	static unsigned long long file_count = 0;
+	char *dir;
 
-	if (!user_expression) {
-		fprintf(stderr, "NULL user_expression parameter in %s", __func__);
+	dir = g_build_filename(g_get_user_cache_dir(), "osc",
+			MATH_OBJECT_FILES_DIR, NULL);
+	if (g_mkdir_with_parents(dir, S_IRWXU) != 0) {
+		fprintf(stderr, "Can't create %s: %s\n", dir, strerror(errno));
+		g_free(dir);
 		return NULL;
 	}
-	if (stat(MATH_OBJECT_FILES_DIR, &st) == -1) {
-		mkdir(MATH_OBJECT_FILES_DIR, S_IRWXU|S_IRWXG|S_IRWXO);
-	}
 
-	base_filename = g_strdup_printf("%s_%llu",
-		MATH_EXPRESSION_BASE_FILE, file_count++);
-	open_path = g_strdup_printf("%s/%s.c",
-		MATH_OBJECT_FILES_DIR, base_filename);
-	fp = fopen(open_path, "w+");
-	g_free(open_path);
-	if (!fp) {
-		perror(base_filename);
-		g_free(base_filename);
-		return NULL;
+	return dir;
+}
+
+/*
+ * Libraries are named after a hash of everything that goes into them: the
+ * expressions with their whitespace normalized, the function generated, the
+ * channel basenames they were resolved against, the compiler flags and the
+ * host.
+ */
+static char * math_cache_key(const char * const *expressions,
+		unsigned int num_expressions, GSList *basenames, const char *symbol)
+{
+	GChecksum *sum = g_checksum_new(G_CHECKSUM_SHA256);
+	const char *c;
+	bool space;
+	GSList *node;
+	unsigned int i;
+	char *key;
+
+	g_checksum_update(sum, (const guchar *)MATH_CACHE_VERSION, -1);
+	g_checksum_update(sum, (const guchar *)"", 1);
+	g_checksum_update(sum, (const guchar *)symbol, strlen(symbol) + 1);
+
+	for (i = 0; i < num_expressions; i++) {
+		space = false;
+		for (c = expressions[i]; *c; c++) {
+			if (g_ascii_isspace(*c)) {
+				space = true;
+				continue;
+			}
+			if (space && c != expressions[i])
+				g_checksum_update(sum, (const guchar *)" ", 1);
+			space = false;
+			g_checksum_update(sum, (const guchar *)c, 1);
+		}
+		g_checksum_update(sum, (const guchar *)"", 1);
 	}
 
+	for (node = basenames; node; node = g_slist_next(node))
+		g_checksum_update(sum, (const guchar *)node->data,
+				strlen(node->data) + 1);
+
+	g_checksum_update(sum, (const guchar *)MATH_COMPILE_FLAGS, -1);
+	/* -march=native code only runs on the machine that built it, and the
+	 * cache directory may be shared between hosts */
+	g_checksum_update(sum, (const guchar *)g_get_host_name(), -1);
+
+	key = g_strdup_printf("%s_%s", MATH_EXPRESSION_BASE_FILE,
+			g_checksum_get_string(sum));
+	g_checksum_free(sum);
+
+	return key;
+}
+
+/* Translate a user expression to C. Channel indexes it reads are appended
+ * to @used and PreviousValue becomes the "prev" carry of the loop. */
+static char * expression_to_c(const char *user_expression, GSList *basenames,
+		GArray *used)
+{
 	char *s1, *s2;
 	GSList *node;
-	char *buf, *old_expr, *new_expr = NULL;
+	char *buf;
 
-	old_expr = g_strdup(user_expression);
+	s1 = g_strdup(user_expression);
 	for (node = basenames; node; node = g_slist_next(node)) {
 		buf = g_strdup_printf("%s[0-9]+", (char *)node->data);
-		new_expr = string_replace(old_expr, buf, NULL, eval);
+		s2 = string_replace(s1, buf, NULL, eval, used);
 		g_free(buf);
-		g_free(old_expr);
-		old_expr = new_expr;
+		g_free(s1);
+		s1 = s2;
 	}
-	if (new_expr)
-		s1 = new_expr;
-	else
-		s1 = g_strdup(user_expression);
 
-	s2 = string_replace(s1, "Index", "i", NULL);
+	s2 = string_replace(s1, "Index", "i", NULL, NULL);
 	g_free(s1);
-	s1 = string_replace(s2, "PreviousValue", "(i > 0 ? out_data[i  -1] : 0)", NULL);
-	s2 = string_replace(s1, "SampleCount", "chn_sample_cnt", NULL);
+	s1 = string_replace(s2, "PreviousValue", "prev", NULL, NULL);
+	g_free(s2);
+	s2 = string_replace(s1, "SampleCount", "chn_sample_cnt", NULL, NULL);
 	g_free(s1);
 
+	return s2;
+}
+
+static bool expression_is_recurrent(const char *user_expression)
+{
+	return strstr(user_expression, "PreviousValue") != NULL;
+}
+
+/*
+ * The channel pointers are loaded once, ahead of the loop, and declared
+ * restrict like the outputs, so each loop without a PreviousValue carry is
+ * a plain elementwise loop the compiler vectorizes. With more than one
+ * expression (@fused), all of them are evaluated in the same loop.
+ */
+static int c_file_create(const char * const *expressions,
+		unsigned int num_expressions, GSList *basenames,
+		const char *c_path, bool fused)
+{
+	char **body;
+	GArray *used;
+	bool recurrent = false;
+	unsigned int i;
+	FILE *fp;
+
+	if (!num_expressions || !expressions[0]) {
+		fprintf(stderr, "NULL user_expression parameter in %s", __func__);
+		return EXIT_FAILURE;
+	}
+
+	fp = fopen(c_path, "w+");
+	if (!fp) {
+		perror(c_path);
+		return EXIT_FAILURE;
+	}
+
+	used = g_array_new(FALSE, FALSE, sizeof(int));
+	body = g_new0(char *, num_expressions + 1);
+	for (i = 0; i < num_expressions; i++) {
+		body[i] = expression_to_c(expressions[i], basenames, used);
+		recurrent |= expression_is_recurrent(expressions[i]);
+	}
+
 	fprintf(fp, "#include <math.h>\n");
 	fprintf(fp, "#define max(a,b) \
 		({ __typeof__ (a) _a = (a); \
@@ -144,28 +246,45 @@ static char * c_file_create(const char *user_expression, GSList *basenames)
 		 __typeof__ (b) _b = (b); \
 		 _a < _b ? _a : _b; })\n");
 	fprintf(fp, "\n");
-	fprintf(fp, "void %s(float ***channels_data, float *out_data, unsigned long long chn_sample_cnt)\n", MATH_FUNCTION_NAME);
+	if (fused)
+		fprintf(fp, "void %s(float ***channels_data, float **out_data, unsigned long long chn_sample_cnt)\n", MATH_FUSED_FUNCTION_NAME);
+	else
+		fprintf(fp, "void %s(float ***channels_data, float * __restrict out_data, unsigned long long chn_sample_cnt)\n", MATH_FUNCTION_NAME);
 	fprintf(fp, "{\n");
+	for (i = 0; i < used->len; i++)
+		fprintf(fp, "\tconst float * __restrict chn_%d = *channels_data[%d];\n",
+			g_array_index(used, int, i), g_array_index(used, int, i));
+	if (fused)
+		for (i = 0; i < num_expressions; i++)
+			fprintf(fp, "\tfloat * __restrict out_%u = out_data[%u];\n", i, i);
+	if (recurrent)
+		fprintf(fp, "\tfloat prev = 0.0f;\n");
 	fprintf(fp, "\tunsigned long long i;\n\n");
 	fprintf(fp, "\tfor (i = 0; i < chn_sample_cnt; i++) {\n");
-	fprintf(fp, "\tout_data[i] = %s;\n", s2);
+	for (i = 0; i < num_expressions; i++) {
+		if (fused)
+			fprintf(fp, "\t\tout_%u[i] = %s;\n", i, body[i]);
+		else if (recurrent)
+			fprintf(fp, "\t\tout_data[i] = prev = %s;\n", body[i]);
+		else
+			fprintf(fp, "\t\tout_data[i] = %s;\n", body[i]);
+	}
 	fprintf(fp, "\t}\n");
 	fprintf(fp, "}\n");
 
 	fclose(fp);
-	g_free(s2);
+	g_strfreev(body);
+	g_array_free(used, TRUE);
 
-	return base_filename;
+	return EXIT_SUCCESS;
 }
 
-static int shared_object_compile(char *base_filename)
+static int run_compiler(const char *args, const char *output)
 {
-	char *pcommand, *object_path;
+	char *pcommand;
 	FILE *pstream;
-	int ret;
 
-	pcommand = g_strdup_printf("gcc -c -Wall -Werror -fpic %s/%s.c -o %s/%s.o",
-		MATH_OBJECT_FILES_DIR, base_filename, MATH_OBJECT_FILES_DIR, base_filename);
+	pcommand = g_strdup_printf("gcc %s", args);
 	pstream = popen(pcommand, "w");
 	g_free(pcommand);
 	if (!pstream) {
@@ -174,71 +293,173 @@ static int shared_object_compile(char *base_filename)
 	}
 	pclose(pstream);
 
-	object_path = g_strdup_printf("./%s/%s.o",
-		MATH_OBJECT_FILES_DIR, base_filename);
-	ret = access(object_path, F_OK);
-	g_free(object_path);
-	if (ret != 0)
-		return EXIT_FAILURE;
+	return access(output, F_OK) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
 
-	pcommand = g_strdup_printf("gcc -shared -o %s/%s.so %s/%s.o",
-		MATH_OBJECT_FILES_DIR, base_filename, MATH_OBJECT_FILES_DIR, base_filename);
-	pstream = popen(pcommand, "w");
-	g_free(pcommand);
-	if (!pstream) {
-		perror("Error creating math expression library");
-		return EXIT_FAILURE;
+/* Build <tmp_base>.c into @so_path. The intermediate files are private to
+ * this process and the library is renamed into place once complete, so a
+ * concurrent instance never loads a partially written file. */
+static int shared_object_compile(const char *tmp_base, const char *so_path)
+{
+	char *c_path, *o_path, *tmp_path, *q_c, *q_o, *q_tmp, *args;
+	int ret;
+
+	c_path = g_strdup_printf("%s.c", tmp_base);
+	o_path = g_strdup_printf("%s.o", tmp_base);
+	tmp_path = g_strdup_printf("%s.so", tmp_base);
+	q_c = g_shell_quote(c_path);
+	q_o = g_shell_quote(o_path);
+	q_tmp = g_shell_quote(tmp_path);
+
+	args = g_strdup_printf("-c " MATH_COMPILE_FLAGS " %s -o %s", q_c, q_o);
+	ret = run_compiler(args, o_path);
+	g_free(args);
+
+	if (ret == EXIT_SUCCESS) {
+		args = g_strdup_printf("-shared -o %s %s", q_tmp, q_o);
+		ret = run_compiler(args, tmp_path);
+		g_free(args);
 	}
-	pclose(pstream);
 
-	object_path = g_strdup_printf("./%s/%s.so",
-		MATH_OBJECT_FILES_DIR, base_filename);
-	ret = access(object_path, F_OK);
-	g_free(object_path);
-	if (ret != 0)
-		return EXIT_FAILURE;
+	if (ret == EXIT_SUCCESS && rename(tmp_path, so_path) != 0) {
+		perror(so_path);
+		ret = EXIT_FAILURE;
+	}
 
-	return EXIT_SUCCESS;
+	remove(c_path);
+	remove(o_path);
+	remove(tmp_path);
+
+	g_free(c_path);
+	g_free(o_path);
+	g_free(tmp_path);
+	g_free(q_c);
+	g_free(q_o);
+	g_free(q_tmp);
+
+	return ret;
 }
 #endif
 
-math_function math_expression_get_math_function(const char *expression_txt,
-	void **lib_handler, GSList *basenames)
+/* Compile the expression for the built-in evaluator. This is what math
+ * channels use unless the gcc backend is enabled and succeeds. */
+struct math_program * math_expression_get_program(const char *expression_txt,
+	GSList *basenames, char *error, size_t error_len)
+{
+	struct math_program *program;
+	const char **names;
+	unsigned int i, count = g_slist_length(basenames);
+	GSList *node;
+
+	names = g_new(const char *, count + 1);
+	for (i = 0, node = basenames; node; node = g_slist_next(node), i++)
+		names[i] = node->data;
+
+	program = math_program_compile(expression_txt, names, count,
+			error, error_len);
+	g_free(names);
+
+	return program;
+}
+
+/* Load @symbol from the library built for @expressions, compiling it first
+ * if it isn't in the cache yet. */
+static void * math_expression_load(const char * const *expressions,
+	unsigned int num_expressions, GSList *basenames, const char *symbol,
+	void **lib_handler)
 {
 #ifdef linux
-	math_function math_fn;
-	char *base_filename, *dlopen_path;
-	int ret;
+	void *fn = NULL;
+	char *dir, *key, *tmp_base, *c_path, *so_path;
+	int ret = EXIT_SUCCESS;
 
-	base_filename = c_file_create(expression_txt, basenames);
-	if (!base_filename)
+	dir = math_cache_dir();
+	if (!dir)
 		return NULL;
 
-	ret = shared_object_compile(base_filename);
-	if (ret == EXIT_FAILURE) {
-		goto FAILED_SO;
+	key = math_cache_key(expressions, num_expressions, basenames, symbol);
+	so_path = g_strdup_printf("%s/%s.so", dir, key);
+
+	/* Only compile on a cache miss */
+	if (access(so_path, F_OK) != 0) {
+		tmp_base = g_strdup_printf("%s/%s.%d", dir, key, (int)getpid());
+		c_path = g_strdup_printf("%s.c", tmp_base);
+		ret = c_file_create(expressions, num_expressions, basenames,
+				c_path, !strcmp(symbol, MATH_FUSED_FUNCTION_NAME));
+		if (ret == EXIT_SUCCESS)
+			ret = shared_object_compile(tmp_base, so_path);
+		else
+			remove(c_path);
+		g_free(c_path);
+		g_free(tmp_base);
 	}
+	if (ret == EXIT_FAILURE)
+		goto FAILED_SO;
 
-	dlopen_path = g_strdup_printf("./%s/%s.so",
-		MATH_OBJECT_FILES_DIR, base_filename);
-	*lib_handler = dlopen(dlopen_path, RTLD_LOCAL | RTLD_LAZY);
-	g_free(dlopen_path);
+	*lib_handler = dlopen(so_path, RTLD_LOCAL | RTLD_LAZY);
 	if (!*lib_handler) {
 		fprintf(stderr, "%s\n", dlerror());
+		/* Don't keep a library that can't be loaded */
+		remove(so_path);
 		goto FAILED_SO;
 	}
 
-	math_fn = dlsym(*lib_handler, MATH_FUNCTION_NAME);
-	if (!math_fn) {
-		fprintf(stderr, "Failed to load %s symbol\n", MATH_FUNCTION_NAME);
+	fn = dlsym(*lib_handler, symbol);
+	if (!fn) {
+		fprintf(stderr, "Failed to load %s symbol\n", symbol);
 	}
 
-	return math_fn;
-
 FAILED_SO:
-	g_free(base_filename);
+	g_free(so_path);
+	g_free(key);
+	g_free(dir);
+	return fn;
+#else
+	return NULL;
 #endif
+}
+
+math_function math_expression_get_math_function(const char *expression_txt,
+	void **lib_handler, GSList *basenames)
+{
+	if (!expression_txt)
+		return NULL;
+
+	return (math_function)math_expression_load(&expression_txt, 1,
+			basenames, MATH_FUNCTION_NAME, lib_handler);
+}
+
+/* One function evaluating all @expressions, which must not use
+ * PreviousValue, into out_data[0..n-1] in a single loop */
+math_fused_function math_expression_get_fused_function(GSList *expressions,
+	void **lib_handler, GSList *basenames)
+{
+#ifdef linux
+	math_fused_function fn;
+	const char **exprs;
+	unsigned int i, count = g_slist_length(expressions);
+	GSList *node;
+
+	if (!count)
+		return NULL;
+
+	exprs = g_new(const char *, count);
+	for (i = 0, node = expressions; node; node = g_slist_next(node), i++) {
+		exprs[i] = node->data;
+		if (expression_is_recurrent(exprs[i])) {
+			g_free(exprs);
+			return NULL;
+		}
+	}
+
+	fn = (math_fused_function)math_expression_load(exprs, count,
+			basenames, MATH_FUSED_FUNCTION_NAME, lib_handler);
+	g_free(exprs);
+
+	return fn;
+#else
 	return NULL;
+#endif
 }
 
 void math_expression_close_lib_handler(void *lib_handler)
@@ -249,6 +470,9 @@ void math_expression_close_lib_handler(void *lib_handler)
 #endif
 }
 
+/* The compiled libraries live in the user cache directory and are kept
+ * between sessions; this only removes the per-session directory that older
+ * versions left in the working directory. */
 void math_expression_objects_clean(void)
 {
 #ifdef linux
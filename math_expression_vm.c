@@ -0,0 +1,969 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "math_expression_vm.h"
+
+/*
+ * All operations of the language: name, number of operands and the value
+ * of one result sample. The same table generates the constant folding
+ * code and the block kernels, so the two can't disagree.
+ */
+#define MATH_OPS(OP) \
+	OP(NEG,    1, -ARG0) \
+	OP(NOT,    1, (ARG0 == 0.0f) ? 1.0f : 0.0f) \
+	OP(ADD,    2, ARG0 + ARG1) \
+	OP(SUB,    2, ARG0 - ARG1) \
+	OP(MUL,    2, ARG0 * ARG1) \
+	OP(DIV,    2, ARG0 / ARG1) \
+	OP(IDIV,   2, (ARG1 == 0.0f) ? 0.0f : truncf(ARG0 / ARG1)) \
+	OP(MOD,    2, fmodf(ARG0, ARG1)) \
+	OP(LT,     2, (ARG0 < ARG1) ? 1.0f : 0.0f) \
+	OP(GT,     2, (ARG0 > ARG1) ? 1.0f : 0.0f) \
+	OP(LE,     2, (ARG0 <= ARG1) ? 1.0f : 0.0f) \
+	OP(GE,     2, (ARG0 >= ARG1) ? 1.0f : 0.0f) \
+	OP(EQ,     2, (ARG0 == ARG1) ? 1.0f : 0.0f) \
+	OP(NE,     2, (ARG0 != ARG1) ? 1.0f : 0.0f) \
+	OP(AND,    2, ((ARG0 != 0.0f) & (ARG1 != 0.0f)) ? 1.0f : 0.0f) \
+	OP(OR,     2, ((ARG0 != 0.0f) | (ARG1 != 0.0f)) ? 1.0f : 0.0f) \
+	OP(MIN,    2, (ARG0 < ARG1) ? ARG0 : ARG1) \
+	OP(MAX,    2, (ARG0 > ARG1) ? ARG0 : ARG1) \
+	OP(POW,    2, powf(ARG0, ARG1)) \
+	OP(ATAN2,  2, atan2f(ARG0, ARG1)) \
+	OP(SELECT, 3, (ARG0 != 0.0f) ? ARG1 : ARG2) \
+	OP(SIN,    1, sinf(ARG0)) \
+	OP(COS,    1, cosf(ARG0)) \
+	OP(TAN,    1, tanf(ARG0)) \
+	OP(ASIN,   1, asinf(ARG0)) \
+	OP(ACOS,   1, acosf(ARG0)) \
+	OP(ATAN,   1, atanf(ARG0)) \
+	OP(SINH,   1, sinhf(ARG0)) \
+	OP(COSH,   1, coshf(ARG0)) \
+	OP(TANH,   1, tanhf(ARG0)) \
+	OP(EXP,    1, expf(ARG0)) \
+	OP(LOG,    1, logf(ARG0)) \
+	OP(LOG10,  1, log10f(ARG0)) \
+	OP(SQRT,   1, sqrtf(ARG0)) \
+	OP(ABS,    1, fabsf(ARG0)) \
+	OP(FLOOR,  1, floorf(ARG0)) \
+	OP(CEIL,   1, ceilf(ARG0)) \
+	OP(ROUND,  1, roundf(ARG0)) \
+	OP(TRUNC,  1, truncf(ARG0))
+
+enum math_op {
+#define OP_ENUM(name, args, expr) MATH_OP_##name,
+	MATH_OPS(OP_ENUM)
+#undef OP_ENUM
+	MATH_OP_COUNT
+};
+
+static const unsigned char math_op_args[] = {
+#define OP_ARGS(name, args, expr) args,
+	MATH_OPS(OP_ARGS)
+#undef OP_ARGS
+};
+
+static const struct {
+	const char *name;
+	enum math_op op;
+} math_functions[] = {
+	{ "sin", MATH_OP_SIN }, { "sinf", MATH_OP_SIN },
+	{ "cos", MATH_OP_COS }, { "cosf", MATH_OP_COS },
+	{ "tan", MATH_OP_TAN }, { "tanf", MATH_OP_TAN },
+	{ "asin", MATH_OP_ASIN }, { "asinf", MATH_OP_ASIN },
+	{ "acos", MATH_OP_ACOS }, { "acosf", MATH_OP_ACOS },
+	{ "atan", MATH_OP_ATAN }, { "atanf", MATH_OP_ATAN },
+	{ "sinh", MATH_OP_SINH }, { "sinhf", MATH_OP_SINH },
+	{ "cosh", MATH_OP_COSH }, { "coshf", MATH_OP_COSH },
+	{ "tanh", MATH_OP_TANH }, { "tanhf", MATH_OP_TANH },
+	{ "exp", MATH_OP_EXP }, { "expf", MATH_OP_EXP },
+	{ "log", MATH_OP_LOG }, { "logf", MATH_OP_LOG },
+	{ "log10", MATH_OP_LOG10 }, { "log10f", MATH_OP_LOG10 },
+	{ "sqrt", MATH_OP_SQRT }, { "sqrtf", MATH_OP_SQRT },
+	{ "abs", MATH_OP_ABS }, { "fabs", MATH_OP_ABS }, { "fabsf", MATH_OP_ABS },
+	{ "floor", MATH_OP_FLOOR }, { "floorf", MATH_OP_FLOOR },
+	{ "ceil", MATH_OP_CEIL }, { "ceilf", MATH_OP_CEIL },
+	{ "round", MATH_OP_ROUND }, { "roundf", MATH_OP_ROUND },
+	{ "trunc", MATH_OP_TRUNC }, { "truncf", MATH_OP_TRUNC },
+	{ "pow", MATH_OP_POW }, { "powf", MATH_OP_POW },
+	{ "atan2", MATH_OP_ATAN2 }, { "atan2f", MATH_OP_ATAN2 },
+	{ "fmod", MATH_OP_MOD }, { "fmodf", MATH_OP_MOD },
+	{ "min", MATH_OP_MIN }, { "fmin", MATH_OP_MIN }, { "fminf", MATH_OP_MIN },
+	{ "max", MATH_OP_MAX }, { "fmax", MATH_OP_MAX }, { "fmaxf", MATH_OP_MAX },
+};
+
+static const struct {
+	const char *name;
+	double value;
+} math_constants[] = {
+	{ "M_E", M_E },
+	{ "M_LOG2E", M_LOG2E },
+	{ "M_LOG10E", M_LOG10E },
+	{ "M_LN2", M_LN2 },
+	{ "M_LN10", M_LN10 },
+	{ "M_PI", M_PI },
+	{ "M_PI_2", M_PI_2 },
+	{ "M_PI_4", M_PI_4 },
+	{ "M_1_PI", M_1_PI },
+	{ "M_2_PI", M_2_PI },
+	{ "M_2_SQRTPI", M_2_SQRTPI },
+	{ "M_SQRT2", M_SQRT2 },
+	{ "M_SQRT1_2", M_SQRT1_2 },
+};
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof((x)[0]))
+
+/* Nesting limit of the parser, to keep the recursion bounded */
+#define MATH_MAX_DEPTH 64
+
+enum math_node_kind {
+	NODE_CONST,
+	NODE_CHANNEL,
+	NODE_INDEX,
+	NODE_COUNT,
+	NODE_PREVIOUS,
+	NODE_OP,
+};
+
+struct math_node {
+	enum math_node_kind kind;
+	enum math_op op;
+	bool is_int;
+	float value;
+	unsigned int channel;
+	int args[3];
+};
+
+struct math_parser {
+	const char *text;
+	const char *pos;
+	const char * const *basenames;
+	unsigned int num_basenames;
+
+	struct math_node *nodes;
+	unsigned int num_nodes;
+	unsigned int max_nodes;
+	unsigned int depth;
+
+	char *error;
+	size_t error_len;
+	bool failed;
+};
+
+enum math_reg_kind {
+	REG_TEMP,
+	REG_CONST,
+	REG_CHANNEL,
+	REG_INDEX,
+	REG_COUNT,
+	REG_PREVIOUS,
+};
+
+struct math_reg {
+	enum math_reg_kind kind;
+	unsigned int channel;
+	float value;
+};
+
+struct math_insn {
+	enum math_op op;
+	unsigned int dst;
+	unsigned int src[3];
+};
+
+struct math_program {
+	struct math_insn *insns;
+	unsigned int num_insns;
+
+	struct math_reg *regs;
+	unsigned int num_regs;
+	unsigned int result;
+
+	/* Registers as seen by the instructions of the current block */
+	const float **src;
+	float **data;
+	float *storage;
+
+	/* PreviousValue makes every sample depend on the one before */
+	bool serial;
+};
+
+static int parse_error(struct math_parser *p, const char *fmt, ...)
+{
+	va_list args;
+	int len;
+
+	if (p->failed || !p->error || !p->error_len) {
+		p->failed = true;
+		return -1;
+	}
+	p->failed = true;
+
+	len = snprintf(p->error, p->error_len, "Column %d: ",
+			(int)(p->pos - p->text) + 1);
+	if (len < 0 || (size_t)len >= p->error_len)
+		return -1;
+
+	va_start(args, fmt);
+	vsnprintf(p->error + len, p->error_len - len, fmt, args);
+	va_end(args);
+
+	return -1;
+}
+
+static void skip_spaces(struct math_parser *p)
+{
+	while (isspace((unsigned char)*p->pos))
+		p->pos++;
+}
+
+static bool accept(struct math_parser *p, const char *token)
+{
+	size_t len = strlen(token);
+
+	skip_spaces(p);
+	if (strncmp(p->pos, token, len))
+		return false;
+
+	p->pos += len;
+	return true;
+}
+
+static int node_new(struct math_parser *p, enum math_node_kind kind)
+{
+	struct math_node *node;
+
+	if (p->num_nodes == p->max_nodes)
+		return parse_error(p, "Expression too long");
+
+	node = &p->nodes[p->num_nodes];
+	memset(node, 0, sizeof(*node));
+	node->kind = kind;
+	node->args[0] = node->args[1] = node->args[2] = -1;
+
+	return p->num_nodes++;
+}
+
+static int node_const(struct math_parser *p, double value, bool is_int)
+{
+	int n = node_new(p, NODE_CONST);
+
+	if (n >= 0) {
+		p->nodes[n].value = value;
+		p->nodes[n].is_int = is_int;
+	}
+
+	return n;
+}
+
+static float math_op_eval(enum math_op op, float v0, float v1, float v2)
+{
+#define ARG0 v0
+#define ARG1 v1
+#define ARG2 v2
+#define OP_EVAL(name, args, expr) case MATH_OP_##name: return (expr);
+	switch (op) {
+	MATH_OPS(OP_EVAL)
+	default:
+		return 0.0f;
+	}
+#undef OP_EVAL
+#undef ARG0
+#undef ARG1
+#undef ARG2
+}
+
+static bool math_op_is_int(enum math_op op, const struct math_node *nodes,
+		const int *args)
+{
+	unsigned int i;
+
+	switch (op) {
+	case MATH_OP_NOT:
+	case MATH_OP_LT:
+	case MATH_OP_GT:
+	case MATH_OP_LE:
+	case MATH_OP_GE:
+	case MATH_OP_EQ:
+	case MATH_OP_NE:
+	case MATH_OP_AND:
+	case MATH_OP_OR:
+		return true;
+	case MATH_OP_SELECT:
+		return nodes[args[1]].is_int && nodes[args[2]].is_int;
+	case MATH_OP_NEG:
+	case MATH_OP_ADD:
+	case MATH_OP_SUB:
+	case MATH_OP_MUL:
+	case MATH_OP_IDIV:
+	case MATH_OP_MOD:
+	case MATH_OP_MIN:
+	case MATH_OP_MAX:
+	case MATH_OP_ABS:
+		for (i = 0; i < math_op_args[op]; i++)
+			if (!nodes[args[i]].is_int)
+				return false;
+		return true;
+	default:
+		return false;
+	}
+}
+
+/* Creates an operation node; operations on constants are folded */
+static int node_op(struct math_parser *p, enum math_op op,
+		int a0, int a1, int a2)
+{
+	float values[3] = { 0.0f, 0.0f, 0.0f };
+	bool folded = true;
+	struct math_node *node;
+	unsigned int i;
+	int n;
+
+	if (a0 < 0 || (math_op_args[op] > 1 && a1 < 0) ||
+			(math_op_args[op] > 2 && a2 < 0))
+		return -1;
+
+	/* C divides integers with truncation */
+	if (op == MATH_OP_DIV && p->nodes[a0].is_int && p->nodes[a1].is_int)
+		op = MATH_OP_IDIV;
+
+	n = node_new(p, NODE_OP);
+	if (n < 0)
+		return -1;
+
+	node = &p->nodes[n];
+	node->op = op;
+	node->args[0] = a0;
+	node->args[1] = a1;
+	node->args[2] = a2;
+	node->is_int = math_op_is_int(op, p->nodes, node->args);
+
+	for (i = 0; i < math_op_args[op]; i++) {
+		if (p->nodes[node->args[i]].kind != NODE_CONST)
+			folded = false;
+		else
+			values[i] = p->nodes[node->args[i]].value;
+	}
+	if (folded) {
+		node->kind = NODE_CONST;
+		node->value = math_op_eval(op, values[0], values[1], values[2]);
+	}
+
+	return n;
+}
+
+static int parse_expr(struct math_parser *p);
+
+/* Numbers are parsed by hand: strtod() depends on the locale */
+static int parse_number(struct math_parser *p)
+{
+	const char *s = p->pos;
+	double value = 0.0, scale = 0.1;
+	bool is_int = true;
+
+	if (s[0] == '0' && (s[1] == 'x' || s[1] == 'X') && isxdigit((unsigned char)s[2])) {
+		char *end;
+
+		value = strtoul(s + 2, &end, 16);
+		s = end;
+	} else {
+		for (; isdigit((unsigned char)*s); s++)
+			value = value * 10.0 + (*s - '0');
+
+		if (*s == '.') {
+			is_int = false;
+			for (s++; isdigit((unsigned char)*s); s++, scale /= 10.0)
+				value += (*s - '0') * scale;
+		}
+
+		if ((*s == 'e' || *s == 'E') && (isdigit((unsigned char)s[1]) ||
+				((s[1] == '+' || s[1] == '-') &&
+				 isdigit((unsigned char)s[2])))) {
+			int sign = 1, exp = 0;
+
+			is_int = false;
+			s++;
+			if (*s == '+' || *s == '-')
+				sign = (*s++ == '-') ? -1 : 1;
+			for (; isdigit((unsigned char)*s); s++)
+				if (exp < 1000)
+					exp = exp * 10 + (*s - '0');
+			value *= pow(10.0, sign * exp);
+		}
+	}
+
+	/* Type suffixes */
+	while (*s && strchr("fFlLuU", *s))
+		s++;
+	if (isalnum((unsigned char)*s) || *s == '_' || *s == '.')
+		return parse_error(p, "Invalid number");
+
+	p->pos = s;
+	return node_const(p, value, is_int);
+}
+
+/* A channel is named by its basename followed by the channel number */
+static bool lookup_channel(struct math_parser *p, const char *name,
+		size_t len, unsigned int *channel)
+{
+	unsigned int i;
+	size_t j;
+
+	for (i = 0; i < p->num_basenames; i++) {
+		size_t blen = strlen(p->basenames[i]);
+
+		if (!blen || blen >= len || strncmp(name, p->basenames[i], blen))
+			continue;
+		for (j = blen; j < len && isdigit((unsigned char)name[j]); j++)
+			;
+		if (j != len)
+			continue;
+
+		*channel = strtoul(name + blen, NULL, 10);
+		return true;
+	}
+
+	return false;
+}
+
+static int parse_call(struct math_parser *p, enum math_op op,
+		const char *name, size_t len)
+{
+	int args[3] = { -1, -1, -1 };
+	unsigned int i, count = math_op_args[op];
+
+	for (i = 0; i < count; i++) {
+		if (i && !accept(p, ","))
+			return parse_error(p, "%.*s() takes %u arguments",
+					(int)len, name, count);
+		args[i] = parse_expr(p);
+		if (args[i] < 0)
+			return -1;
+	}
+	if (!accept(p, ")"))
+		return parse_error(p, "%.*s() takes %u argument%s",
+				(int)len, name, count, count > 1 ? "s" : "");
+
+	return node_op(p, op, args[0], args[1], args[2]);
+}
+
+static int parse_identifier(struct math_parser *p)
+{
+	const char *name = p->pos;
+	unsigned int i, channel;
+	size_t len;
+	int n;
+
+	while (isalnum((unsigned char)*p->pos) || *p->pos == '_')
+		p->pos++;
+	len = p->pos - name;
+
+	for (i = 0; i < ARRAY_SIZE(math_functions); i++) {
+		if (strlen(math_functions[i].name) != len ||
+				strncmp(math_functions[i].name, name, len))
+			continue;
+		if (!accept(p, "("))
+			return parse_error(p, "Missing '(' after %.*s",
+					(int)len, name);
+		return parse_call(p, math_functions[i].op, name, len);
+	}
+
+	for (i = 0; i < ARRAY_SIZE(math_constants); i++)
+		if (strlen(math_constants[i].name) == len &&
+				!strncmp(math_constants[i].name, name, len))
+			return node_const(p, math_constants[i].value, false);
+
+	if (len == 5 && !strncmp(name, "Index", len)) {
+		n = node_new(p, NODE_INDEX);
+		if (n >= 0)
+			p->nodes[n].is_int = true;
+		return n;
+	}
+	if (len == 11 && !strncmp(name, "SampleCount", len)) {
+		n = node_new(p, NODE_COUNT);
+		if (n >= 0)
+			p->nodes[n].is_int = true;
+		return n;
+	}
+	if (len == 13 && !strncmp(name, "PreviousValue", len))
+		return node_new(p, NODE_PREVIOUS);
+
+	if (lookup_channel(p, name, len, &channel)) {
+		n = node_new(p, NODE_CHANNEL);
+		if (n >= 0)
+			p->nodes[n].channel = channel;
+		return n;
+	}
+
+	p->pos = name;
+	return parse_error(p, "Unknown name \"%.*s\"", (int)len, name);
+}
+
+static int parse_primary(struct math_parser *p)
+{
+	int n;
+
+	skip_spaces(p);
+
+	if (isdigit((unsigned char)*p->pos) ||
+			(*p->pos == '.' && isdigit((unsigned char)p->pos[1])))
+		return parse_number(p);
+
+	if (isalpha((unsigned char)*p->pos) || *p->pos == '_')
+		return parse_identifier(p);
+
+	if (accept(p, "(")) {
+		n = parse_expr(p);
+		if (n >= 0 && !accept(p, ")"))
+			return parse_error(p, "Missing ')'");
+		return n;
+	}
+
+	if (!*p->pos)
+		return parse_error(p, "Unexpected end of expression");
+
+	return parse_error(p, "Unexpected '%c'", *p->pos);
+}
+
+static int parse_unary(struct math_parser *p)
+{
+	int n;
+
+	if (++p->depth > MATH_MAX_DEPTH)
+		return parse_error(p, "Expression nested too deeply");
+
+	if (accept(p, "-"))
+		n = node_op(p, MATH_OP_NEG, parse_unary(p), -1, -1);
+	else if (accept(p, "+"))
+		n = parse_unary(p);
+	else if (accept(p, "!"))
+		n = node_op(p, MATH_OP_NOT, parse_unary(p), -1, -1);
+	else
+		n = parse_primary(p);
+
+	p->depth--;
+	return n;
+}
+
+static int parse_mul(struct math_parser *p)
+{
+	int n = parse_unary(p);
+
+	while (n >= 0) {
+		if (accept(p, "*"))
+			n = node_op(p, MATH_OP_MUL, n, parse_unary(p), -1);
+		else if (accept(p, "/"))
+			n = node_op(p, MATH_OP_DIV, n, parse_unary(p), -1);
+		else if (accept(p, "%"))
+			n = node_op(p, MATH_OP_MOD, n, parse_unary(p), -1);
+		else
+			break;
+	}
+
+	return n;
+}
+
+static int parse_add(struct math_parser *p)
+{
+	int n = parse_mul(p);
+
+	while (n >= 0) {
+		if (accept(p, "+"))
+			n = node_op(p, MATH_OP_ADD, n, parse_mul(p), -1);
+		else if (accept(p, "-"))
+			n = node_op(p, MATH_OP_SUB, n, parse_mul(p), -1);
+		else
+			break;
+	}
+
+	return n;
+}
+
+static int parse_compare(struct math_parser *p)
+{
+	int n = parse_add(p);
+
+	while (n >= 0) {
+		if (accept(p, "<="))
+			n = node_op(p, MATH_OP_LE, n, parse_add(p), -1);
+		else if (accept(p, ">="))
+			n = node_op(p, MATH_OP_GE, n, parse_add(p), -1);
+		else if (accept(p, "=="))
+			n = node_op(p, MATH_OP_EQ, n, parse_add(p), -1);
+		else if (accept(p, "!="))
+			n = node_op(p, MATH_OP_NE, n, parse_add(p), -1);
+		else if (accept(p, "<"))
+			n = node_op(p, MATH_OP_LT, n, parse_add(p), -1);
+		else if (accept(p, ">"))
+			n = node_op(p, MATH_OP_GT, n, parse_add(p), -1);
+		else
+			break;
+	}
+
+	return n;
+}
+
+static int parse_and(struct math_parser *p)
+{
+	int n = parse_compare(p);
+
+	while (n >= 0 && accept(p, "&&"))
+		n = node_op(p, MATH_OP_AND, n, parse_compare(p), -1);
+
+	return n;
+}
+
+static int parse_or(struct math_parser *p)
+{
+	int n = parse_and(p);
+
+	while (n >= 0 && accept(p, "||"))
+		n = node_op(p, MATH_OP_OR, n, parse_and(p), -1);
+
+	return n;
+}
+
+static int parse_expr(struct math_parser *p)
+{
+	int cond, a, b;
+
+	if (++p->depth > MATH_MAX_DEPTH)
+		return parse_error(p, "Expression nested too deeply");
+
+	cond = parse_or(p);
+	if (cond >= 0 && accept(p, "?")) {
+		a = parse_expr(p);
+		if (a >= 0 && !accept(p, ":")) {
+			p->depth--;
+			return parse_error(p, "Missing ':'");
+		}
+		b = (a >= 0) ? parse_expr(p) : -1;
+		cond = node_op(p, MATH_OP_SELECT, cond, a, b);
+	}
+
+	p->depth--;
+	return cond;
+}
+
+/* Code generation */
+
+struct math_codegen {
+	struct math_program *prog;
+	const struct math_node *nodes;
+	unsigned int *free_temps;
+	unsigned int num_free_temps;
+};
+
+static unsigned int reg_new(struct math_codegen *cg, enum math_reg_kind kind)
+{
+	struct math_program *prog = cg->prog;
+	unsigned int i;
+
+	/* Values that are the same for the whole block are shared */
+	if (kind == REG_INDEX || kind == REG_COUNT || kind == REG_PREVIOUS)
+		for (i = 0; i < prog->num_regs; i++)
+			if (prog->regs[i].kind == kind)
+				return i;
+
+	if (kind == REG_TEMP && cg->num_free_temps)
+		return cg->free_temps[--cg->num_free_temps];
+
+	prog->regs[prog->num_regs].kind = kind;
+	return prog->num_regs++;
+}
+
+static unsigned int emit(struct math_codegen *cg, int n)
+{
+	struct math_program *prog = cg->prog;
+	const struct math_node *node = &cg->nodes[n];
+	struct math_insn *insn;
+	unsigned int i, r, src[3] = { 0, 0, 0 };
+
+	switch (node->kind) {
+	case NODE_CONST:
+		r = reg_new(cg, REG_CONST);
+		prog->regs[r].value = node->value;
+		return r;
+	case NODE_CHANNEL:
+		for (r = 0; r < prog->num_regs; r++)
+			if (prog->regs[r].kind == REG_CHANNEL &&
+					prog->regs[r].channel == node->channel)
+				return r;
+		r = reg_new(cg, REG_CHANNEL);
+		prog->regs[r].channel = node->channel;
+		return r;
+	case NODE_INDEX:
+		return reg_new(cg, REG_INDEX);
+	case NODE_COUNT:
+		return reg_new(cg, REG_COUNT);
+	case NODE_PREVIOUS:
+		prog->serial = true;
+		return reg_new(cg, REG_PREVIOUS);
+	default:
+		break;
+	}
+
+	for (i = 0; i < math_op_args[node->op]; i++)
+		src[i] = emit(cg, node->args[i]);
+	for (; i < 3; i++)
+		src[i] = src[0];
+
+	/* The destination is picked before the operands are released, so an
+	 * instruction never writes over one of its own inputs */
+	r = reg_new(cg, REG_TEMP);
+	for (i = 0; i < math_op_args[node->op]; i++)
+		if (prog->regs[src[i]].kind == REG_TEMP)
+			cg->free_temps[cg->num_free_temps++] = src[i];
+
+	insn = &prog->insns[prog->num_insns++];
+	insn->op = node->op;
+	insn->dst = r;
+	memcpy(insn->src, src, sizeof(src));
+
+	return r;
+}
+
+static struct math_program * math_program_build(const struct math_node *nodes,
+		unsigned int num_nodes, int root)
+{
+	struct math_codegen cg;
+	struct math_program *prog;
+	unsigned int i, j;
+
+	prog = calloc(1, sizeof(*prog));
+	if (!prog)
+		return NULL;
+
+	/* At most one register and one instruction per node */
+	prog->insns = calloc(num_nodes, sizeof(*prog->insns));
+	prog->regs = calloc(num_nodes, sizeof(*prog->regs));
+	cg.free_temps = malloc(num_nodes * sizeof(*cg.free_temps));
+	if (!prog->insns || !prog->regs || !cg.free_temps)
+		goto err;
+
+	cg.prog = prog;
+	cg.nodes = nodes;
+	cg.num_free_temps = 0;
+	prog->result = emit(&cg, root);
+	free(cg.free_temps);
+	cg.free_temps = NULL;
+
+	prog->src = calloc(prog->num_regs, sizeof(*prog->src));
+	prog->data = calloc(prog->num_regs, sizeof(*prog->data));
+	prog->storage = malloc(prog->num_regs * MATH_VM_BLOCK * sizeof(float));
+	if (!prog->src || !prog->data || !prog->storage)
+		goto err;
+
+	for (i = 0; i < prog->num_regs; i++) {
+		prog->data[i] = prog->storage + i * MATH_VM_BLOCK;
+		prog->src[i] = prog->data[i];
+		if (prog->regs[i].kind == REG_CONST)
+			for (j = 0; j < MATH_VM_BLOCK; j++)
+				prog->data[i][j] = prog->regs[i].value;
+	}
+
+	return prog;
+err:
+	free(cg.free_temps);
+	math_program_destroy(prog);
+	return NULL;
+}
+
+struct math_program * math_program_compile(const char *expression,
+		const char * const *basenames, unsigned int num_basenames,
+		char *error, size_t error_len)
+{
+	struct math_program *prog = NULL;
+	struct math_parser p;
+	int root;
+
+	if (error && error_len)
+		error[0] = '\0';
+	if (!expression)
+		return NULL;
+
+	memset(&p, 0, sizeof(p));
+	p.text = expression;
+	p.pos = expression;
+	p.basenames = basenames;
+	p.num_basenames = num_basenames;
+	p.error = error;
+	p.error_len = error_len;
+
+	/* Every token makes at most one node */
+	p.max_nodes = strlen(expression) + 2;
+	p.nodes = malloc(p.max_nodes * sizeof(*p.nodes));
+	if (!p.nodes)
+		return NULL;
+
+	root = parse_expr(&p);
+	if (root >= 0) {
+		skip_spaces(&p);
+		if (*p.pos)
+			root = parse_error(&p, "Unexpected '%c'", *p.pos);
+	}
+	if (root >= 0)
+		prog = math_program_build(p.nodes, p.num_nodes, root);
+
+	free(p.nodes);
+	return prog;
+}
+
+void math_program_destroy(struct math_program *prog)
+{
+	if (!prog)
+		return;
+
+	free(prog->insns);
+	free(prog->regs);
+	free(prog->src);
+	free(prog->data);
+	free(prog->storage);
+	free(prog);
+}
+
+static void math_insn_run(const struct math_insn *insn,
+		const float * const *src, float * __restrict dst, unsigned int n)
+{
+	const float * __restrict a0 = src[insn->src[0]];
+	const float * __restrict a1 = src[insn->src[1]];
+	const float * __restrict a2 = src[insn->src[2]];
+	unsigned int i;
+
+#define ARG0 a0[i]
+#define ARG1 a1[i]
+#define ARG2 a2[i]
+#define OP_KERNEL(name, args, expr) \
+	case MATH_OP_##name: \
+		for (i = 0; i < n; i++) \
+			dst[i] = (expr); \
+		break;
+	switch (insn->op) {
+	MATH_OPS(OP_KERNEL)
+	default:
+		break;
+	}
+#undef OP_KERNEL
+#undef ARG0
+#undef ARG1
+#undef ARG2
+}
+
+/* Bind the registers that stay the same for the whole run. Returns false,
+ * with @out cleared, when a channel the program reads has no data. */
+static bool math_program_prepare(struct math_program *prog,
+		float ***channels_data, float *out, unsigned long long count)
+{
+	unsigned int i, k;
+
+	for (i = 0; i < prog->num_regs; i++) {
+		struct math_reg *reg = &prog->regs[i];
+
+		if (reg->kind == REG_CHANNEL && (!channels_data[reg->channel] ||
+					!*channels_data[reg->channel])) {
+			memset(out, 0, count * sizeof(*out));
+			return false;
+		}
+		if (reg->kind == REG_COUNT)
+			for (k = 0; k < MATH_VM_BLOCK; k++)
+				prog->data[i][k] = count;
+	}
+
+	return true;
+}
+
+static void math_program_run_block(struct math_program *prog,
+		float ***channels_data, float *out,
+		unsigned long long start, unsigned int n)
+{
+	unsigned int i, k;
+
+	for (i = 0; i < prog->num_regs; i++) {
+		switch (prog->regs[i].kind) {
+		case REG_CHANNEL:
+			prog->src[i] = *channels_data[prog->regs[i].channel] + start;
+			break;
+		case REG_INDEX:
+			for (k = 0; k < n; k++)
+				prog->data[i][k] = start + k;
+			break;
+		case REG_PREVIOUS:
+			prog->data[i][0] = start ? out[start - 1] : 0.0f;
+			break;
+		default:
+			break;
+		}
+	}
+
+	for (i = 0; i < prog->num_insns; i++)
+		math_insn_run(&prog->insns[i], prog->src,
+				prog->data[prog->insns[i].dst], n);
+
+	memcpy(out + start, prog->src[prog->result], n * sizeof(*out));
+}
+
+bool math_program_is_serial(const struct math_program *prog)
+{
+	return prog->serial;
+}
+
+void math_program_run(struct math_program *prog, float ***channels_data,
+		float *out, unsigned long long count)
+{
+	unsigned int block = prog->serial ? 1 : MATH_VM_BLOCK;
+	unsigned long long start;
+	unsigned int n;
+
+	if (!math_program_prepare(prog, channels_data, out, count))
+		return;
+
+	for (start = 0; start < count; start += n) {
+		n = (count - start > block) ? block : count - start;
+		math_program_run_block(prog, channels_data, out, start, n);
+	}
+}
+
+/*
+ * Evaluate several programs over the same channels in one pass: each block
+ * of the inputs is run through all the programs while it is still in the
+ * cache, instead of streaming the whole capture once per program. Programs
+ * using PreviousValue can't share the blocks and are run on their own.
+ */
+void math_program_run_fused(struct math_program **progs, unsigned int num_progs,
+		float ***channels_data, float **outs, unsigned long long count)
+{
+	bool *active;
+	unsigned long long start;
+	unsigned int i, n;
+
+	active = calloc(num_progs, sizeof(*active));
+	if (!active)
+		return;
+
+	for (i = 0; i < num_progs; i++) {
+		if (progs[i]->serial)
+			math_program_run(progs[i], channels_data, outs[i], count);
+		else
+			active[i] = math_program_prepare(progs[i], channels_data,
+					outs[i], count);
+	}
+
+	for (start = 0; start < count; start += n) {
+		n = (count - start > MATH_VM_BLOCK) ? MATH_VM_BLOCK : count - start;
+		for (i = 0; i < num_progs; i++)
+			if (active[i])
+				math_program_run_block(progs[i], channels_data,
+						outs[i], start, n);
+	}
+
+	free(active);
+}
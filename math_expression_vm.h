@@ -0,0 +1,43 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __MATH_EXPRESSION_VM_H__
+#define __MATH_EXPRESSION_VM_H__
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Number of samples each instruction works on at a time */
+#define MATH_VM_BLOCK 256
+
+/* In-process compiler for the math channel expressions. The expression is
+ * parsed to a tree, constant subexpressions are folded, and the rest is
+ * lowered to a list of register instructions. Every register holds a block
+ * of samples, so each instruction is a simple loop over the block that the
+ * compiler vectorizes, and the cost of interpreting it is paid once per
+ * block rather than once per sample.
+ *
+ * The language is the C expression subset offered by the math dialog:
+ * numbers, channels (basename followed by the channel number), Index,
+ * SampleCount, PreviousValue, the M_* constants, arithmetic, comparison
+ * and logical operators, ?: and the <math.h> functions of the dialog (with
+ * or without the "f" suffix) plus min() and max(). Integer operands follow
+ * the C rules for division; values are computed in float.
+ */
+struct math_program;
+
+struct math_program * math_program_compile(const char *expression,
+		const char * const *basenames, unsigned int num_basenames,
+		char *error, size_t error_len);
+void math_program_destroy(struct math_program *prog);
+void math_program_run(struct math_program *prog, float ***channels_data,
+		float *out, unsigned long long count);
+void math_program_run_fused(struct math_program **progs, unsigned int num_progs,
+		float ***channels_data, float **outs, unsigned long long count);
+bool math_program_is_serial(const struct math_program *prog);
+
+#endif /* __MATH_EXPRESSION_VM_H__ */
@@ -32,6 +32,7 @@
 #include "int_fft.h"
 #include "config.h"
 #include "osc_plugin.h"
+#include "flight_recorder.h"
 
 GSList *plugin_list = NULL;
 
@@ -63,8 +64,19 @@ static void capture_profile_save(const char *filename);
 static int load_profile(const char *filename, bool load_plugins);
 static int capture_setup(void);
 static void capture_start(void);
+static void recorder_profile_save(FILE *fp);
 static void stop_sampling(void);
 
+/* Flight recorder settings, from the main section of the profile */
+static struct {
+	double seconds;			/* 0 when disabled */
+	double pre, post;		/* seconds; negative for the defaults */
+	unsigned int memory;		/* MiB per device */
+	char *dir;			/* NULL for the home directory */
+	bool on_trigger;
+	double marker_threshold;	/* dB; NAN when disabled */
+} recorder_cfg = { 0.0, -1.0, -1.0, 256, NULL, false, NAN };
+
 static char * dma_devices[] = {
 	"ad9122",
 	"ad9144",
@@ -239,6 +251,13 @@ static void disable_all_channels(struct iio_device *dev)
 		iio_channel_disable(iio_device_get_channel(dev, i));
 }
 
+/* Exports of a plot may be writing the samples straight from the buffer */
+static void buffer_exports_wait(struct extra_dev_info *info)
+{
+	while (g_atomic_int_get(&info->buffer_exports))
+		g_usleep(1000);
+}
+
 static void close_active_buffers(void)
 {
 	unsigned int i;
@@ -247,6 +266,7 @@ static void close_active_buffers(void)
 		struct iio_device *dev = iio_context_get_device(ctx, i);
 		struct extra_dev_info *info = iio_device_get_data(dev);
 		if (info->buffer) {
+			buffer_exports_wait(info);
 			iio_buffer_destroy(info->buffer);
 			info->buffer = NULL;
 		}
@@ -1068,6 +1088,169 @@ static bool device_is_oneshot(struct iio_device *dev)
 	return false;
 }
 
+/*
+ * The SigMF datatype of the frames of @dev, if all the enabled channels
+ * share a format that SigMF can describe; an even number of channels is
+ * taken as I/Q pairs.
+ */
+static char * recorder_datatype(struct iio_device *dev,
+		unsigned int *num_channels)
+{
+	const struct iio_data_format *fmt = NULL, *f;
+	unsigned int i, n = 0, nb_channels = iio_device_get_channels_count(dev);
+
+	for (i = 0; i < nb_channels; i++) {
+		struct iio_channel *ch = iio_device_get_channel(dev, i);
+
+		if (!iio_channel_is_enabled(ch))
+			continue;
+
+		f = iio_channel_get_data_format(ch);
+		if (fmt && (f->length != fmt->length ||
+					f->is_signed != fmt->is_signed ||
+					f->is_be != fmt->is_be))
+			return NULL;
+		fmt = f;
+		n++;
+	}
+
+	if (!fmt || (fmt->length != 8 && fmt->length != 16 &&
+				fmt->length != 32) ||
+			(ssize_t)(n * fmt->length / 8) !=
+				iio_device_get_sample_size(dev))
+		return NULL;
+
+	*num_channels = n % 2 ? n : n / 2;
+	return g_strdup_printf("%c%c%u%s", n % 2 ? 'r' : 'c',
+			fmt->is_signed ? 'i' : 'u', fmt->length,
+			fmt->length == 8 ? "" : fmt->is_be ? "_be" : "_le");
+}
+
+static struct flight_recorder * recorder_create(struct iio_device *dev,
+		double freq)
+{
+	struct flight_recorder_params params = { 0 };
+	struct flight_recorder *rec;
+	const char *name = iio_device_get_name(dev) ?: iio_device_get_id(dev);
+	const char *description = iio_context_get_description(ctx);
+	unsigned long long budget;
+	unsigned int i, nb_channels = iio_device_get_channels_count(dev);
+	double pre, post;
+	char *hw;
+
+	params.frame_size = iio_device_get_sample_size(dev);
+	budget = (unsigned long long)recorder_cfg.memory << 20;
+	params.capacity = budget / params.frame_size;
+	if (freq > 0 && recorder_cfg.seconds * freq < params.capacity)
+		params.capacity = recorder_cfg.seconds * freq;
+
+	pre = recorder_cfg.pre >= 0 ? recorder_cfg.pre : recorder_cfg.seconds / 2;
+	post = recorder_cfg.post >= 0 ? recorder_cfg.post : recorder_cfg.seconds / 4;
+	if (freq > 0) {
+		params.pre = pre * freq;
+		params.post = post * freq;
+	} else {
+		params.pre = params.capacity / 2;
+		params.post = params.capacity / 4;
+	}
+
+	if (description && description[0])
+		hw = g_strdup_printf("%s (%s)", name, description);
+	else
+		hw = g_strdup(name);
+
+	params.dir = recorder_cfg.dir ?: g_get_home_dir();
+	params.name = name;
+	params.datatype = recorder_datatype(dev, &params.num_channels);
+	params.sample_rate = freq;
+	params.hw = hw;
+	for (i = 0; i < nb_channels; i++) {
+		struct iio_channel *ch = iio_device_get_channel(dev, i);
+		struct extra_info *info = iio_channel_get_data(ch);
+
+		if (iio_channel_is_enabled(ch)) {
+			params.frequency = info->lo_freq;
+			break;
+		}
+	}
+
+	if (!params.datatype)
+		fprintf(stderr, "Flight recorder: the channels of %s have no "
+				"SigMF datatype, only the samples will be saved\n",
+				name);
+
+	rec = flight_recorder_new(&params);
+	g_free((char *)params.datatype);
+	g_free(hw);
+
+	return rec;
+}
+
+static int recorder_event(struct iio_device *dev, unsigned long long frame,
+		const char *reason)
+{
+	struct extra_dev_info *dev_info = iio_device_get_data(dev);
+
+	if (!dev_info->recorder)
+		return 0;
+
+	return flight_recorder_event(dev_info->recorder, frame, reason);
+}
+
+/*
+ * Save what the flight recorder of @dev holds around this moment, or the
+ * one of every device when @dev is NULL.
+ */
+void osc_flight_recorder_event(struct iio_device *dev, const char *reason)
+{
+	struct extra_dev_info *dev_info;
+	unsigned int i;
+
+	for (i = 0; i < num_devices; i++) {
+		struct iio_device *d = iio_context_get_device(ctx, i);
+
+		if (dev && d != dev)
+			continue;
+
+		dev_info = iio_device_get_data(d);
+		if (!dev_info->recorder)
+			continue;
+
+		if (recorder_event(d, flight_recorder_position(
+					dev_info->recorder), reason) == -EBUSY)
+			printf("Flight recorder: ignoring \'%s\' on %s, still "
+					"saving the previous event\n", reason,
+					iio_device_get_name(d) ?: iio_device_get_id(d));
+	}
+}
+
+/* Markers of @dev were updated; the highest one is at @level dB */
+void osc_flight_recorder_marker_level(struct iio_device *dev, double level)
+{
+	struct extra_dev_info *dev_info;
+
+	if (!dev || isnan(recorder_cfg.marker_threshold))
+		return;
+
+	dev_info = iio_device_get_data(dev);
+	if (dev_info->recorder)
+		flight_recorder_level(dev_info->recorder,
+				level >= recorder_cfg.marker_threshold, "marker");
+}
+
+static void recorders_destroy(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_devices; i++) {
+		struct iio_device *dev = iio_context_get_device(ctx, i);
+		struct extra_dev_info *dev_info = iio_device_get_data(dev);
+
+		flight_recorder_destroy(dev_info->recorder);
+		dev_info->recorder = NULL;
+	}
+}
+
 static gboolean capture_process(void)
 {
 	unsigned int i;
@@ -1083,6 +1266,7 @@ static gboolean capture_process(void)
 		ssize_t sample_count = dev_info->sample_count;
 		struct iio_channel *chn;
 		off_t offset = 0;
+		unsigned long long recorded = 0;
 
 		if (dev_info->input_device == false)
 			continue;
@@ -1090,6 +1274,10 @@ static gboolean capture_process(void)
 		if (sample_size == 0)
 			continue;
 
+		/* Paused while the buffer is being saved */
+		if (g_atomic_int_get(&dev_info->buffer_exports))
+			continue;
+
 		if (dev_info->buffer == NULL || device_is_oneshot(dev)) {
 			dev_info->buffer_size = sample_count;
 			dev_info->buffer = iio_device_create_buffer(dev,
@@ -1107,6 +1295,7 @@ static gboolean capture_process(void)
 			info->offset = 0;
 		}
 
+		dev_info->buffer_holds_capture = false;
 		while (true) {
 			ssize_t ret = iio_buffer_refill(dev_info->buffer);
 			if (ret < 0) {
@@ -1119,6 +1308,15 @@ static gboolean capture_process(void)
 			if (ret >= sample_count) {
 				iio_buffer_foreach_sample(
 						dev_info->buffer, demux_sample, NULL);
+				dev_info->buffer_holds_capture = true;
+
+				if (dev_info->recorder) {
+					recorded = flight_recorder_position(
+							dev_info->recorder);
+					flight_recorder_append(dev_info->recorder,
+						iio_buffer_start(dev_info->buffer),
+						ret);
+				}
 
 				if (ret >= sample_count * 2) {
 					printf("Decreasing buffer size\n");
@@ -1126,6 +1324,7 @@ static gboolean capture_process(void)
 					dev_info->buffer_size /= 2;
 					dev_info->buffer = iio_device_create_buffer(dev,
 							dev_info->buffer_size, false);
+					dev_info->buffer_holds_capture = false;
 				}
 				break;
 			}
@@ -1150,6 +1349,9 @@ static gboolean capture_process(void)
 			if (offset / (off_t)sizeof(gfloat) < info->offset / 4) {
 				offset = 0;
 			} else if (offset) {
+				if (recorder_cfg.on_trigger)
+					recorder_event(dev, recorded +
+						offset / sizeof(gfloat), "trigger");
 				offset -= info->offset * sizeof(gfloat) / 4;
 				for (i = 0; i < nb_channels; i++) {
 					chn = iio_device_get_channel(dev, i);
@@ -1170,6 +1372,8 @@ static gboolean capture_process(void)
 			G_UNLOCK(buffer_full);
 		}
 
+		dev_info->capture_generation++;
+
 		if (device_is_oneshot(dev)) {
 			iio_buffer_destroy(dev_info->buffer);
 			dev_info->buffer = NULL;
@@ -1277,6 +1481,9 @@ static int capture_setup(void)
 				iio_channel_disable(ch);
 		}
 
+		flight_recorder_destroy(dev_info->recorder);
+		dev_info->recorder = NULL;
+
 		sample_size = iio_device_get_sample_size(dev);
 		if (sample_size == 0 || sample_count == 0)
 			continue;
@@ -1290,8 +1497,10 @@ static int capture_setup(void)
 			info->data_ref = (gfloat *) g_new0(gfloat, sample_count);
 		}
 
-		if (dev_info->buffer)
+		if (dev_info->buffer) {
+			buffer_exports_wait(dev_info);
 			iio_buffer_destroy(dev_info->buffer);
+		}
 		dev_info->buffer = NULL;
 		dev_info->sample_count = sample_count;
 
@@ -1307,6 +1516,9 @@ static int capture_setup(void)
 			if (timeout > min_timeout)
 				min_timeout = timeout;
 		}
+
+		if (recorder_cfg.seconds > 0 && dev_info->input_device)
+			dev_info->recorder = recorder_create(dev, freq);
 	}
 
 	if (ctx)
@@ -1474,6 +1686,7 @@ static void do_quit(bool reload)
 	G_TRYLOCK(buffer_full);
 	G_UNLOCK(buffer_full);
 	close_active_buffers();
+	recorders_destroy();
 
 	close_all_plots();
 	destroy_all_plots();
@@ -1900,6 +2113,7 @@ static void capture_profile_save(const char *filename)
 		gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(tooltips_en)));
 	fprintf(fp, "startup_version_check=%d\n",
 		gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(versioncheck_en)));
+	recorder_profile_save(fp);
 	if (ctx && !strcmp(iio_context_get_name(ctx), "network")) {
 		char *ip_addr = (char *) iio_context_get_description(ctx);
 		ip_addr = strtok(ip_addr, " ");
@@ -1967,6 +2181,59 @@ void save_complete_profile(const char *filename)
 	}
 }
 
+/* Settings take effect when the capture is started next */
+static int recorder_handle_param(const char *name, const char *value)
+{
+	if (!strcmp(name, "seconds")) {
+		recorder_cfg.seconds = g_ascii_strtod(value, NULL);
+	} else if (!strcmp(name, "pre")) {
+		recorder_cfg.pre = g_ascii_strtod(value, NULL);
+	} else if (!strcmp(name, "post")) {
+		recorder_cfg.post = g_ascii_strtod(value, NULL);
+	} else if (!strcmp(name, "memory")) {
+		recorder_cfg.memory = atoi(value);
+	} else if (!strcmp(name, "dir")) {
+		g_free(recorder_cfg.dir);
+		recorder_cfg.dir = value[0] ? g_strdup(value) : NULL;
+	} else if (!strcmp(name, "on_trigger")) {
+		recorder_cfg.on_trigger = !!atoi(value);
+	} else if (!strcmp(name, "marker_threshold")) {
+		recorder_cfg.marker_threshold = value[0] ?
+			g_ascii_strtod(value, NULL) : NAN;
+	} else if (!strcmp(name, "dump")) {
+		osc_flight_recorder_event(NULL, value[0] ? value : "profile");
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static void recorder_profile_save(FILE *fp)
+{
+	char buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+	if (recorder_cfg.seconds <= 0)
+		return;
+
+	fprintf(fp, "flight_recorder.seconds=%s\n", g_ascii_dtostr(buf,
+				sizeof(buf), recorder_cfg.seconds));
+	if (recorder_cfg.pre >= 0)
+		fprintf(fp, "flight_recorder.pre=%s\n", g_ascii_dtostr(buf,
+					sizeof(buf), recorder_cfg.pre));
+	if (recorder_cfg.post >= 0)
+		fprintf(fp, "flight_recorder.post=%s\n", g_ascii_dtostr(buf,
+					sizeof(buf), recorder_cfg.post));
+	fprintf(fp, "flight_recorder.memory=%u\n", recorder_cfg.memory);
+	if (recorder_cfg.dir)
+		fprintf(fp, "flight_recorder.dir=%s\n", recorder_cfg.dir);
+	fprintf(fp, "flight_recorder.on_trigger=%d\n", recorder_cfg.on_trigger);
+	if (!isnan(recorder_cfg.marker_threshold))
+		fprintf(fp, "flight_recorder.marker_threshold=%s\n",
+				g_ascii_dtostr(buf, sizeof(buf),
+					recorder_cfg.marker_threshold));
+}
+
 static int handle_osc_param(int line, const char *name, const char *value)
 {
 	gchar **elems;
@@ -1994,6 +2261,12 @@ static int handle_osc_param(int line, const char *name, const char *value)
 		return 0;
 	}
 
+	if (elems && !strcmp(elems[0], "flight_recorder") && elems[1] &&
+			!recorder_handle_param(elems[1], value)) {
+		g_strfreev(elems);
+		return 0;
+	}
+
 	g_strfreev(elems);
 
 	create_blocking_popup(GTK_MESSAGE_ERROR, GTK_BUTTONS_CLOSE,
@@ -2069,9 +2342,14 @@ err_unlink:
 
 static int load_profile(const char *filename, bool load_plugins)
 {
+	static const char * const recorder_keys[] = {
+		"seconds", "pre", "post", "memory", "dir",
+		"on_trigger", "marker_threshold",
+	};
 	int ret = 0;
 	GSList *node;
 	gint x_pos = 0, y_pos = 0;
+	unsigned int i;
 	char *value;
 
 	close_all_plots();
@@ -2124,6 +2402,18 @@ static int load_profile(const char *filename, bool load_plugins)
 
 	gtk_window_move(GTK_WINDOW(main_window), x_pos, y_pos);
 
+	for (i = 0; i < G_N_ELEMENTS(recorder_keys); i++) {
+		char buf[64];
+
+		snprintf(buf, sizeof(buf), "flight_recorder.%s", recorder_keys[i]);
+		value = read_token_from_ini(filename, OSC_INI_SECTION, buf);
+		if (!value)
+			continue;
+
+		recorder_handle_param(recorder_keys[i], value);
+		free(value);
+	}
+
 	foreach_in_ini(filename, capture_profile_handler);
 
 	for (node = plugin_list; node; node = g_slist_next(node)) {
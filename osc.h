@@ -23,6 +23,7 @@
 #define SAVE_MAT 1
 #define SAVE_VSA 2
 #define SAVE_PNG 3
+#define SAVE_SIGMF 4
 
 extern GtkWidget *capture_graph;
 extern gint capture_function;
@@ -119,6 +120,9 @@ void plugin_osc_start_capture(void);
 bool plugin_osc_running_state(void);
 void plugin_osc_stop_all_plots(void);
 
+void osc_flight_recorder_event(struct iio_device *dev, const char *reason);
+void osc_flight_recorder_marker_level(struct iio_device *dev, double level);
+
 void save_complete_profile(const char *filename);
 void load_complete_profile(const char *filename);
 
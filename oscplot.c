@@ -23,6 +23,7 @@
 #include <complex.h>
 #include <fftw3.h>
 #include <iio.h>
+#include <gdk/gdkkeysyms.h>
 
 #include "osc.h"
 #include "oscplot.h"
@@ -31,10 +32,13 @@
 #include "datatypes.h"
 #include "osc_plugin.h"
 #include "math_expression_generator.h"
+#include "data_export.h"
 
 /* add backwards compat for <matio-1.5.0 */
 #if MATIO_MAJOR_VERSION == 1 && MATIO_MINOR_VERSION < 5
 typedef int mat_dim;
+#define MAT_COMPRESSION_ZLIB COMPRESSION_ZLIB
+#define MAT_F_DONT_COPY_DATA MEM_CONSERVE
 #else
 typedef size_t mat_dim;
 #endif
@@ -52,11 +56,18 @@ static void add_grid(OscPlot *plot);
 static void rescale_databox(OscPlotPrivate *priv, GtkDatabox *box, gfloat border);
 static bool call_all_transform_functions(OscPlotPrivate *priv);
 static void capture_start(OscPlotPrivate *priv);
+static void redraw_scheduler_request(OscPlotPrivate *priv);
+static void redraw_scheduler_post(OscPlotPrivate *priv);
+static void redraw_scheduler_cancel(OscPlotPrivate *priv);
+static void math_passes_clear(OscPlotPrivate *priv);
+static GSList * iio_chn_basenames_get(OscPlot *plot, const char *dev_name);
+static bool plot_is_viewable(OscPlotPrivate *priv);
 static void plot_profile_save(OscPlot *plot, char *filename);
 static void transform_add_plot_markers(OscPlot *plot, Transform *transform);
 static void osc_plot_finalize(GObject *object);
 static void osc_plot_dispose(GObject *object);
 static void save_as(OscPlot *plot, const char *filename, int type);
+static void export_abandon(OscPlotPrivate *priv);
 static void treeview_expand_update(OscPlot *plot);
 static void treeview_icon_color_update(OscPlot *plot);
 static int enabled_channels_of_device(GtkTreeView *treeview, const char *name, unsigned *enabled_mask);
@@ -152,6 +163,18 @@ static GdkColor color_graph[] = {
 
 #define NUM_GRAPH_COLORS (sizeof(color_graph) / sizeof(color_graph[0]))
 
+/* Intensity levels of the XY density plot, from sparse to dense */
+static GdkColor color_density[DENSITY_LEVELS] = {
+	OSC_COLOR(32, 74, 135),
+	OSC_COLOR(52, 101, 164),
+	OSC_COLOR(114, 159, 207),
+	OSC_COLOR(115, 210, 22),
+	OSC_COLOR(252, 233, 79),
+	OSC_COLOR(245, 121, 0),
+	OSC_COLOR(239, 41, 41),
+	OSC_COLOR(255, 255, 255),
+};
+
 static GdkColor color_grid = {
 	.red = 51000,
 	.green = 51000,
@@ -206,9 +229,22 @@ struct math_channel_settings {
 	char *txt_math_expression;
 	void (*math_expression)(float ***channels_data, float *out_data, unsigned long long chn_sample_cnt);
 	void *math_lib_handler;
+	struct math_program *math_program;
 	float *data_ref;
+	unsigned int num_samples;
+	/* Capture generation of the device that data_ref was computed from */
+	unsigned long generation;
 };
 
+static void plot_math_channel_evaluate(PlotMathChn *m, unsigned long long count)
+{
+	if (m->math_expression)
+		m->math_expression(m->iio_channels_data, m->data_ref, count);
+	else if (m->math_program)
+		math_program_run(m->math_program, m->iio_channels_data,
+			m->data_ref, count);
+}
+
 /* Helpers */
 #define TIME_SETTINGS(obj) ((struct _time_settings *)obj->settings)
 #define FFT_SETTINGS(obj) ((struct _fft_settings *)obj->settings)
@@ -276,6 +312,8 @@ struct _OscPlotPrivate
 	GtkWidget *fft_size_widget;
 	GtkWidget *fft_avg_widget;
 	GtkWidget *fft_pwr_offset_widget;
+	GtkWidget *fft_zoom_widget;
+	GtkWidget *fft_zoom_center_widget;
 	GtkWidget *device_settings_menu;
 	GtkWidget *math_settings_menu;
 	GtkWidget *device_trigger_menuitem;
@@ -330,6 +368,15 @@ struct _OscPlotPrivate
 	/* List of transforms for this plot */
 	TrList *transform_list;
 
+	/* Math channels used by the transforms, grouped by device */
+	GSList *math_passes;
+
+	/* Save As running in the background */
+	struct data_export *export;
+	GtkWidget *export_dialog;
+	GtkWidget *export_progress;
+	guint export_timer;
+
 	/* Active transform type for this window */
 	int active_transform_type;
 
@@ -355,12 +402,22 @@ struct _OscPlotPrivate
 	unsigned fft_count;
 	double start_freq;
 	double filter_bw;
+	double freq_step;	/* between segments, 0 if filter_bw */
 
 	gint line_thickness;
 
-	gint redraw_function;
-	gboolean stop_redraw;
+	/* Persistence of the XY density plot */
+	gfloat density_decay;
+
+	/* Redraw state, see redraw_scheduler_request() */
+	gboolean redraw_enabled;
 	gboolean redraw;
+	gint64 next_redraw_time;
+	gint64 redraw_cost;
+	bool iconified;
+	bool obscured;
+	/* plot_is_viewable(), kept by the main loop for the capture threads */
+	volatile gint viewable;
 
 	bool spectrum_data_ready;
 
@@ -468,6 +525,10 @@ void osc_plot_reset_numbering (void)
 void osc_plot_set_visible (OscPlot *plot, bool visible)
 {
 	gtk_widget_set_visible(plot->priv->window, visible);
+
+	/* Show the latest frame, which was not drawn while hidden */
+	if (visible && plot->priv->redraw)
+		redraw_scheduler_request(plot->priv);
 }
 
 struct iio_buffer * osc_plot_get_buffer(OscPlot *plot)
@@ -480,8 +541,13 @@ struct iio_buffer * osc_plot_get_buffer(OscPlot *plot)
 
 void osc_plot_data_update (OscPlot *plot)
 {
-	if (call_all_transform_functions(plot->priv))
+	if (call_all_transform_functions(plot->priv)) {
 		plot->priv->redraw = TRUE;
+		if (g_main_context_is_owner(g_main_context_default()))
+			redraw_scheduler_request(plot->priv);
+		else
+			redraw_scheduler_post(plot->priv);
+	}
 
 	if (plot->priv->single_shot_mode) {
 		plot->priv->single_shot_mode = false;
@@ -501,7 +567,7 @@ void osc_plot_update_rx_lbl(OscPlot *plot, bool force_update)
 	device_rx_info_update(plot);
 
 	/* Skip rescaling graphs, updating labels and others if the redrawing is currently halted. */
-	if (priv->redraw_function <= 0 && !force_update)
+	if (!priv->redraw_enabled && !force_update)
 		return;
 
 	if (priv->active_transform_type == FFT_TRANSFORM ||
@@ -524,9 +590,20 @@ void osc_plot_update_rx_lbl(OscPlot *plot, bool force_update)
 			return;
 		if (priv->profile_loaded_scale)
 			return;
-		gtk_databox_set_total_limits(GTK_DATABOX(priv->databox),
+		if (priv->active_transform_type != FREQ_SPECTRUM_TRANSFORM &&
+				FFT_SETTINGS(tr_list->transforms[i - 1])->zoom_fft) {
+			struct _fft_settings *settings = FFT_SETTINGS(tr_list->transforms[i - 1]);
+			double span = dev_info->adc_freq / settings->zoom;
+
+			gtk_databox_set_total_limits(GTK_DATABOX(priv->databox),
+				settings->zoom_center - span / 2,
+				settings->zoom_center + span / 2,
+				0.0, -100.0);
+		} else {
+			gtk_databox_set_total_limits(GTK_DATABOX(priv->databox),
 				-5.0 - corr, dev_info->adc_freq / 2.0 + 5.0,
 				0.0, -100.0);
+		}
 		priv->do_a_rescale_flag = 1;
 	} else {
 		switch (gtk_combo_box_get_active(GTK_COMBO_BOX(priv->hor_units))) {
@@ -544,9 +621,8 @@ void osc_plot_restart (OscPlot *plot)
 {
 	OscPlotPrivate *priv = plot->priv;
 
-	if (priv->redraw_function > 0)
+	if (priv->redraw_enabled)
 	{
-		priv->stop_redraw = TRUE;
 		plot_setup(plot);
 		add_grid(plot);
 		gtk_widget_queue_draw(priv->databox);
@@ -557,7 +633,7 @@ void osc_plot_restart (OscPlot *plot)
 
 bool osc_plot_running_state (OscPlot *plot)
 {
-	return !!plot->priv->redraw_function;
+	return !!plot->priv->redraw_enabled;
 }
 
 void osc_plot_draw_start (OscPlot *plot)
@@ -813,6 +889,25 @@ void osc_plot_spect_set_filter_bw(OscPlot *plot, double bw)
 	plot->priv->filter_bw = bw;
 }
 
+/* Segments closer than the filter bandwidth overlap; the overlapping bins
+ * are blended */
+void osc_plot_spect_set_step(OscPlot *plot, double step_mhz)
+{
+	g_return_if_fail(plot);
+
+	plot->priv->freq_step = step_mhz;
+}
+
+static double spect_width(OscPlotPrivate *priv)
+{
+	double step = priv->freq_step > 0 ? priv->freq_step : priv->filter_bw;
+
+	if (!priv->fft_count)
+		return 0;
+
+	return priv->filter_bw + step * (priv->fft_count - 1);
+}
+
 static void osc_plot_dispose(GObject *object)
 {
 	G_OBJECT_CLASS(osc_plot_parent_class)->dispose(object);
@@ -832,6 +927,46 @@ static double win_hanning(int j, int n)
 	return (w);
 }
 
+static void fft_average(gfloat *out, gfloat mag, double avg)
+{
+	if (*out == FLT_MAX) {
+		/* Don't average the first iteration */
+		*out = mag;
+	} else if (!avg) {
+		/* keep peaks */
+		if (*out <= mag)
+			*out = mag;
+	} else if (avg == 128) {
+		/* keep min */
+		if (*out >= mag)
+			*out = mag;
+	} else {
+		/* do an average */
+		*out = ((1 - avg) * *out) + (avg * mag);
+	}
+}
+
+static void fft_markers_publish(Transform *tr)
+{
+	struct _fft_settings *settings = tr->settings;
+	struct marker_type *markers = settings->markers;
+	double level = -INFINITY;
+	int j;
+
+	for (j = 0; j <= MAX_MARKERS && markers[j].active; j++)
+		level = MAX(level, markers[j].y);
+	if (j)
+		osc_flight_recorder_marker_level(
+				transform_get_device_parent(tr), level);
+
+	if (settings->markers_copy && *settings->markers_copy) {
+		memcpy(*settings->markers_copy, settings->markers,
+			sizeof(struct marker_type) * MAX_MARKERS);
+		*settings->markers_copy = NULL;
+		g_mutex_unlock(settings->marker_lock);
+	}
+}
+
 static void do_fft(Transform *tr)
 {
 	struct _fft_settings *settings = tr->settings;
@@ -942,21 +1077,7 @@ static void do_fft(Transform *tr)
 		 * rather than do these tests inside the loop, but it makes
 		 * the code harder to understand... Oh well...
 		 ***/
-		if (out_data[i] == FLT_MAX) {
-			/* Don't average the first iteration */
-			 out_data[i] = mag;
-		} else if (!avg) {
-			/* keep peaks */
-			if (out_data[i] <= mag)
-				out_data[i] = mag;
-		} else if (avg == 128) {
-			/* keep min */
-			if (out_data[i] >= mag)
-				out_data[i] = mag;
-		} else {
-			/* do an average */
-			out_data[i] = ((1 - avg) * out_data[i]) + (avg * mag);
-		}
+		fft_average(&out_data[i], mag, avg);
 		if (!settings->markers || i < 2)
 			continue;
 		if (MAX_MARKERS && (marker_type == MARKER_PEAK ||
@@ -1080,13 +1201,79 @@ static void do_fft(Transform *tr)
 				markers[j].vector = 0 + I * 0;
 			}
 		}
-		if (settings->markers_copy && *settings->markers_copy) {
-			memcpy(*settings->markers_copy, settings->markers,
-				sizeof(struct marker_type) * MAX_MARKERS);
-			*settings->markers_copy = NULL;
-			g_mutex_unlock(settings->marker_lock);
-		}
+		fft_markers_publish(tr);
+	}
+}
+
+/*
+ * Fixed markers only need the bins they sit on. When the plot can't be
+ * seen, those bins are evaluated with a sparse DFT instead of running the
+ * whole FFT; the readouts are the same, the rest of the spectrum is left
+ * as it was until the plot is shown again.
+ */
+static bool do_fixed_markers(Transform *tr)
+{
+	struct _fft_settings *settings = tr->settings;
+	struct _fft_alg_data *fft = &settings->fft_alg_data;
+	struct marker_type *markers = settings->markers;
+	gfloat *out_data = tr->y_axis;
+	gfloat *X = tr->x_axis;
+	bool complex_in = fft->num_active_channels == 2;
+	int m = complex_in ? settings->fft_size : settings->fft_size / 2;
+	unsigned int j, count = 0;
+	double avg;
+	gfloat mag, plugin_fft_corr;
+
+	for (j = 0; j <= MAX_MARKERS && markers[j].active; j++)
+		count++;
+	if (!count)
+		return false;
+
+	if (!settings->tone_dft || settings->tone_dft->count != count ||
+			settings->tone_dft->size != (unsigned)settings->fft_size) {
+		tone_dft_destroy(settings->tone_dft);
+		settings->tone_dft = tone_dft_new(settings->fft_size, count);
+		if (!settings->tone_dft)
+			return false;
+	}
+
+	/* Complex spectra are plotted with DC in the middle */
+	for (j = 0; j < count; j++)
+		tone_dft_set_bin(settings->tone_dft, j,
+			complex_in ? markers[j].bin - m / 2 : markers[j].bin);
+
+	tone_dft_process(settings->tone_dft, settings->real_source,
+			complex_in ? settings->imag_source : NULL);
+
+	plugin_fft_corr = ((struct extra_dev_info *)iio_device_get_data(
+			transform_get_device_parent(tr)))->plugin_fft_corr;
+	avg = (double)settings->fft_avg;
+	if (avg && avg != 128)
+		avg = 1.0f / avg;
+
+	for (j = 0; j < count; j++) {
+		double complex out = settings->tone_dft->out[j];
+		int bin = markers[j].bin;
+
+		if (creal(out) == 0 && cimag(out) == 0)
+			out = FLT_MIN + I * FLT_MIN;
+
+		mag = 10 * log10((creal(out) * creal(out) + cimag(out) * cimag(out)) /
+				((unsigned long long)m * m)) +
+			fft->fft_corr + settings->fft_pwr_off + plugin_fft_corr;
+		fft_average(&out_data[bin], mag, avg);
+
+		markers[j].x = (gfloat)X[bin];
+		markers[j].y = (gfloat)out_data[bin];
+		if (complex_in)
+			markers[j].vector = I * settings->imag_source[bin] +
+				settings->real_source[bin];
+		else
+			markers[j].vector = 0 + I * 0;
 	}
+	fft_markers_publish(tr);
+
+	return true;
 }
 
 static void do_fft_for_spectrum(Transform *tr)
@@ -1097,12 +1284,16 @@ static void do_fft_for_spectrum(Transform *tr)
 	enum marker_types marker_type = MARKER_OFF;
 	int fft_clip_size = settings->fft_upper_clipping_limit -
 				settings->fft_lower_clipping_limit;
+	int step = settings->fft_step_bins;
+	int overlap = fft_clip_size - step;
+	bool last = settings->fft_index + 1 == settings->fft_count;
 	gfloat *in_data = settings->real_source;
 	gfloat *in_data_c = settings->imag_source;
-	gfloat *out_data = tr->y_axis + (settings->fft_index * fft_clip_size);
+	gfloat *out_data = tr->y_axis;
 	int fft_size = settings->fft_size;
-	int i, j, k, m;
+	int i, j, k, m, g;
 	int cnt;
+	double pwr;
 	gfloat mag;
 	double avg, pwr_offset;
 	gfloat plugin_fft_corr;
@@ -1169,40 +1360,54 @@ static void do_fft_for_spectrum(Transform *tr)
 		if (creal(fft->out[j]) == 0 && cimag(fft->out[j]) == 0)
 			fft->out[j] = FLT_MIN + I * FLT_MIN;
 
-		mag = 10 * log10((creal(fft->out[j]) * creal(fft->out[j]) +
-				cimag(fft->out[j]) * cimag(fft->out[j])) / ((unsigned long long)fft->m * fft->m)) +
+		pwr = (creal(fft->out[j]) * creal(fft->out[j]) +
+				cimag(fft->out[j]) * cimag(fft->out[j])) / ((unsigned long long)fft->m * fft->m);
+
+		/* Where segments overlap, the power crossfades from one
+		 * segment to the next: the faded tail of a segment is kept
+		 * until the head of the next one is added to it */
+		if (overlap > 0 && k >= step && !last) {
+			settings->blend[k - step] = (1.0 - (k - step + 0.5) / overlap) * pwr;
+			k++;
+			continue;
+		}
+		if (overlap > 0 && k < overlap && settings->fft_index > 0)
+			pwr = settings->blend[k] + (k + 0.5) / overlap * pwr;
+		g = settings->fft_index * step + k;
+
+		mag = 10 * log10(pwr) +
 			settings->fft_corr + pwr_offset + plugin_fft_corr;
 		/* it's better for performance to have separate loops,
 		 * rather than do these tests inside the loop, but it makes
 		 * the code harder to understand... Oh well...
 		 ***/
-		if (out_data[k] == FLT_MAX) {
+		if (out_data[g] == FLT_MAX) {
 			/* Don't average the first iteration */
-			 out_data[k] = mag;
+			 out_data[g] = mag;
 		} else if (!avg) {
 			/* keep peaks */
-			if (out_data[k] <= mag)
-				out_data[k] = mag;
+			if (out_data[g] <= mag)
+				out_data[g] = mag;
 		} else if (avg == 128) {
 			/* keep min */
-			if (out_data[k] >= mag)
-				out_data[k] = mag;
+			if (out_data[g] >= mag)
+				out_data[g] = mag;
 		} else {
 			/* do an average */
-			out_data[k] = ((1 - avg) * out_data[k]) + (avg * mag);
+			out_data[g] = ((1 - avg) * out_data[g]) + (avg * mag);
 		}
 
 		if (MAX_MARKERS && marker_type == MARKER_PEAK) {
-			if (settings->fft_index == 0 && k <= 2) {
+			if (g <= 2) {
 				maxX[0] = 0;
 				maxY[0] = out_data[0];
 			} else {
 				for (j = 0; j <= MAX_MARKERS && markers[j].active; j++) {
-					if  ((*(out_data + k - 1) > maxY[j]) &&
-						((!((*(out_data + k - 2) > *(out_data + k - 1)) &&
-						 (*(out_data + k - 1) > *(out_data + k)))) &&
-						 (!((*(out_data + k - 2) < *(out_data + k - 1)) &&
-						 (*(out_data + k - 1) < *(out_data + k)))))) {
+					if  ((*(out_data + g - 1) > maxY[j]) &&
+						((!((*(out_data + g - 2) > *(out_data + g - 1)) &&
+						 (*(out_data + g - 1) > *(out_data + g)))) &&
+						 (!((*(out_data + g - 2) < *(out_data + g - 1)) &&
+						 (*(out_data + g - 1) < *(out_data + g)))))) {
 
 						if (marker_type == MARKER_PEAK) {
 							for (m = MAX_MARKERS; m > j; m--) {
@@ -1210,8 +1415,8 @@ static void do_fft_for_spectrum(Transform *tr)
 								maxX[m] = maxX[m - 1];
 							}
 						}
-						maxY[j] = *(out_data + k - 1);
-						maxX[j] = k + (settings->fft_index * fft_clip_size) - 1;
+						maxY[j] = *(out_data + g - 1);
+						maxX[j] = g - 1;
 						break;
 					}
 				}
@@ -1309,7 +1514,7 @@ bool time_transform_function(Transform *tr, gboolean init_transform)
 	struct _time_settings *settings = tr->settings;
 	unsigned axis_length = settings->num_samples;
 	gfloat *in_data;
-	unsigned int i;
+	unsigned int i, ops = 0;
 
 	if (init_transform) {
 
@@ -1326,9 +1531,18 @@ bool time_transform_function(Transform *tr, gboolean init_transform)
 		}
 		tr->y_axis_size = axis_length;
 
-		if (settings->apply_inverse_funct ||
-				settings->apply_multiply_funct ||
-				settings->apply_add_funct) {
+		/* Pick the kernel that does all the enabled operations at once */
+		if (settings->apply_inverse_funct)
+			ops |= SAMPLE_OP_INVERSE;
+		if (settings->apply_multiply_funct)
+			ops |= SAMPLE_OP_MULTIPLY;
+		if (settings->apply_add_funct)
+			ops |= SAMPLE_OP_ADD;
+		settings->post_process = sample_op_kernel_get(ops);
+		settings->post_process_params.multiply_value = settings->multiply_value;
+		settings->post_process_params.add_value = settings->add_value;
+
+		if (settings->post_process) {
 			Transform_resize_y_axis(tr, tr->y_axis_size);
 		} else {
 			tr->y_axis = settings->data_source;
@@ -1337,34 +1551,16 @@ bool time_transform_function(Transform *tr, gboolean init_transform)
 		return true;
 	}
 
-	if (tr->plot_channels_type == PLOT_MATH_CHANNEL) {
-		PlotMathChn *m = tr->plot_channels->data;
-		m->math_expression(m->iio_channels_data,
-			m->data_ref, settings->num_samples);
-	} else if (tr->plot_channels_type == PLOT_IIO_CHANNEL) {
-		if (!settings->apply_inverse_funct &&
-				!settings->apply_multiply_funct &&
-				!settings->apply_add_funct)
+	if (tr->plot_channels_type == PLOT_IIO_CHANNEL) {
+		if (!settings->post_process)
 			return true;
 
 		in_data = plot_channels_get_nth_data_ref(tr->plot_channels, 0);
 		if (!in_data)
 			return false;
 
-		for (i = 0; i < tr->y_axis_size; i++) {
-			if (settings->apply_inverse_funct) {
-				if (in_data[i] != 0)
-					tr->y_axis[i] = 1 / in_data[i];
-				else
-					tr->y_axis[i] = 65535;
-			} else {
-				tr->y_axis[i] = in_data[i];
-			}
-			if (settings->apply_multiply_funct)
-				tr->y_axis[i] *= settings->multiply_value;
-			if (settings->apply_add_funct)
-				tr->y_axis[i] += settings->add_value;
-		}
+		settings->post_process(in_data, tr->y_axis, tr->y_axis_size,
+				&settings->post_process_params);
 	}
 
 	return true;
@@ -1414,15 +1610,6 @@ bool cross_correlation_transform_function(Transform *tr, gboolean init_transform
 		return true;
 	}
 
-	GSList *node;
-
-	if (tr->plot_channels_type == PLOT_MATH_CHANNEL)
-		for (node = tr->plot_channels; node; node = g_slist_next(node)) {
-			PlotMathChn *m = node->data;
-			m->math_expression(m->iio_channels_data,
-				m->data_ref, settings->num_samples);
-		}
-
 	i_0 = settings->i0_source;
 	q_0 = settings->q0_source;
 	i_1 = settings->i1_source;
@@ -1525,7 +1712,7 @@ bool freq_spectrum_transform_function(Transform *tr, gboolean init_transform)
 {
 	struct iio_channel *chn;
 	struct _freq_spectrum_settings *settings = tr->settings;
-	unsigned i, j, k, axis_length, fft_size, bits_used;
+	unsigned i, j, k, axis_length, fft_size, bits_used, clip_size, step;
 	int ret;
 	double sampling_freq;
 	bool complete_transform = false;
@@ -1553,14 +1740,26 @@ bool freq_spectrum_transform_function(Transform *tr, gboolean init_transform)
 		settings->real_source = plot_channels_get_nth_data_ref(tr->plot_channels, 0);
 		settings->imag_source = plot_channels_get_nth_data_ref(tr->plot_channels, 1);
 
-		axis_length = (settings->fft_upper_clipping_limit - settings->fft_lower_clipping_limit) * settings->fft_count;
+		/* Consecutive segments start step bins apart; they overlap by
+		 * at most half of their width */
+		clip_size = settings->fft_upper_clipping_limit - settings->fft_lower_clipping_limit;
+		step = settings->freq_step * fft_size / sampling_freq + 0.5;
+		if (!step || step > clip_size)
+			step = clip_size;
+		if (step < (clip_size + 1) / 2)
+			step = (clip_size + 1) / 2;
+		settings->fft_step_bins = step;
+		if (clip_size > step)
+			settings->blend = g_renew(gfloat, settings->blend, clip_size - step);
+
+		axis_length = settings->fft_count ? step * (settings->fft_count - 1) + clip_size : 0;
 		Transform_resize_x_axis(tr, axis_length);
 		Transform_resize_y_axis(tr, axis_length);
 
-		for (i = 0, k = 0; i < settings->fft_count; i++) {
-			for (j = 0; j < fft_size; j++) {
+		for (i = 0; i < settings->fft_count; i++) {
+			for (j = 0, k = i * step; j < fft_size; j++) {
 				if (j >= settings->fft_lower_clipping_limit && j < settings->fft_upper_clipping_limit) {
-					tr->x_axis[k] = (j * sampling_freq / settings->fft_size - sampling_freq / 2) + settings->freq_sweep_start + (settings->filter_bandwidth) * i;
+					tr->x_axis[k] = (j * sampling_freq / settings->fft_size - sampling_freq / 2) + settings->freq_sweep_start + settings->freq_step * i;
 					tr->y_axis[k] = FLT_MAX;
 					k++;
 				}
@@ -1606,6 +1805,50 @@ bool freq_spectrum_transform_function(Transform *tr, gboolean init_transform)
 	return complete_transform;
 }
 
+/* Put the zoom stage in front of the FFT: the FFT then reads the complex
+ * output of the downconverter instead of the channels themselves. */
+static bool fft_zoom_setup(Transform *tr, struct extra_dev_info *dev_info,
+		unsigned num_samples)
+{
+	struct _fft_settings *settings = tr->settings;
+	unsigned int channels = g_slist_length(tr->plot_channels);
+
+	zoom_fft_destroy(settings->zoom_fft);
+	settings->zoom_fft = NULL;
+	free(settings->zoom_data);
+	settings->zoom_data = NULL;
+	settings->fft_alg_data.num_active_channels = channels;
+
+	if (settings->zoom < 2)
+		return true;
+
+	if (num_samples < zoom_fft_input_count(settings->fft_size, settings->zoom)) {
+		fprintf(stderr, "Not enough samples for a x%u zoom, zoom disabled\n",
+				settings->zoom);
+		return true;
+	}
+
+	settings->zoom_fft = zoom_fft_new(settings->fft_size, settings->zoom);
+	settings->zoom_data = malloc(sizeof(gfloat) * 2 * settings->fft_size);
+	if (!settings->zoom_fft || !settings->zoom_data) {
+		zoom_fft_destroy(settings->zoom_fft);
+		settings->zoom_fft = NULL;
+		free(settings->zoom_data);
+		settings->zoom_data = NULL;
+		return false;
+	}
+	zoom_fft_set_center(settings->zoom_fft,
+			settings->zoom_center / dev_info->adc_freq);
+
+	settings->zoom_source_i = settings->real_source;
+	settings->zoom_source_q = (channels > 1) ? settings->imag_source : NULL;
+	settings->real_source = settings->zoom_data;
+	settings->imag_source = settings->zoom_data + settings->fft_size;
+	settings->fft_alg_data.num_active_channels = 2;
+
+	return true;
+}
+
 bool fft_transform_function(Transform *tr, gboolean init_transform)
 {
 	struct iio_device *dev;
@@ -1649,17 +1892,30 @@ bool fft_transform_function(Transform *tr, gboolean init_transform)
 
 		if (!bits_used)
 			return false;
+		if (!fft_zoom_setup(tr, dev_info, num_samples))
+			return false;
 		axis_length = settings->fft_size * settings->fft_alg_data.num_active_channels / 2;
 		Transform_resize_x_axis(tr, axis_length);
 		Transform_resize_y_axis(tr, axis_length);
 		tr->y_axis_size = axis_length;
-		if (settings->fft_alg_data.num_active_channels == 2)
-			corr = dev_info->adc_freq / 2.0;
-		else
-			corr = 0;
-		for (i = 0; i < axis_length; i++) {
-			tr->x_axis[i] = i * dev_info->adc_freq / num_samples - corr;
-			tr->y_axis[i] = FLT_MAX;
+		if (settings->zoom_fft) {
+			/* The decimated band, centered on the zoom center */
+			double span = dev_info->adc_freq / settings->zoom;
+
+			for (i = 0; i < axis_length; i++) {
+				tr->x_axis[i] = settings->zoom_center +
+					(i - axis_length / 2) * span / axis_length;
+				tr->y_axis[i] = FLT_MAX;
+			}
+		} else {
+			if (settings->fft_alg_data.num_active_channels == 2)
+				corr = dev_info->adc_freq / 2.0;
+			else
+				corr = 0;
+			for (i = 0; i < axis_length; i++) {
+				tr->x_axis[i] = i * dev_info->adc_freq / num_samples - corr;
+				tr->y_axis[i] = FLT_MAX;
+			}
 		}
 
 		/* Compute FFT normalization and scaling offset */
@@ -1674,15 +1930,15 @@ bool fft_transform_function(Transform *tr, gboolean init_transform)
 		return true;
 	}
 
-	GSList *node;
-
-	if (tr->plot_channels_type == PLOT_MATH_CHANNEL)
-		for (node = tr->plot_channels; node; node = g_slist_next(node)) {
-			PlotMathChn *m = node->data;
-			m->math_expression(m->iio_channels_data,
-				m->data_ref, settings->fft_size);
-		}
-	do_fft(tr);
+	if (settings->zoom_fft)
+		zoom_fft_process(settings->zoom_fft, settings->zoom_source_i,
+				settings->zoom_source_q, settings->real_source,
+				settings->imag_source);
+	if (!settings->markers_only || !settings->markers ||
+			!settings->marker_type ||
+			*settings->marker_type != MARKER_FIXED ||
+			!do_fixed_markers(tr))
+		do_fft(tr);
 
 	return true;
 }
@@ -1703,17 +1959,25 @@ bool constellation_transform_function(Transform *tr, gboolean init_transform)
 		tr->x_axis = settings->x_source;
 		tr->y_axis = settings->y_source;
 
+		density_map_destroy(settings->density);
+		settings->density = NULL;
+		if (settings->density_mode) {
+			settings->density = density_map_new(DENSITY_GRID_SIZE,
+					DENSITY_GRID_SIZE, DENSITY_LEVELS);
+			if (!settings->density)
+				return false;
+			density_map_set_decay(settings->density,
+					settings->density_decay);
+		}
+
 		return true;
 	}
 
-	GSList *node;
-
-	if (tr->plot_channels_type == PLOT_MATH_CHANNEL)
-		for (node = tr->plot_channels; node; node = g_slist_next(node)) {
-			PlotMathChn *m = node->data;
-			m->math_expression(m->iio_channels_data,
-				m->data_ref, settings->num_samples);
-		}
+	if (settings->density) {
+		density_map_accumulate(settings->density, settings->x_source,
+				settings->y_source, settings->num_samples);
+		density_map_update_levels(settings->density);
+	}
 
 	return true;
 }
@@ -1889,6 +2153,7 @@ static void plot_math_channel_destroy(PlotChn *obj)
 		g_free(this->txt_math_expression);
 
 	math_expression_close_lib_handler(this->math_lib_handler);
+	math_program_destroy(this->math_program);
 
 	free(this);
 }
@@ -2171,6 +2436,14 @@ static int plot_get_sample_count_of_device(OscPlot *plot, const char *device)
 	switch (gtk_combo_box_get_active(GTK_COMBO_BOX(priv->hor_units))) {
 	case 0:
 		count = (int)osc_plot_get_sample_count(plot);
+		if (gtk_combo_box_get_active(GTK_COMBO_BOX(priv->plot_domain)) == FFT_PLOT) {
+			int zoom = comboboxtext_get_active_text_as_int(
+				GTK_COMBO_BOX_TEXT(priv->fft_zoom_widget));
+
+			/* The zoom FFT decimates, so it needs more input */
+			if (zoom > 1)
+				count = zoom_fft_input_count(count, zoom);
+		}
 		break;
 	case 1:
 		iio_dev = iio_context_find_device(ctx, device);
@@ -2235,6 +2508,8 @@ static void update_transform_settings(OscPlot *plot, Transform *transform)
 		FFT_SETTINGS(transform)->fft_size = comboboxtext_get_active_text_as_int(GTK_COMBO_BOX_TEXT(priv->fft_size_widget));
 		FFT_SETTINGS(transform)->fft_avg = gtk_spin_button_get_value(GTK_SPIN_BUTTON(priv->fft_avg_widget));
 		FFT_SETTINGS(transform)->fft_pwr_off = gtk_spin_button_get_value(GTK_SPIN_BUTTON(priv->fft_pwr_offset_widget));
+		FFT_SETTINGS(transform)->zoom = comboboxtext_get_active_text_as_int(GTK_COMBO_BOX_TEXT(priv->fft_zoom_widget));
+		FFT_SETTINGS(transform)->zoom_center = gtk_spin_button_get_value(GTK_SPIN_BUTTON(priv->fft_zoom_center_widget));
 		FFT_SETTINGS(transform)->fft_alg_data.cached_fft_size = -1;
 		FFT_SETTINGS(transform)->fft_alg_data.cached_num_active_channels = -1;
 		FFT_SETTINGS(transform)->fft_alg_data.num_active_channels = g_slist_length(transform->plot_channels);
@@ -2282,6 +2557,8 @@ static void update_transform_settings(OscPlot *plot, Transform *transform)
 		FREQ_SPECTRUM_SETTINGS(transform)->fft_count = priv->fft_count;
 		FREQ_SPECTRUM_SETTINGS(transform)->freq_sweep_start = priv->start_freq + priv->filter_bw / 2;
 		FREQ_SPECTRUM_SETTINGS(transform)->filter_bandwidth = priv->filter_bw;
+		FREQ_SPECTRUM_SETTINGS(transform)->freq_step = priv->freq_step > 0 ?
+			priv->freq_step : priv->filter_bw;
 		FREQ_SPECTRUM_SETTINGS(transform)->fft_size = comboboxtext_get_active_text_as_int(GTK_COMBO_BOX_TEXT(priv->fft_size_widget));
 		FREQ_SPECTRUM_SETTINGS(transform)->fft_avg = gtk_spin_button_get_value(GTK_SPIN_BUTTON(priv->fft_avg_widget));
 		FREQ_SPECTRUM_SETTINGS(transform)->fft_pwr_off = gtk_spin_button_get_value(GTK_SPIN_BUTTON(priv->fft_pwr_offset_widget));
@@ -2420,6 +2697,15 @@ static void remove_transform_from_list(OscPlot *plot, Transform *tr)
 		free(FREQ_SPECTRUM_SETTINGS(tr)->ffts_alg_data);
 		free(FREQ_SPECTRUM_SETTINGS(tr)->maxXaxis);
 		free(FREQ_SPECTRUM_SETTINGS(tr)->maxYaxis);
+		g_free(FREQ_SPECTRUM_SETTINGS(tr)->blend);
+	} else if (tr->type_id == FFT_TRANSFORM ||
+			tr->type_id == COMPLEX_FFT_TRANSFORM) {
+		zoom_fft_destroy(FFT_SETTINGS(tr)->zoom_fft);
+		free(FFT_SETTINGS(tr)->zoom_data);
+		tone_dft_destroy(FFT_SETTINGS(tr)->tone_dft);
+	} else if (tr->type_id == CONSTELLATION_TRANSFORM) {
+		density_map_destroy(CONSTELLATION_SETTINGS(tr)->density);
+		g_slist_free(CONSTELLATION_SETTINGS(tr)->density_graphs);
 	}
 	TrList_remove_transform(list, tr);
 	Transform_destroy(tr);
@@ -2571,6 +2857,7 @@ static void plot_channels_update(OscPlot *plot)
 			num_samples = osc_plot_get_sample_count(plot);
 		mch->data_ref = realloc(mch->data_ref,
 				sizeof(gfloat) * num_samples);
+		mch->num_samples = num_samples;
 	}
 }
 
@@ -2846,6 +3133,197 @@ static void device_rx_info_update(OscPlot *plot)
 	}
 }
 
+/*
+ * The math channels of a device are evaluated once per capture of the
+ * device, ahead of the transforms and over the whole capture, so every
+ * transform reading a channel, and any update of the plot that doesn't
+ * bring new samples, reuses data_ref. Those without a PreviousValue carry
+ * share a single loop over the device channels; the others run on their own.
+ */
+struct math_pass {
+	struct extra_dev_info *dev_info;
+	gfloat ***channels_data;
+	unsigned int count;
+
+	PlotMathChn **fused;
+	struct math_program **programs;
+	float **outs;
+	unsigned int num_fused;
+	math_fused_function fused_fn;
+	void *fused_lib_handler;
+
+	GSList *others;
+};
+
+static void math_pass_free(struct math_pass *pass)
+{
+	math_expression_close_lib_handler(pass->fused_lib_handler);
+	g_slist_free(pass->others);
+	g_free(pass->fused);
+	g_free(pass->programs);
+	g_free(pass->outs);
+	g_free(pass);
+}
+
+static void math_passes_clear(OscPlotPrivate *priv)
+{
+	g_slist_free_full(priv->math_passes, (GDestroyNotify)math_pass_free);
+	priv->math_passes = NULL;
+}
+
+static bool math_channel_is_fusable(PlotMathChn *m)
+{
+	return m->math_program && !math_program_is_serial(m->math_program);
+}
+
+static struct math_pass * math_pass_new(OscPlot *plot, GSList *channels)
+{
+	struct math_pass *pass = g_new0(struct math_pass, 1);
+	PlotMathChn *m = channels->data;
+	struct iio_device *dev;
+	GSList *node;
+	unsigned int n = 0;
+
+	dev = iio_context_find_device(plot->priv->ctx, m->iio_device_name);
+	if (dev)
+		pass->dev_info = iio_device_get_data(dev);
+	pass->channels_data = m->iio_channels_data;
+	pass->count = m->num_samples;
+
+	for (node = channels; node; node = g_slist_next(node)) {
+		m = node->data;
+		/* data_ref was just reallocated, whatever it held is gone */
+		if (pass->dev_info)
+			m->generation = pass->dev_info->capture_generation - 1;
+		if (math_channel_is_fusable(m))
+			n++;
+	}
+
+	/* A single channel gains nothing from the fused loop */
+	if (n < 2) {
+		pass->others = g_slist_copy(channels);
+		return pass;
+	}
+
+	pass->fused = g_new(PlotMathChn *, n);
+	pass->programs = g_new(struct math_program *, n);
+	pass->outs = g_new(float *, n);
+	for (node = channels; node; node = g_slist_next(node)) {
+		m = node->data;
+		if (!math_channel_is_fusable(m)) {
+			pass->others = g_slist_append(pass->others, m);
+			continue;
+		}
+		pass->fused[pass->num_fused] = m;
+		pass->programs[pass->num_fused++] = m->math_program;
+	}
+
+#ifdef MATH_EXPRESSION_GCC
+	GSList *exprs = NULL, *basenames;
+	unsigned int i;
+
+	for (i = 0; i < pass->num_fused; i++) {
+		if (!pass->fused[i]->math_expression)
+			break;
+		exprs = g_slist_append(exprs,
+				pass->fused[i]->txt_math_expression);
+	}
+	if (i == pass->num_fused) {
+		basenames = iio_chn_basenames_get(plot,
+				pass->fused[0]->iio_device_name);
+		pass->fused_fn = math_expression_get_fused_function(exprs,
+				&pass->fused_lib_handler, basenames);
+		g_slist_free_full(basenames, (GDestroyNotify)g_free);
+	}
+	g_slist_free(exprs);
+#endif
+
+	return pass;
+}
+
+/* Group the math channels used by the transforms of the plot by device */
+static void math_passes_build(OscPlot *plot)
+{
+	OscPlotPrivate *priv = plot->priv;
+	TrList *tr_list = priv->transform_list;
+	GSList *channels = NULL, *node, *group, *rest;
+	PlotMathChn *m;
+	int i;
+
+	math_passes_clear(priv);
+
+	for (i = 0; i < tr_list->size; i++) {
+		Transform *tr = tr_list->transforms[i];
+
+		if (tr->plot_channels_type != PLOT_MATH_CHANNEL)
+			continue;
+		for (node = tr->plot_channels; node; node = g_slist_next(node))
+			if (!g_slist_find(channels, node->data))
+				channels = g_slist_append(channels, node->data);
+	}
+
+	while (channels) {
+		m = channels->data;
+		group = NULL;
+		rest = NULL;
+		for (node = channels; node; node = g_slist_next(node)) {
+			PlotMathChn *other = node->data;
+
+			if (!strcmp(other->iio_device_name, m->iio_device_name))
+				group = g_slist_append(group, other);
+			else
+				rest = g_slist_append(rest, other);
+		}
+		priv->math_passes = g_slist_append(priv->math_passes,
+				math_pass_new(plot, group));
+		g_slist_free(group);
+		g_slist_free(channels);
+		channels = rest;
+	}
+}
+
+static bool math_channel_needs_update(struct math_pass *pass, PlotMathChn *m)
+{
+	if (!pass->dev_info)
+		return true;
+	if (m->generation == pass->dev_info->capture_generation)
+		return false;
+
+	m->generation = pass->dev_info->capture_generation;
+	return true;
+}
+
+static void math_pass_run(struct math_pass *pass)
+{
+	PlotMathChn *m;
+	GSList *node;
+	unsigned int i;
+
+	/* The fused channels are always updated together */
+	if (pass->num_fused && math_channel_needs_update(pass, pass->fused[0])) {
+		for (i = 1; i < pass->num_fused; i++)
+			pass->fused[i]->generation = pass->fused[0]->generation;
+
+		/* The outputs are reallocated when the capture is set up */
+		for (i = 0; i < pass->num_fused; i++)
+			pass->outs[i] = pass->fused[i]->data_ref;
+
+		if (pass->fused_fn)
+			pass->fused_fn(pass->channels_data, pass->outs,
+					pass->count);
+		else
+			math_program_run_fused(pass->programs, pass->num_fused,
+					pass->channels_data, pass->outs,
+					pass->count);
+	}
+
+	for (node = pass->others; node; node = g_slist_next(node)) {
+		m = node->data;
+		if (math_channel_needs_update(pass, m))
+			plot_math_channel_evaluate(m, pass->count);
+	}
+}
+
 static bool call_all_transform_functions(OscPlotPrivate *priv)
 {
 	TrList *tr_list = priv->transform_list;
@@ -2853,11 +3331,17 @@ static bool call_all_transform_functions(OscPlotPrivate *priv)
 	bool valid = true;
 	int i = 0;
 
-	if (priv->redraw_function <= 0)
+	if (!priv->redraw_enabled)
 		return false;
 
+	g_slist_foreach(priv->math_passes, (GFunc)math_pass_run, NULL);
+
 	for (; i < tr_list->size; i++) {
 		tr = tr_list->transforms[i];
+		if (tr->type_id == FFT_TRANSFORM ||
+				tr->type_id == COMPLEX_FFT_TRANSFORM)
+			FFT_SETTINGS(tr)->markers_only =
+				!g_atomic_int_get(&priv->viewable);
 		valid = valid && Transform_update_output(tr);
 	}
 
@@ -3114,70 +3598,282 @@ static void fps_counter(OscPlotPrivate *priv)
 	}
 }
 
-static gboolean plot_redraw(OscPlotPrivate *priv)
+static void density_graphs_add(OscPlotPrivate *priv, Transform *tr)
 {
-	TrList *tr_list = priv->transform_list;
-	Transform *tr;
-	bool show_diff_phase = false;
-	int i;
+	struct _constellation_settings *settings = tr->settings;
+	struct density_map *map = settings->density;
+	GtkDataboxGraph *graph;
+	GtkAllocation alloc;
+	gint size;
+	unsigned int i;
 
-	if (!GTK_IS_DATABOX(priv->databox))
-		return FALSE;
+	/* Make the points as big as a grid cell, so the levels form an image */
+	gtk_widget_get_allocation(priv->databox, &alloc);
+	size = MAX(alloc.width, alloc.height) / DENSITY_GRID_SIZE + 1;
 
-	if (priv->redraw) {
-			auto_scale_databox(priv, GTK_DATABOX(priv->databox));
-			gtk_widget_queue_draw(priv->databox);
-			fps_counter(priv);
-			for (i = 0; i < tr_list->size; i++) {
-				tr = tr_list->transforms[i];
-				if (tr->has_the_marker) {
+	g_slist_free(settings->density_graphs);
+	settings->density_graphs = NULL;
 
-					show_diff_phase = true;
-					draw_marker_values(priv, tr);
-				}
-			}
-			if (show_diff_phase)
-				markers_phase_diff_show(priv);
+	/* The length is adjusted on every redraw, see density_graphs_update() */
+	for (i = 0; i < map->levels; i++) {
+		graph = gtk_databox_points_new(1,
+				map->level_x[i], map->level_y[i],
+				&color_density[i], size);
+		gtk_databox_graph_set_hide(graph, TRUE);
+		gtk_databox_graph_add(GTK_DATABOX(priv->databox), graph);
+		settings->density_graphs = g_slist_append(
+				settings->density_graphs, graph);
 	}
-	if (priv->stop_redraw == TRUE)
-		priv->redraw_function = 0;
-
-	priv->redraw = FALSE;
-	return !priv->stop_redraw;
 }
 
-static void capture_start(OscPlotPrivate *priv)
+static void density_graphs_update(Transform *tr)
 {
-	if (priv->redraw_function) {
-		priv->stop_redraw = FALSE;
-	} else {
-		priv->stop_redraw = FALSE;
-		priv->redraw_function = g_timeout_add_full(G_PRIORITY_DEFAULT_IDLE, 50, (GSourceFunc) plot_redraw, priv, NULL);
+	struct _constellation_settings *settings = tr->settings;
+	GSList *node;
+	unsigned int i;
+
+	for (i = 0, node = settings->density_graphs; node;
+			i++, node = g_slist_next(node)) {
+		guint len = settings->density->level_len[i];
+
+		/* Only draw the cells that are in use */
+		if (len)
+			g_object_set(G_OBJECT(node->data), "length", len, NULL);
+		gtk_databox_graph_set_hide(GTK_DATABOX_GRAPH(node->data), !len);
 	}
 }
 
-static void plot_setup(OscPlot *plot)
+static void plot_redraw(OscPlotPrivate *priv)
 {
-	OscPlotPrivate *priv = plot->priv;
 	TrList *tr_list = priv->transform_list;
-	Transform *transform;
-	gfloat *transform_x_axis;
-	gfloat *transform_y_axis;
-	unsigned int max_x_axis = 0;
-	GtkDataboxGraph *graph;
+	Transform *tr;
+	GdkWindow *window;
+	bool show_diff_phase = false;
+	gint64 start;
 	int i;
 
-	gtk_databox_graph_remove_all(GTK_DATABOX(priv->databox));
-	markers_init(plot);
-	osc_plot_update_rx_lbl(plot, FORCE_UPDATE);
+	if (!GTK_IS_DATABOX(priv->databox) || !priv->redraw)
+		return;
+
+	start = g_get_monotonic_time();
 
 	for (i = 0; i < tr_list->size; i++) {
-		transform = tr_list->transforms[i];
+		tr = tr_list->transforms[i];
+		if (tr->type_id == CONSTELLATION_TRANSFORM &&
+				CONSTELLATION_SETTINGS(tr)->density)
+			density_graphs_update(tr);
+	}
+	auto_scale_databox(priv, GTK_DATABOX(priv->databox));
+	gtk_widget_queue_draw(priv->databox);
+	fps_counter(priv);
+	for (i = 0; i < tr_list->size; i++) {
+		tr = tr_list->transforms[i];
+		if (tr->has_the_marker) {
+
+			show_diff_phase = true;
+			draw_marker_values(priv, tr);
+		}
+	}
+	if (show_diff_phase)
+		markers_phase_diff_show(priv);
+
+	/* Draw now rather than from the main loop, so the cost is known */
+	window = gtk_widget_get_window(priv->databox);
+	if (window)
+		gdk_window_process_updates(window, TRUE);
+
+	priv->redraw_cost = g_get_monotonic_time() - start;
+	priv->redraw = FALSE;
+}
+
+/*
+ * Redraw scheduling
+ *
+ * Plots don't redraw on a timer of their own. Every time a plot has a new
+ * frame, osc_plot_data_update() queues it here. One shared timer then draws
+ * the queued plots, at most once per display frame for each of them.
+ * Windows that are hidden, minimized or fully covered are not drawn; they
+ * are drawn when they are shown again. A plot whose last draw took longer
+ * than a display frame waits that long before it is drawn again, so it
+ * skips the frames that arrived in the meantime.
+ * The queue and the timer belong to the main loop. Frames computed by other
+ * threads are posted to it through redraw_pending.
+ */
+#define REDRAW_FRAME_RATE	60
+#define REDRAW_FRAME_TIME	(G_USEC_PER_SEC / REDRAW_FRAME_RATE)
+
+static GSList *redraw_queue;
+static guint redraw_source;
+
+static GMutex redraw_lock;	/* protects the two below */
+static GSList *redraw_pending;
+static guint redraw_pending_source;
+
+static bool plot_is_viewable(OscPlotPrivate *priv)
+{
+	return gtk_widget_get_visible(priv->window) &&
+		!priv->iconified && !priv->obscured;
+}
+
+/* Called from the main loop whenever the visibility may have changed */
+static void plot_viewable_update(OscPlotPrivate *priv)
+{
+	g_atomic_int_set(&priv->viewable, plot_is_viewable(priv));
+}
+
+static gboolean redraw_scheduler_dispatch(gpointer data);
+
+static void redraw_scheduler_arm(void)
+{
+	gint64 now, first = G_MAXINT64;
+	guint delay = 0;
+	GSList *node;
+
+	if (redraw_source) {
+		g_source_remove(redraw_source);
+		redraw_source = 0;
+	}
+
+	if (!redraw_queue)
+		return;
+
+	for (node = redraw_queue; node; node = g_slist_next(node)) {
+		OscPlotPrivate *priv = node->data;
+
+		if (priv->next_redraw_time < first)
+			first = priv->next_redraw_time;
+	}
+
+	now = g_get_monotonic_time();
+	if (first > now)
+		delay = (first - now + 999) / 1000;
+
+	redraw_source = g_timeout_add_full(G_PRIORITY_DEFAULT_IDLE, delay,
+			redraw_scheduler_dispatch, NULL, NULL);
+}
+
+static gboolean redraw_scheduler_dispatch(gpointer data)
+{
+	gint64 now = g_get_monotonic_time();
+	GSList *node, *next;
+
+	for (node = redraw_queue; node; node = next) {
+		OscPlotPrivate *priv = node->data;
+
+		next = g_slist_next(node);
+		if (priv->next_redraw_time > now)
+			continue;
+
+		redraw_queue = g_slist_delete_link(redraw_queue, node);
+		if (!priv->redraw_enabled || !plot_is_viewable(priv))
+			continue;
+
+		plot_redraw(priv);
+		priv->next_redraw_time = g_get_monotonic_time() +
+			MAX(REDRAW_FRAME_TIME, priv->redraw_cost);
+	}
+
+	/* The timer is removed by returning FALSE, not by the rearm below */
+	redraw_source = 0;
+	redraw_scheduler_arm();
+
+	return FALSE;
+}
+
+static void redraw_scheduler_request(OscPlotPrivate *priv)
+{
+	if (g_slist_find(redraw_queue, priv))
+		return;
+
+	redraw_queue = g_slist_append(redraw_queue, priv);
+	redraw_scheduler_arm();
+}
+
+static gboolean redraw_scheduler_flush(gpointer data)
+{
+	GSList *pending, *node;
+
+	g_mutex_lock(&redraw_lock);
+	pending = redraw_pending;
+	redraw_pending = NULL;
+	redraw_pending_source = 0;
+	g_mutex_unlock(&redraw_lock);
+
+	for (node = pending; node; node = g_slist_next(node))
+		redraw_scheduler_request(node->data);
+	g_slist_free(pending);
+
+	return FALSE;
+}
+
+/* redraw_scheduler_request(), from a thread other than the main loop */
+static void redraw_scheduler_post(OscPlotPrivate *priv)
+{
+	g_mutex_lock(&redraw_lock);
+	if (!g_slist_find(redraw_pending, priv))
+		redraw_pending = g_slist_prepend(redraw_pending, priv);
+	if (!redraw_pending_source)
+		redraw_pending_source = g_idle_add(redraw_scheduler_flush, NULL);
+	g_mutex_unlock(&redraw_lock);
+}
+
+static void redraw_scheduler_cancel(OscPlotPrivate *priv)
+{
+	g_mutex_lock(&redraw_lock);
+	redraw_pending = g_slist_remove(redraw_pending, priv);
+	g_mutex_unlock(&redraw_lock);
+
+	if (!g_slist_find(redraw_queue, priv))
+		return;
+
+	redraw_queue = g_slist_remove(redraw_queue, priv);
+	redraw_scheduler_arm();
+}
+
+static void capture_start(OscPlotPrivate *priv)
+{
+	priv->redraw_enabled = TRUE;
+	priv->next_redraw_time = 0;
+}
+
+static void plot_setup(OscPlot *plot)
+{
+	OscPlotPrivate *priv = plot->priv;
+	TrList *tr_list = priv->transform_list;
+	Transform *transform;
+	gfloat *transform_x_axis;
+	gfloat *transform_y_axis;
+	unsigned int max_x_axis = 0;
+	GtkDataboxGraph *graph;
+	int i;
+
+	gtk_databox_graph_remove_all(GTK_DATABOX(priv->databox));
+	markers_init(plot);
+	osc_plot_update_rx_lbl(plot, FORCE_UPDATE);
+	math_passes_build(plot);
+
+	for (i = 0; i < tr_list->size; i++) {
+		transform = tr_list->transforms[i];
+		gchar *plot_type_str = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->plot_type));
+
+		if (transform->type_id == CONSTELLATION_TRANSFORM) {
+			CONSTELLATION_SETTINGS(transform)->density_mode =
+				!strcmp(plot_type_str, "Density");
+			CONSTELLATION_SETTINGS(transform)->density_decay =
+				priv->density_decay;
+		}
+
 		Transform_setup(transform);
 		transform_x_axis = Transform_get_x_axis_ref(transform);
 		transform_y_axis = Transform_get_y_axis_ref(transform);
 
-		gchar *plot_type_str = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->plot_type));
+		if (transform->type_id == CONSTELLATION_TRANSFORM &&
+				CONSTELLATION_SETTINGS(transform)->density) {
+			g_free(plot_type_str);
+			density_graphs_add(priv, transform);
+			continue;
+		}
+
 		if (strcmp(plot_type_str, "Lines")) {
 			graph = gtk_databox_points_new(transform->y_axis_size,
 					transform_x_axis, transform_y_axis,
@@ -3214,7 +3910,7 @@ static void plot_setup(OscPlot *plot)
 			!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(priv->enable_auto_scale)))
 			gtk_databox_set_total_limits(GTK_DATABOX(priv->databox), -1000.0, 1000.0, 1000, -1000);
 		else if (priv->active_transform_type == FREQ_SPECTRUM_TRANSFORM) {
-			double end_freq = priv->start_freq + priv->filter_bw * priv->fft_count;
+			double end_freq = priv->start_freq + spect_width(priv);
 			double width = end_freq - priv->start_freq;
 			gtk_databox_set_total_limits(GTK_DATABOX(priv->databox),
 				priv->start_freq - 0.05 * width, end_freq + 0.05 * width,
@@ -3296,7 +3992,9 @@ static void capture_button_clicked_cb(GtkToggleToolButton *btn, gpointer data)
 		priv->frame_counter = 0;
 		capture_start(priv);
 	} else {
-		priv->stop_redraw = TRUE;
+		priv->redraw_enabled = FALSE;
+		redraw_scheduler_cancel(priv);
+		math_passes_clear(priv);
 		dispose_parameters_from_plot(plot);
 		deassert_used_channels(plot);
 
@@ -3965,7 +4663,7 @@ static void rescale_databox(OscPlotPrivate *priv, GtkDatabox *box, gfloat border
 		if (min_x == 0) {
 			min_x = priv->start_freq;
 		}
-		width = priv->filter_bw * priv->fft_count;
+		width = spect_width(priv);
 
 		gtk_databox_set_total_limits(box, min_x - 0.05 * width,
 				max_x + 0.05 * width, max_y, min_y);
@@ -4138,6 +4836,9 @@ static void transform_csv_print(OscPlotPrivate *priv, FILE *fp, Transform *tr)
 static void plot_destroyed (GtkWidget *object, OscPlot *plot)
 {
 	osc_plot_draw_stop(plot);
+	redraw_scheduler_cancel(plot->priv);
+	math_passes_clear(plot->priv);
+	export_abandon(plot->priv);
 	g_slist_free_full(plot->priv->ch_settings_list, (GDestroyNotify)g_free);
 	g_mutex_trylock(&plot->priv->g_marker_copy_lock);
 	g_mutex_unlock(&plot->priv->g_marker_copy_lock);
@@ -4296,25 +4997,527 @@ static void saveas_dialog_show(GtkWidget *w, OscPlot *plot)
 	gtk_widget_show(priv->saveas_dialog);
 }
 
-static void save_as(OscPlot *plot, const char *filename, int type)
+static gboolean export_progress_update(OscPlotPrivate *priv)
+{
+	gtk_progress_bar_set_fraction(GTK_PROGRESS_BAR(priv->export_progress),
+			data_export_progress(priv->export));
+
+	return TRUE;
+}
+
+static void export_dialog_response_cb(GtkDialog *dialog, gint response_id,
+		OscPlotPrivate *priv)
+{
+	data_export_cancel(priv->export);
+}
+
+static void export_done(struct data_export *exp, void *data)
+{
+	OscPlotPrivate *priv = data;
+
+	if (exp->error && exp->error != ECANCELED)
+		fprintf(stderr, "Error saving %s: %s\n", exp->filename,
+				strerror(exp->error));
+
+	g_source_remove(priv->export_timer);
+	gtk_widget_destroy(priv->export_dialog);
+	priv->export_timer = 0;
+	priv->export_dialog = NULL;
+	priv->export = NULL;
+	data_export_free(exp);
+}
+
+/* Leave a running export to finish on its own, e.g. when the plot goes away */
+static void export_abandon(OscPlotPrivate *priv)
+{
+	if (!priv->export)
+		return;
+
+	priv->export->done = NULL;
+	data_export_cancel(priv->export);
+	g_source_remove(priv->export_timer);
+	priv->export_timer = 0;
+	priv->export = NULL;
+}
+
+static void export_start(OscPlot *plot, struct data_export *exp,
+		data_export_writer writer)
 {
 	OscPlotPrivate *priv = plot->priv;
-	struct iio_context *ctx = priv->ctx;
-	FILE *fp;
+	GtkWidget *content;
+	char *basename;
+	int ret;
+
+	ret = data_export_start(exp, writer, export_done, priv);
+	if (ret < 0) {
+		fprintf(stderr, "Error creating %s: %s\n", exp->filename,
+				strerror(-ret));
+		data_export_free(exp);
+		return;
+	}
+	priv->export = exp;
+
+	/* Not modal: the plot keeps capturing while the file is written */
+	priv->export_dialog = gtk_dialog_new_with_buttons("Saving",
+			GTK_WINDOW(priv->window), GTK_DIALOG_DESTROY_WITH_PARENT,
+			GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL, NULL);
+	priv->export_progress = gtk_progress_bar_new();
+	basename = g_path_get_basename(exp->filename);
+	gtk_progress_bar_set_text(GTK_PROGRESS_BAR(priv->export_progress),
+			basename);
+	g_free(basename);
+	content = gtk_dialog_get_content_area(GTK_DIALOG(priv->export_dialog));
+	gtk_box_pack_start(GTK_BOX(content), priv->export_progress,
+			TRUE, TRUE, 5);
+	g_signal_connect(priv->export_dialog, "response",
+			G_CALLBACK(export_dialog_response_cb), priv);
+	gtk_widget_show_all(priv->export_dialog);
+
+	priv->export_timer = g_timeout_add(100,
+			(GSourceFunc)export_progress_update, priv);
+}
+
+/* Copy the channels selected in the Save As dialog of the active device */
+static struct data_export * export_snapshot_new(OscPlot *plot,
+		const char *filename, struct extra_dev_info **info_out)
+{
+	OscPlotPrivate *priv = plot->priv;
+	struct data_export *exp;
+	struct iio_device *dev;
+	struct extra_dev_info *dev_info;
+	gchar *active_device;
+	int *save_channels_mask;
+	unsigned int nb_channels, num_columns = 0, i, col;
+	unsigned int dev_sample_count;
+	int d;
+
+	if (priv->export) {
+		fprintf(stderr, "Error: a file is already being saved\n");
+		return NULL;
+	}
+
+	active_device = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->device_combobox));
+	d = device_find_by_name(priv->ctx, active_device);
+	g_free(active_device);
+	if (d < 0)
+		return NULL;
+
+	dev = iio_context_get_device(priv->ctx, d);
+	dev_info = iio_device_get_data(dev);
+	nb_channels = iio_device_get_channels_count(dev);
+
+	/* Find which channel need to be saved */
+	save_channels_mask = get_user_saveas_channel_selection(plot, nb_channels);
+	for (i = 0; i < nb_channels; i++)
+		if (save_channels_mask[i] != 1)
+			num_columns++;
+
+	dev_sample_count = dev_info->sample_count;
+	if (dev_info->channel_trigger_enabled)
+		dev_sample_count /= 2;
+
+	exp = data_export_new(filename, num_columns, dev_sample_count);
+	for (i = 0, col = 0; i < nb_channels; i++) {
+		struct extra_info *info = iio_channel_get_data(iio_device_get_channel(dev, i));
+
+		if (save_channels_mask[i] == 1)
+			continue;
+		data_export_set_column(exp, col++, info->data_ref);
+	}
+	free(save_channels_mask);
+
+	if (info_out)
+		*info_out = dev_info;
+
+	return exp;
+}
+
+/*
+ * Interleave the samples of @chns straight from the capture buffer, as
+ * 16-bit words. NULL if the buffer doesn't hold the capture any more, or
+ * holds other than little endian 16-bit samples. When the buffer holds
+ * exactly these channels, in this order and with nothing to shift out, the
+ * buffer itself is returned and @in_place is set: the capture of the device
+ * pauses until it's written, see sigmf_buffer_release().
+ */
+static const void * sigmf_raw_samples(struct extra_dev_info *dev_info,
+		struct iio_channel **chns, unsigned int num_chns,
+		unsigned int count, bool *is_signed, bool *in_place)
+{
+	struct iio_buffer *buf = dev_info->buffer;
+	const struct iio_data_format *fmt;
+	const char *start;
+	ptrdiff_t step;
+	bool plain = true;
+	int16_t *out;
+	unsigned int c, i;
+
+	if (G_BYTE_ORDER != G_LITTLE_ENDIAN || !buf ||
+			!dev_info->buffer_holds_capture ||
+			dev_info->channel_trigger_enabled)
+		return NULL;
+
+	start = iio_buffer_start(buf);
+	step = iio_buffer_step(buf);
+	if ((const char *)iio_buffer_end(buf) - start < (ptrdiff_t)count * step)
+		return NULL;
+
+	for (c = 0; c < num_chns; c++) {
+		fmt = iio_channel_get_data_format(chns[c]);
+		if (!iio_channel_is_enabled(chns[c]) || fmt->length != 16 ||
+				fmt->is_be || fmt->is_signed != iio_channel_get_data_format(chns[0])->is_signed)
+			return NULL;
+		if (fmt->bits != 16 || fmt->shift ||
+				(const char *)iio_buffer_first(buf, chns[c]) != start + 2 * c)
+			plain = false;
+	}
+	*is_signed = iio_channel_get_data_format(chns[0])->is_signed;
+
+	*in_place = plain && step == 2 * (ptrdiff_t)num_chns;
+	if (*in_place) {
+		g_atomic_int_inc(&dev_info->buffer_exports);
+		return start;
+	}
+
+	out = g_try_new(int16_t, (size_t)count * num_chns);
+	if (!out)
+		return NULL;
+
+	for (c = 0; c < num_chns; c++) {
+		const char *src = iio_buffer_first(buf, chns[c]);
+		unsigned int shift, unused;
+
+		fmt = iio_channel_get_data_format(chns[c]);
+		shift = fmt->shift;
+		unused = 16 - fmt->bits;
+		for (i = 0; i < count; i++) {
+			uint16_t v = *(const uint16_t *)(src + i * step) >> shift;
+
+			if (*is_signed)
+				out[i * num_chns + c] = (int16_t)(v << unused) >> unused;
+			else
+				out[i * num_chns + c] = v & (0xffff >> unused);
+		}
+	}
+
+	return out;
+}
+
+/* From the export thread: the capture of the device can go on */
+static void sigmf_buffer_release(void *data)
+{
+	struct extra_dev_info *dev_info = data;
+
+	__atomic_fetch_sub(&dev_info->buffer_exports, 1, __ATOMIC_RELEASE);
+}
+
+static char * sigmf_meta_new(struct iio_context *ctx, struct iio_device *dev,
+		struct extra_dev_info *dev_info, struct iio_channel *first,
+		const char *datatype, unsigned int num_channels)
+{
+	struct extra_info *info = iio_channel_get_data(first);
+	const char *dev_name = iio_device_get_name(dev) ?: iio_device_get_id(dev);
+	const char *description = iio_context_get_description(ctx);
+	struct sigmf_capture capture = { 0, g_get_real_time() };
+	struct sigmf_meta meta = { 0 };
+	char *hw, *text;
+
+	if (description && description[0])
+		hw = g_strdup_printf("%s (%s)", dev_name, description);
+	else
+		hw = g_strdup(dev_name);
+
+	meta.datatype = datatype;
+	meta.sample_rate = dev_info->adc_freq * prefix2scale(dev_info->adc_scale);
+	meta.num_channels = num_channels;
+	meta.hw = hw;
+	meta.frequency = info->lo_freq;
+	meta.captures = &capture;
+	meta.num_captures = 1;
+
+	text = sigmf_meta_to_json(&meta);
+	g_free(hw);
+
+	return text;
+}
+
+/*
+ * SigMF recording: the samples of the selected channels, interleaved, go to
+ * <name>.sigmf-data and the description to <name>.sigmf-meta. An even
+ * number of channels is saved as I/Q pairs. The samples come from the
+ * capture buffer as 16-bit integers when possible, from the channel data
+ * as floats otherwise.
+ */
+static void save_as_sigmf(OscPlot *plot, const char *filename)
+{
+	OscPlotPrivate *priv = plot->priv;
+	struct data_export *exp;
+	struct iio_device *dev;
+	struct extra_dev_info *dev_info;
+	struct iio_channel **chns;
+	gchar *active_device, *base, *data_path;
+	const char *type;
+	char datatype[16];
+	int *save_channels_mask;
+	unsigned int nb_channels, num_chns = 0, count, i, c;
+	const void *raw;
+	float *samples;
+	bool is_signed, in_place;
+	int d;
+
+	if (priv->export) {
+		fprintf(stderr, "Error: a file is already being saved\n");
+		return;
+	}
+
+	active_device = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->device_combobox));
+	d = device_find_by_name(priv->ctx, active_device);
+	g_free(active_device);
+	if (d < 0)
+		return;
+
+	dev = iio_context_get_device(priv->ctx, d);
+	dev_info = iio_device_get_data(dev);
+	nb_channels = iio_device_get_channels_count(dev);
+
+	save_channels_mask = get_user_saveas_channel_selection(plot, nb_channels);
+	chns = g_new(struct iio_channel *, nb_channels);
+	for (i = 0; i < nb_channels; i++)
+		if (save_channels_mask[i] != 1)
+			chns[num_chns++] = iio_device_get_channel(dev, i);
+	free(save_channels_mask);
+	if (!num_chns) {
+		g_free(chns);
+		return;
+	}
+
+	count = dev_info->sample_count;
+	if (dev_info->channel_trigger_enabled)
+		count /= 2;
+
+	if (g_str_has_suffix(filename, ".sigmf-data") ||
+			g_str_has_suffix(filename, ".sigmf-meta"))
+		base = g_strndup(filename, strlen(filename) - strlen(".sigmf-data"));
+	else
+		base = g_strdup(filename);
+	data_path = g_strdup_printf("%s.sigmf-data", base);
+
+	exp = data_export_new(data_path, 0, count);
+	exp->sidecar_filename = g_strdup_printf("%s.sigmf-meta", base);
+	g_free(data_path);
+	g_free(base);
+
+	raw = sigmf_raw_samples(dev_info, chns, num_chns, count, &is_signed,
+			&in_place);
+	if (raw) {
+		if (in_place)
+			data_export_set_raw_ref(exp, raw,
+					(size_t)count * num_chns * sizeof(int16_t),
+					sigmf_buffer_release, dev_info);
+		else
+			data_export_set_raw(exp, (void *)raw,
+					(size_t)count * num_chns * sizeof(int16_t));
+		type = is_signed ? "i16" : "u16";
+	} else {
+		samples = g_new(float, (size_t)count * num_chns);
+		for (c = 0; c < num_chns; c++) {
+			struct extra_info *info = iio_channel_get_data(chns[c]);
+
+			for (i = 0; i < count; i++)
+				samples[i * num_chns + c] = info->data_ref[i];
+		}
+		data_export_set_raw(exp, samples,
+				(size_t)count * num_chns * sizeof(*samples));
+		type = "f32";
+	}
+
+	snprintf(datatype, sizeof(datatype), "%c%s_%s",
+			num_chns % 2 ? 'r' : 'c', type,
+			G_BYTE_ORDER == G_LITTLE_ENDIAN ? "le" : "be");
+	exp->sidecar = sigmf_meta_new(priv->ctx, dev, dev_info, chns[0],
+			datatype, num_chns % 2 ? num_chns : num_chns / 2);
+	g_free(chns);
+
+	export_start(plot, exp, data_export_write_raw);
+}
+
+static mat_t * mat_file_create(const char *name)
+{
+#if MATIO_MAJOR_VERSION == 1 && MATIO_MINOR_VERSION < 5
+	return Mat_Create(name, NULL);
+#else
 	mat_t *mat;
+
+	/* v7.3 files are HDF5, written in compressed chunks; it takes a matio
+	 * built with HDF5 support, v5 files are compressed as a whole */
+	mat = Mat_CreateVer(name, NULL, MAT_FT_MAT73);
+	if (!mat)
+		mat = Mat_CreateVer(name, NULL, MAT_FT_MAT5);
+	return mat;
+#endif
+}
+
+static int mat_write_double(mat_t *mat, const char *name, double value)
+{
+	mat_dim dims[2] = {1, 1};
 	matvar_t *matvar;
+	int ret;
+
+	matvar = Mat_VarCreate(name, MAT_C_DOUBLE, MAT_T_DOUBLE, 2, dims,
+			&value, 0);
+	if (!matvar)
+		return -1;
+
+	ret = Mat_VarWrite(mat, matvar, MAT_COMPRESSION_ZLIB);
+	Mat_VarFree(matvar);
+
+	return ret ? -1 : 0;
+}
+
+/*
+ * Every channel is saved as the integers the converter delivered, in the
+ * smallest class that holds them, along with <name>_scale and <name>_offset
+ * to get the values from: raw * scale + offset. The scale is 1 unless the
+ * scaling option of the dialog is set, in which case it maps the full
+ * range of the converter to +/-1. Channels are converted and written one
+ * at a time through the same buffer.
+ */
+static void save_as_mat(OscPlot *plot, const char *name)
+{
+	OscPlotPrivate *priv = plot->priv;
 	struct iio_device *dev;
 	struct extra_dev_info *dev_info;
-	char tmp[100];
+	gchar *active_device, *var_name;
+	const char *dev_name;
+	int *save_channels_mask;
+	unsigned int nb_channels, dev_sample_count, i, j;
 	mat_dim dims[2] = {-1, 1};
+	matvar_t *matvar;
+	mat_t *mat;
+	void *buf;
+	bool scale;
+	int d, ret = 0;
+
+	active_device = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->device_combobox));
+	d = device_find_by_name(priv->ctx, active_device);
+	g_free(active_device);
+	if (d < 0)
+		return;
+
+	dev = iio_context_get_device(priv->ctx, d);
+	dev_info = iio_device_get_data(dev);
+	nb_channels = iio_device_get_channels_count(dev);
+	dev_name = iio_device_get_name(dev) ?: iio_device_get_id(dev);
+
+	dev_sample_count = dev_info->sample_count;
+	if (dev_info->channel_trigger_enabled)
+		dev_sample_count /= 2;
+	dims[0] = dev_sample_count;
+
+	buf = g_try_malloc(dev_sample_count * sizeof(int32_t));
+	if (!buf) {
+		fprintf(stderr, "Error saving %s: %s\n", name, strerror(ENOMEM));
+		return;
+	}
+
+	mat = mat_file_create(name);
+	if (!mat) {
+		fprintf(stderr, "Error creating MAT file %s: %s\n", name, strerror(errno));
+		g_free(buf);
+		return;
+	}
+
+	/* Find which channel need to be saved */
+	save_channels_mask = get_user_saveas_channel_selection(plot, nb_channels);
+	scale = gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(priv->save_mat_scale));
+
+	for (i = 0; !ret && i < nb_channels; i++) {
+		struct iio_channel *chn = iio_device_get_channel(dev, i);
+		const char *ch_name = iio_channel_get_name(chn) ?:
+			iio_channel_get_id(chn);
+		const struct iio_data_format *format = iio_channel_get_data_format(chn);
+		struct extra_info *info = iio_channel_get_data(chn);
+		const float *data = info->data_ref;
+		enum matio_classes class_type;
+		enum matio_types data_type;
+		char *scale_name;
+
+		if (save_channels_mask[i] == 1)
+			continue;
+
+		if (format->bits <= 16 && format->is_signed) {
+			int16_t *out = buf;
+
+			class_type = MAT_C_INT16;
+			data_type = MAT_T_INT16;
+			for (j = 0; j < dev_sample_count; j++)
+				out[j] = data[j];
+		} else if (format->bits <= 16) {
+			uint16_t *out = buf;
+
+			class_type = MAT_C_UINT16;
+			data_type = MAT_T_UINT16;
+			for (j = 0; j < dev_sample_count; j++)
+				out[j] = data[j];
+		} else if (format->is_signed) {
+			int32_t *out = buf;
+
+			class_type = MAT_C_INT32;
+			data_type = MAT_T_INT32;
+			for (j = 0; j < dev_sample_count; j++)
+				out[j] = data[j];
+		} else {
+			uint32_t *out = buf;
+
+			class_type = MAT_C_UINT32;
+			data_type = MAT_T_UINT32;
+			for (j = 0; j < dev_sample_count; j++)
+				out[j] = data[j];
+		}
+
+		var_name = g_strdup_printf("%s_%s", dev_name, ch_name);
+		g_strdelimit(var_name, "-", '_');
+		matvar = Mat_VarCreate(var_name, class_type, data_type, 2, dims,
+				buf, MAT_F_DONT_COPY_DATA);
+		if (!matvar) {
+			fprintf(stderr, "error creating matvar on channel %s\n",
+					var_name);
+			g_free(var_name);
+			continue;
+		}
+		ret = Mat_VarWrite(mat, matvar, MAT_COMPRESSION_ZLIB);
+		Mat_VarFree(matvar);
+
+		scale_name = g_strdup_printf("%s_scale", var_name);
+		if (!ret)
+			ret = mat_write_double(mat, scale_name, scale ? 1.0 / (1ULL <<
+				(format->is_signed ? format->bits - 1 : format->bits)) : 1.0);
+		g_free(scale_name);
+		scale_name = g_strdup_printf("%s_offset", var_name);
+		if (!ret)
+			ret = mat_write_double(mat, scale_name, 0.0);
+		g_free(scale_name);
+		g_free(var_name);
+	}
+
+	free(save_channels_mask);
+	g_free(buf);
+	Mat_Close(mat);
+
+	if (ret)
+		fprintf(stderr, "Error writing MAT file %s, it is incomplete\n",
+				name);
+}
+
+static void save_as(OscPlot *plot, const char *filename, int type)
+{
+	OscPlotPrivate *priv = plot->priv;
+	FILE *fp;
+	struct extra_dev_info *dev_info;
 	double freq;
 	char *name;
-	gchar *active_device;
-	int *save_channels_mask;
 	int d;
-	unsigned int nb_channels, i, j;
-	const char *dev_name;
-	unsigned int dev_sample_count;
+	struct data_export *exp;
 
 	name = malloc(strlen(filename) + 5);
 	switch(type) {
@@ -4324,54 +5527,29 @@ static void save_as(OscPlot *plot, const char *filename, int type)
 					strcpy(name, filename);
 				else
 					sprintf(name, "%s.txt", filename);
-			fp = fopen(name, "w");
-			if (!fp)
-				break;
 
-			active_device = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->device_combobox));
-			d = device_find_by_name(ctx, active_device);
-			g_free(active_device);
-			if (d < 0)
+			exp = export_snapshot_new(plot, name, &dev_info);
+			if (!exp)
 				break;
-			dev = iio_context_get_device(ctx, d);
-			dev_info = iio_device_get_data(dev);
-			nb_channels = iio_device_get_channels_count(dev);
-
-			/* Find which channel need to be saved */
-			save_channels_mask = get_user_saveas_channel_selection(plot, nb_channels);
 
 			/* Make a VSA file header */
-			fprintf(fp, "InputZoom\tTRUE\n");
-			fprintf(fp, "InputCenter\t0\n");
-			fprintf(fp, "InputRange\t1\n");
-			fprintf(fp, "InputRefImped\t50\n");
-			fprintf(fp, "XStart\t0\n");
 			freq = dev_info->adc_freq * prefix2scale(dev_info->adc_scale);
-			fprintf(fp, "XDelta\t%-.17f\n", 1.0/freq);
-			fprintf(fp, "XDomain\t2\n");
-			fprintf(fp, "XUnit\tSec\n");
-			fprintf(fp, "YUnit\tV\n");
-			fprintf(fp, "FreqValidMax\t%e\n", freq / 2);
-			fprintf(fp, "FreqValidMin\t-%e\n", freq / 2);
-			fprintf(fp, "Y\n");
-
-			dev_sample_count = dev_info->sample_count;
-			if (dev_info->channel_trigger_enabled)
-				dev_sample_count /= 2;
-
-			/* Start writing the samples */
-			for (i = 0; i < dev_sample_count; i++) {
-				for (j = 0; j < nb_channels; j++) {
-					struct extra_info *info = iio_channel_get_data(iio_device_get_channel(dev, j));
-					if (save_channels_mask[j] == 1)
-						continue;
-					fprintf(fp, "%g\t", info->data_ref[i]);
-				}
-				fprintf(fp, "\n");
-			}
-			fprintf(fp, "\n");
-			fclose(fp);
-			free(save_channels_mask);
+			exp->header = g_strdup_printf(
+				"InputZoom\tTRUE\n"
+				"InputCenter\t0\n"
+				"InputRange\t1\n"
+				"InputRefImped\t50\n"
+				"XStart\t0\n"
+				"XDelta\t%-.17f\n"
+				"XDomain\t2\n"
+				"XUnit\tSec\n"
+				"YUnit\tV\n"
+				"FreqValidMax\t%e\n"
+				"FreqValidMin\t-%e\n"
+				"Y\n", 1.0/freq, freq / 2, freq / 2);
+			exp->separator = "\t";
+			exp->trailer = "\n";
+			export_start(plot, exp, data_export_write_text);
 
 			break;
 		case SAVE_CSV:
@@ -4380,47 +5558,32 @@ static void save_as(OscPlot *plot, const char *filename, int type)
 					strcpy(name, filename);
 				else
 					sprintf(name, "%s.csv", filename);
-			fp = fopen(name, "w");
-			if (!fp)
-				break;
 			if (priv->active_saveas_type == SAVE_AS_RAW_DATA) {
-				active_device = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->device_combobox));
-				d = device_find_by_name(ctx, active_device);
-				g_free(active_device);
-				if (d < 0)
+				exp = export_snapshot_new(plot, name, NULL);
+				if (!exp)
 					break;
 
-				dev = iio_context_get_device(ctx, d);
-				dev_info = iio_device_get_data(dev);
-				nb_channels = iio_device_get_channels_count(dev);
-
-				/* Find which channel need to be saved */
-				save_channels_mask = get_user_saveas_channel_selection(plot, nb_channels);
-
-				dev_sample_count = dev_info->sample_count;
-				if (dev_info->channel_trigger_enabled)
-					dev_sample_count /= 2;
+				exp->separator = ", ";
+				exp->trailer = "\n\n";
+				export_start(plot, exp, data_export_write_text);
+				break;
+			}
 
-				for (i = 0; i < dev_sample_count; i++) {
-					for (j = 0; j < nb_channels; j++) {
-						struct extra_info *info = iio_channel_get_data(iio_device_get_channel(dev, j));
-						if (save_channels_mask[j] == 1)
-							continue;
-						fprintf(fp, "%g, ", info->data_ref[i]);
-					}
-					fprintf(fp, "\n");
-				}
-				fprintf(fp, "\n");
-				free(save_channels_mask);
-			} else {
-				for (d = 0; d < priv->transform_list->size; d++) {
-						transform_csv_print(priv, fp, priv->transform_list->transforms[d]);
-				}
+			fp = fopen(name, "w");
+			if (!fp)
+				break;
+			for (d = 0; d < priv->transform_list->size; d++) {
+					transform_csv_print(priv, fp, priv->transform_list->transforms[d]);
 			}
 			fprintf(fp, "\n");
 			fclose(fp);
 			break;
 
+		case SAVE_SIGMF:
+			strcpy(name, filename);
+			save_as_sigmf(plot, filename);
+			break;
+
 		case SAVE_PNG:
 			/* save png */
 			if (!strncasecmp(&filename[strlen(filename)-4], ".png", 4))
@@ -4440,75 +5603,7 @@ static void save_as(OscPlot *plot, const char *filename, int type)
 				else
 					sprintf(name, "%s.mat", filename);
 
-			mat = Mat_Create(name, NULL);
-			if (!mat) {
-				fprintf(stderr, "Error creating MAT file %s: %s\n", name, strerror(errno));
-				break;
-			}
-
-			active_device = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->device_combobox));
-			d = device_find_by_name(ctx, active_device);
-			g_free(active_device);
-			if (d < 0)
-				break;
-
-			dev = iio_context_get_device(ctx, d);
-			dev_info = iio_device_get_data(dev);
-			nb_channels = iio_device_get_channels_count(dev);
-			dev_name = iio_device_get_name(dev) ?:
-				iio_device_get_id(dev);
-
-			/* Find which channel need to be saved */
-			save_channels_mask = get_user_saveas_channel_selection(plot, nb_channels);
-
-			dev_sample_count = dev_info->sample_count;
-			if (dev_info->channel_trigger_enabled)
-				dev_sample_count /= 2;
-
-			dims[0] = dev_sample_count;
-			for (i = 0; i < nb_channels; i++) {
-				struct iio_channel *chn = iio_device_get_channel(dev, i);
-				const char *ch_name = iio_channel_get_name(chn) ?:
-					iio_channel_get_id(chn);
-				struct extra_info *info = iio_channel_get_data(chn);
-				if (save_channels_mask[i] == 1)
-					continue;
-				sprintf(tmp, "%s_%s", dev_name, ch_name);
-				g_strdelimit(tmp, "-", '_');
-				if (!gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(priv->save_mat_scale))) {
-						matvar = Mat_VarCreate(tmp, MAT_C_SINGLE, MAT_T_SINGLE, 2, dims,
-					info->data_ref, 0);
-				} else {
-					const struct iio_data_format* format = iio_channel_get_data_format(chn);
-					gdouble *tmp_data;
-					double k;
-
-					tmp_data = g_new(gdouble, dev_sample_count);
-					if (format->is_signed)
-						k = format->bits - 1;
-					else
-						k = format->bits;
-					for (j = 0; j < dev_sample_count; j++) {
-						tmp_data[j] = (gdouble)info->data_ref[j] /
-									(pow(2.0, k));
-					}
-					matvar = Mat_VarCreate(tmp, MAT_C_DOUBLE, MAT_T_DOUBLE,
-							2, dims, tmp_data, 0);
-					g_free(tmp_data);
-				}
-
-				if (!matvar)
-					fprintf(stderr,
-						"error creating matvar on channel %s\n",
-						tmp);
-				else {
-					Mat_VarWrite(mat, matvar, 0);
-					Mat_VarFree(matvar);
-				}
-			}
-			free(save_channels_mask);
-
-			Mat_Close(mat);
+			save_as_mat(plot, name);
 			break;
 
 		default:
@@ -4766,6 +5861,12 @@ static void plot_profile_save(OscPlot *plot, char *filename)
 	tmp_float = gtk_spin_button_get_value(GTK_SPIN_BUTTON(priv->fft_pwr_offset_widget));
 	fprintf(fp, "fft_pwr_offset=%f\n", tmp_float);
 
+	tmp_int = comboboxtext_get_active_text_as_int(GTK_COMBO_BOX_TEXT(priv->fft_zoom_widget));
+	fprintf(fp, "fft_zoom=%d\n", tmp_int);
+
+	tmp_float = gtk_spin_button_get_value(GTK_SPIN_BUTTON(priv->fft_zoom_center_widget));
+	fprintf(fp, "fft_zoom_center=%f\n", tmp_float);
+
 	tmp_string = gtk_combo_box_text_get_active_text(GTK_COMBO_BOX_TEXT(priv->plot_type));
 	fprintf(fp, "graph_type=%s\n", tmp_string);
 	g_free(tmp_string);
@@ -4791,6 +5892,8 @@ static void plot_profile_save(OscPlot *plot, char *filename)
 
 	fprintf(fp, "line_thickness = %i\n", priv->line_thickness);
 
+	fprintf(fp, "density_decay = %f\n", priv->density_decay);
+
 	fprintf(fp, "plot_title = %s\n", gtk_window_get_title(GTK_WINDOW(priv->window)));
 
 	fprintf(fp, "show_capture_options = %d\n", gtk_check_menu_item_get_active(GTK_CHECK_MENU_ITEM(priv->menu_show_options)));
@@ -4893,7 +5996,7 @@ static void plot_profile_save(OscPlot *plot, char *filename)
 			fprintf(fp, "marker.%i = %i\n", tmp_int, priv->markers[tmp_int].bin);
 	}
 
-	fprintf(fp, "capture_started=%d\n", (priv->redraw_function) ? 1 : 0);
+	fprintf(fp, "capture_started=%d\n", (priv->redraw_enabled) ? 1 : 0);
 	fclose(fp);
 }
 
@@ -5024,7 +6127,7 @@ int osc_plot_ini_read_handler (OscPlot *plot, int line, const char *section,
 	switch(elem_type) {
 		case PLOT_ATTRIBUTE:
 			if (MATCH_NAME("capture_started")) {
-				if (priv->redraw_function && atoi(value))
+				if (priv->redraw_enabled && atoi(value))
 					goto handled;
 				treeview_expand_update(plot);
 				treeview_icon_color_update(plot);
@@ -5068,6 +6171,11 @@ int osc_plot_ini_read_handler (OscPlot *plot, int line, const char *section,
 				gtk_spin_button_set_value(GTK_SPIN_BUTTON(priv->fft_avg_widget), atoi(value));
 			} else if (MATCH_NAME("fft_pwr_offset")) {
 				gtk_spin_button_set_value(GTK_SPIN_BUTTON(priv->fft_pwr_offset_widget), atof(value));
+			} else if (MATCH_NAME("fft_zoom")) {
+				if (!comboboxtext_set_active_by_string(GTK_COMBO_BOX(priv->fft_zoom_widget), value))
+					goto unhandled;
+			} else if (MATCH_NAME("fft_zoom_center")) {
+				gtk_spin_button_set_value(GTK_SPIN_BUTTON(priv->fft_zoom_center_widget), atof(value));
 			} else if (MATCH_NAME("graph_type")) {
 				if (!comboboxtext_set_active_by_string(GTK_COMBO_BOX(priv->plot_type), value))
 					goto unhandled;
@@ -5173,6 +6281,8 @@ int osc_plot_ini_read_handler (OscPlot *plot, int line, const char *section,
 			} else if (MATCH_NAME("line_thickness")) {
 				if (atoi(value))
 					priv->line_thickness = atoi(value);
+			} else if (MATCH_NAME("density_decay")) {
+				priv->density_decay = atof(value);
 			} else if (MATCH_NAME("quit") || MATCH_NAME("stop")) {
 				application_quit();
 				return 0;
@@ -5680,6 +6790,21 @@ static void enable_tree_device_selection(OscPlot *plot, gboolean enable)
 	}
 }
 
+/* Density rendering is only implemented by the constellation transform */
+static void plot_type_density_update(OscPlotPrivate *priv, bool offer)
+{
+	GtkComboBox *box = GTK_COMBO_BOX(priv->plot_type);
+	gint n = gtk_tree_model_iter_n_children(gtk_combo_box_get_model(box), NULL);
+
+	if (offer && n == 2) {
+		gtk_combo_box_text_append_text(GTK_COMBO_BOX_TEXT(box), "Density");
+	} else if (!offer && n == 3) {
+		if (gtk_combo_box_get_active(box) == 2)
+			gtk_combo_box_set_active(box, 1);
+		gtk_combo_box_text_remove(GTK_COMBO_BOX_TEXT(box), 2);
+	}
+}
+
 static void plot_domain_changed_cb(GtkComboBox *box, OscPlot *plot)
 {
 	OscPlotPrivate *priv = plot->priv;
@@ -5693,6 +6818,7 @@ static void plot_domain_changed_cb(GtkComboBox *box, OscPlot *plot)
 	plot_type = gtk_combo_box_get_active(box);
 	foreach_device_iter(GTK_TREE_VIEW(priv->channel_list_view),
 			*iter_children_plot_type_update, plot);
+	plot_type_density_update(priv, plot_type == XY_PLOT);
 
 	/* Allow horizontal units selection only for TIME plots */
 	if (gtk_widget_is_sensitive(priv->hor_units))
@@ -5729,6 +6855,13 @@ static gboolean domain_is_fft(GBinding *binding,
 	return TRUE;
 }
 
+static gboolean domain_is_fft_only(GBinding *binding,
+	const GValue *source_value, GValue *target_value, gpointer user_data)
+{
+	g_value_set_boolean(target_value, g_value_get_int(source_value) == FFT_PLOT);
+	return TRUE;
+}
+
 static gboolean domain_is_time(GBinding *binding,
 	const GValue *source_value, GValue *target_value, gpointer user_data)
 {
@@ -6004,8 +7137,10 @@ static int math_expression_get_settings(OscPlot *plot, PlotMathChn *pmc)
 	OscPlotPrivate *priv = plot->priv;
 	char *active_device;
 	int ret;
-	void *lhandler;
-	math_function fn;
+	void *lhandler = NULL;
+	math_function fn = NULL;
+	struct math_program *program = NULL;
+	char error[128];
 	GSList *channels = NULL;
 	gchar *txt_math_expr;
 	bool invalid_channels;
@@ -6066,23 +7201,34 @@ static int math_expression_get_settings(OscPlot *plot, PlotMathChn *pmc)
 
 		/* Get the compiled math expression */
 		GSList *basenames = iio_chn_basenames_get(plot, active_device);
+		math_program_destroy(program);
+		program = math_expression_get_program(txt_math_expr, basenames,
+				error, sizeof(error));
+#ifdef MATH_EXPRESSION_GCC
+		math_expression_close_lib_handler(lhandler);
+		lhandler = NULL;
 		fn = math_expression_get_math_function(txt_math_expr, &lhandler, basenames);
+#endif
 		if (basenames) {
 			g_slist_free_full(basenames, (GDestroyNotify)g_free);
 			basenames = NULL;
 		}
 
 		gtk_widget_set_visible(priv->math_expr_error, true);
-		if (!fn)
-			gtk_label_set_text(GTK_LABEL(priv->math_expr_error), "Invalid math expression.");
+		if (!program && !fn)
+			gtk_label_set_text(GTK_LABEL(priv->math_expr_error),
+				error[0] ? error : "Invalid math expression.");
 		else if (!channel_name)
 			gtk_label_set_text(GTK_LABEL(priv->math_expr_error), "An expression with the same name already exists");
 		else
 			gtk_widget_set_visible(priv->math_expr_error, false);
-	} while (!fn || !channel_name);
+	} while ((!program && !fn) || !channel_name);
 	gtk_widget_hide(priv->math_expression_dialog);
-	if (ret != GTK_RESPONSE_OK)
+	if (ret != GTK_RESPONSE_OK) {
+		math_program_destroy(program);
+		math_expression_close_lib_handler(lhandler);
 		return - 1;
+	}
 
 	/* Store the settings of the new channel*/
 	if (pmc->txt_math_expression)
@@ -6098,8 +7244,11 @@ static int math_expression_get_settings(OscPlot *plot, PlotMathChn *pmc)
 	pmc->base.name = g_strdup(channel_name);
 	pmc->iio_device_name = g_strdup(active_device);
 	pmc->iio_channels = channels;
+	math_program_destroy(pmc->math_program);
+	math_expression_close_lib_handler(pmc->math_lib_handler);
 	pmc->math_expression = fn;
 	pmc->math_lib_handler = lhandler;
+	pmc->math_program = program;
 	pmc->num_channels = g_slist_length(pmc->iio_channels);
 	pmc->iio_channels_data = iio_channels_get_data(priv->ctx,
 					pmc->iio_device_name);
@@ -6569,9 +7718,42 @@ static gboolean window_state_event_cb(GtkWidget *widget, GdkEventWindowState *ev
 	else
 		plot->priv->fullscreen_state = false;
 
+	plot->priv->iconified = !!(event->new_window_state &
+		(GDK_WINDOW_STATE_ICONIFIED | GDK_WINDOW_STATE_WITHDRAWN));
+	plot_viewable_update(plot->priv);
+	if (plot->priv->redraw && plot_is_viewable(plot->priv))
+		redraw_scheduler_request(plot->priv);
+
+	return FALSE;
+}
+
+/* Ctrl+R saves what the flight recorders hold */
+static gboolean key_press_event_cb(GtkWidget *widget, GdkEventKey *event, OscPlot *plot)
+{
+	if ((event->state & GDK_CONTROL_MASK) &&
+			gdk_keyval_to_lower(event->keyval) == GDK_r) {
+		osc_flight_recorder_event(NULL, "keypress");
+		return TRUE;
+	}
+
 	return FALSE;
 }
 
+static gboolean visibility_notify_event_cb(GtkWidget *widget, GdkEventVisibility *event, OscPlot *plot)
+{
+	plot->priv->obscured = (event->state == GDK_VISIBILITY_FULLY_OBSCURED);
+	plot_viewable_update(plot->priv);
+	if (plot->priv->redraw && plot_is_viewable(plot->priv))
+		redraw_scheduler_request(plot->priv);
+
+	return FALSE;
+}
+
+static void window_map_changed_cb(GtkWidget *widget, OscPlot *plot)
+{
+	plot_viewable_update(plot->priv);
+}
+
 static void capture_window_realize_cb(GtkWidget *widget, OscPlot *plot)
 {
 	gtk_window_get_size(GTK_WINDOW(plot->priv->window),
@@ -6630,6 +7812,8 @@ static void create_plot(OscPlot *plot)
 	priv->sample_count_widget = GTK_WIDGET(gtk_builder_get_object(builder, "sample_count"));
 	priv->fft_size_widget = GTK_WIDGET(gtk_builder_get_object(builder, "fft_size"));
 	priv->fft_avg_widget = GTK_WIDGET(gtk_builder_get_object(builder, "fft_avg"));
+	priv->fft_zoom_widget = GTK_WIDGET(gtk_builder_get_object(builder, "fft_zoom"));
+	priv->fft_zoom_center_widget = GTK_WIDGET(gtk_builder_get_object(builder, "fft_zoom_center"));
 	priv->fft_pwr_offset_widget = GTK_WIDGET(gtk_builder_get_object(builder, "pwr_offset"));
 	priv->math_dialog = GTK_WIDGET(gtk_builder_get_object(builder, "dialog_math_settings"));
 	priv->capture_options_box = GTK_WIDGET(gtk_builder_get_object(builder, "box_capture_options"));
@@ -6789,6 +7973,15 @@ static void create_plot(OscPlot *plot)
 
 	g_signal_connect(G_OBJECT(priv->window), "window-state-event",
 		G_CALLBACK(window_state_event_cb), plot);
+	g_signal_connect(G_OBJECT(priv->window), "key-press-event",
+		G_CALLBACK(key_press_event_cb), plot);
+	gtk_widget_add_events(priv->window, GDK_VISIBILITY_NOTIFY_MASK);
+	g_signal_connect(G_OBJECT(priv->window), "visibility-notify-event",
+		G_CALLBACK(visibility_notify_event_cb), plot);
+	g_signal_connect(G_OBJECT(priv->window), "map",
+		G_CALLBACK(window_map_changed_cb), plot);
+	g_signal_connect(G_OBJECT(priv->window), "unmap",
+		G_CALLBACK(window_map_changed_cb), plot);
 	g_signal_connect(G_OBJECT(priv->window), "realize",
 		G_CALLBACK(capture_window_realize_cb), plot);
 
@@ -6906,6 +8099,10 @@ static void create_plot(OscPlot *plot)
 		"capture_domain", "sensitive", G_BINDING_INVERT_BOOLEAN);
 	g_builder_bind_property(builder, "capture_button", "active",
 		"fft_size", "sensitive", G_BINDING_INVERT_BOOLEAN);
+	g_builder_bind_property(builder, "capture_button", "active",
+		"fft_zoom", "sensitive", G_BINDING_INVERT_BOOLEAN);
+	g_builder_bind_property(builder, "capture_button", "active",
+		"fft_zoom_center", "sensitive", G_BINDING_INVERT_BOOLEAN);
 	g_builder_bind_property(builder, "capture_button", "active",
 		"plot_type", "sensitive", G_BINDING_INVERT_BOOLEAN);
 	g_builder_bind_property(builder, "capture_button", "active",
@@ -6921,6 +8118,18 @@ static void create_plot(OscPlot *plot)
 	 g_object_bind_property_full(priv->plot_domain, "active", priv->fft_size_widget, "visible",
 		0, domain_is_fft, NULL, NULL, NULL);
 
+	tmp = GTK_WIDGET(gtk_builder_get_object(builder, "fft_zoom_label"));
+	 g_object_bind_property_full(priv->plot_domain, "active", tmp, "visible",
+		0, domain_is_fft_only, NULL, NULL, NULL);
+	 g_object_bind_property_full(priv->plot_domain, "active", priv->fft_zoom_widget, "visible",
+		0, domain_is_fft_only, NULL, NULL, NULL);
+
+	tmp = GTK_WIDGET(gtk_builder_get_object(builder, "fft_zoom_center_label"));
+	 g_object_bind_property_full(priv->plot_domain, "active", tmp, "visible",
+		0, domain_is_fft_only, NULL, NULL, NULL);
+	 g_object_bind_property_full(priv->plot_domain, "active", priv->fft_zoom_center_widget, "visible",
+		0, domain_is_fft_only, NULL, NULL, NULL);
+
 	tmp = GTK_WIDGET(gtk_builder_get_object(builder, "fft_avg_label"));
 	 g_object_bind_property_full(priv->plot_domain, "active", tmp, "visible",
 		0, domain_is_xcorr_fft, NULL, NULL, NULL);
@@ -6952,6 +8161,7 @@ static void create_plot(OscPlot *plot)
 	g_signal_connect(priv->sample_count_widget, "value-changed", G_CALLBACK(count_changed_cb), plot);
 
 	gtk_combo_box_set_active(GTK_COMBO_BOX(priv->fft_size_widget), 2);
+	gtk_combo_box_set_active(GTK_COMBO_BOX(priv->fft_zoom_widget), 0);
 	gtk_combo_box_set_active(GTK_COMBO_BOX(priv->plot_type), 0);
 	gtk_spin_button_set_value(GTK_SPIN_BUTTON(priv->y_axis_max), 1000);
 	gtk_spin_button_set_value(GTK_SPIN_BUTTON(priv->y_axis_min), -1000);
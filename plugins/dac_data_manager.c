@@ -1,16 +1,20 @@
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <malloc.h>
 #include <errno.h>
 #include <math.h>
 #include <ctype.h>
 #include <sys/stat.h>
+#include <utime.h>
 #ifdef __linux__
 #include <sys/utsname.h>
 #endif
 #include <matio.h>
 
 #include "dac_data_manager.h"
+#include "../wave_pack.h"
+#include "../wave_synth.h"
 #include "../iio_widget.h"
 #include "../osc.h"
 
@@ -37,6 +41,7 @@
 
 #define WAVEFORM_TXT_INVALID_FORMAT 1
 #define WAVEFORM_MAT_INVALID_FORMAT 2
+#define WAVEFORM_BIN_INVALID_FORMAT 3
 
 extern bool dma_valid_selection(const char *device, unsigned mask, unsigned channel_count);
 
@@ -109,6 +114,10 @@ struct dac_buffer {
 
 	GtkWidget *frame;
 	GtkWidget *buffer_fchooser_btn;
+	GtkWidget *stream_btn;
+	GtkWidget *synth_entry;
+	GtkWidget *playlist_combo;
+	bool playlist_updating;
 	GtkWidget *tx_channels_view;
 	GtkTextBuffer *load_status_buf;
 };
@@ -128,8 +137,17 @@ struct dac_data_manager {
 	bool dds_activated;
 	bool dds_disabled;
 	struct iio_buffer *dds_buffer;
+	struct wave_stream *stream;
 	bool is_local;
 
+	/* Converted waveforms, most recently used first */
+	GList *wave_cache;
+	size_t wave_cache_size;
+
+	/* Waveforms converted ahead of time, and the one playing */
+	GPtrArray *playlist;
+	unsigned int playlist_pos;
+
 	GtkWidget *container;
 };
 
@@ -226,152 +244,335 @@ static void replicate_tx_data_channels(struct _complex_ref *data, int count)
 	}
 }
 
-static bool line_is_empty(char *s)
+/* Waveform text files are split in chunks of at least this size, each
+ * parsed by its own thread */
+#define WAVE_TEXT_CHUNK_MIN (1 << 20)
+
+/* Powers of ten that are exact in a double */
+static const double wave_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+struct wave_text_chunk {
+	const char *start, *end;
+	float *rows;		/* i1, q1, i2, q2 of every line */
+	unsigned int num_rows;
+	double max;
+	int error;
+};
+
+static bool wave_is_space(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+static bool line_is_empty(const char *s, const char *end)
 {
-	while (isspace((unsigned char)*s))
+	while (s < end && wave_is_space(*s))
 		s++;
 
-	return *s == '\0' ? true : false;
+	return s == end;
 }
 
-static unsigned short convert(double scale, float val, double offset)
+/* Anything the fast path does not handle: inf, nan, hex, many digits */
+static const char * wave_parse_double_slow(const char *p, const char *end,
+		double *val)
 {
-	return (short) (val * scale + offset);
+	char buf[64], *e;
+	size_t len = 0;
+
+	while (p + len < end && len < sizeof(buf) - 1 &&
+			!wave_is_space(p[len]) && p[len] != ',')
+		len++;
+	memcpy(buf, p, len);
+	buf[len] = '\0';
+
+	*val = strtod(buf, &e);
+	return e == buf ? NULL : p + (e - buf);
 }
 
-static int analyse_wavefile(struct dac_data_manager *manager,
-		const char *file_name, char **buf, int *count, int tx_channels)
+/*
+ * Parse a number as strtod() would, without needing it NUL terminated.
+ * Numbers of up to 15 digits with a small exponent are computed with a
+ * single correctly rounded operation, which gives the same double.
+ */
+static const char * wave_parse_double(const char *p, const char *end,
+		double *val)
+{
+	const char *start = p;
+	unsigned long long mant = 0;
+	int digits = 0, exp10 = 0, e = 0;
+	bool neg = false, eneg = false, any = false;
+
+	if (p < end && (*p == '-' || *p == '+'))
+		neg = *p++ == '-';
+
+	for (; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+		if (mant || *p != '0')
+			digits++;
+		mant = mant * 10 + (*p - '0');
+		if (digits > 15)
+			return wave_parse_double_slow(start, end, val);
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++, any = true) {
+			if (mant || *p != '0')
+				digits++;
+			mant = mant * 10 + (*p - '0');
+			exp10--;
+			if (digits > 15)
+				return wave_parse_double_slow(start, end, val);
+		}
+	}
+	if (!any)
+		return wave_parse_double_slow(start, end, val);
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		const char *q = p + 1;
+
+		if (q < end && (*q == '-' || *q == '+'))
+			eneg = *q++ == '-';
+		if (q < end && *q >= '0' && *q <= '9') {
+			for (; q < end && *q >= '0' && *q <= '9'; q++)
+				if (e < 1000)
+					e = e * 10 + (*q - '0');
+			exp10 += eneg ? -e : e;
+			p = q;
+		}
+	}
+
+	/* e.g. 0x10 */
+	if (p < end && (g_ascii_isalnum(*p) || *p == '.'))
+		return wave_parse_double_slow(start, end, val);
+
+	if (exp10 > 22 || exp10 < -22)
+		return wave_parse_double_slow(start, end, val);
+
+	*val = exp10 >= 0 ? (double)mant * wave_pow10[exp10] :
+		(double)mant / wave_pow10[-exp10];
+	if (neg)
+		*val = -*val;
+
+	return p;
+}
+
+/* Up to 4 numbers separated by commas, spaces or tabs; returns how many
+ * were read, like the sscanf() format used before */
+static int wave_parse_line(const char *p, const char *end, double val[4])
 {
-	int ret, rep;
-	unsigned int size, j, i = 0;
-	double max = 0.0, val[4], scale = 0.0;
-	double i1, q1, i2, q2;
-	double offset;
-	char line[80];
-	mat_t *matfp;
-	matvar_t **matvars;
+	int n = 0;
 
-	FILE *infile = fopen(file_name, "r");
+	while (n < 4) {
+		while (p < end && wave_is_space(*p))
+			p++;
+		p = wave_parse_double(p, end, &val[n]);
+		if (!p)
+			break;
+		if (++n == 4 || p == end || (*p != ',' && *p != ' ' && *p != '\t'))
+			break;
+		while (p < end && (*p == ',' || *p == ' ' || *p == '\t'))
+			p++;
+	}
 
-	*buf = NULL;
+	return n;
+}
 
-	if (infile == NULL)
-		return -errno;
+static gpointer wave_text_chunk_parse(gpointer data)
+{
+	struct wave_text_chunk *chunk = data;
+	const char *p, *eol;
+	unsigned int lines = 1;
+	double val[4];
+	float *row;
+	int i, n;
+
+	for (p = chunk->start; (p = memchr(p, '\n', chunk->end - p)); p++)
+		lines++;
+
+	chunk->rows = g_try_new(float, (size_t)lines * 4);
+	if (!chunk->rows) {
+		chunk->error = -ENOMEM;
+		return NULL;
+	}
+
+	row = chunk->rows;
+	for (p = chunk->start; p < chunk->end; p = eol + 1) {
+		eol = memchr(p, '\n', chunk->end - p) ?: chunk->end;
+
+		n = wave_parse_line(p, eol, val);
+		if (n != 2 && n != 4) {
+			if (line_is_empty(p, eol))
+				continue;
+			chunk->error = WAVEFORM_TXT_INVALID_FORMAT;
+			return NULL;
+		}
+
+		for (i = 0; i < n; i++)
+			if (fabs(val[i]) > chunk->max)
+				chunk->max = fabs(val[i]);
+
+		/* Two columns go to both channels of 4 */
+		row[0] = val[0];
+		row[1] = val[1];
+		row[2] = val[n == 4 ? 2 : 0];
+		row[3] = val[n == 4 ? 3 : 1];
+		row += 4;
+		chunk->num_rows++;
+	}
+
+	return NULL;
+}
+
+/*
+ * TEXT waveforms: a "TEXT[U] [REPEAT n]" line, then one line of 2 or 4
+ * columns per sample. The file is mapped and split in chunks at line
+ * boundaries that are parsed in parallel; the samples are then scaled and
+ * packed for the enabled channels, every line repeated n times.
+ */
+static int analyse_text_wavefile(struct dac_data_manager *manager,
+		const char *data, size_t len, char **buf, int *count,
+		int tx_channels)
+{
+	struct wave_text_chunk *chunks;
+	const char *body, *split, *end = data + len;
+	unsigned int c, num_chunks, size = 0, rows = 0;
+	double max = 0.0, scale = 0.0, offset;
+	char line[80];
+	int ret = 0, rep;
 
 	offset = dac_offset_get_value(manager->dac1.iio_dac);
 
-	if (fgets(line, 80, infile) != NULL) {
-		if (strncmp(line, "TEXT", 4) == 0) {
-			/* Unscaled samples need to be in the range +- 2047 */
-			if (strncmp(line, "TEXTU", 5) == 0)
-				scale = 16.0;	/* scale up to 16-bit */
-			ret = sscanf(line, "TEXT%*c REPEAT %d", &rep);
-			if (ret != 1) {
-				rep = 1;
-			}
-			size = 0;
-			while (fgets(line, 80, infile)) {
-				ret = sscanf(line, "%lf%*[, \t]%lf%*[, \t]%lf%*[, \t]%lf",
-						&val[0], &val[1], &val[2], &val[3]);
-				if (!(ret == 4 || ret == 2)) {
-					if (line_is_empty(line))
-						continue;
-					fclose(infile);
-					fprintf(stderr, "ERROR: No 2 or 4 columns of data inside the text file\n");
-					return WAVEFORM_TXT_INVALID_FORMAT;
-				}
+	body = memchr(data, '\n', len);
+	body = body ? body + 1 : end;
+	snprintf(line, sizeof(line), "%.*s", (int)(body - data), data);
+
+	/* Unscaled samples need to be in the range +- 2047 */
+	if (strncmp(line, "TEXTU", 5) == 0)
+		scale = 16.0;	/* scale up to 16-bit */
+	if (sscanf(line, "TEXT%*c REPEAT %d", &rep) != 1)
+		rep = 1;
+
+	num_chunks = MIN(MAX((end - body) / WAVE_TEXT_CHUNK_MIN, 1),
+			g_get_num_processors());
+	chunks = g_new0(struct wave_text_chunk, num_chunks);
+	for (c = 0, split = body; c < num_chunks; c++) {
+		chunks[c].start = split;
+		split = MAX(split, body + (end - body) / num_chunks * (c + 1));
+		if (c < num_chunks - 1)
+			split = memchr(split, '\n', end - split);
+		split = split && c < num_chunks - 1 ? split + 1 : end;
+		chunks[c].end = split;
+	}
 
-				for (i = 0; i < (unsigned int) ret; i++)
-					if (fabs(val[i]) > max)
-						max = fabs(val[i]);
+	if (num_chunks > 1) {
+		GThread **threads = g_new(GThread *, num_chunks);
 
-				size += tx_channels * 2;
-			}
+		for (c = 0; c < num_chunks; c++)
+			threads[c] = g_thread_new("Waveform parser",
+					wave_text_chunk_parse, &chunks[c]);
+		for (c = 0; c < num_chunks; c++)
+			g_thread_join(threads[c]);
+		g_free(threads);
+	} else {
+		wave_text_chunk_parse(&chunks[0]);
+	}
 
-			size *= rep;
-			if (scale == 0.0)
-				scale = 32752.0 / max;
+	for (c = 0; c < num_chunks; c++) {
+		if (chunks[c].error && !ret)
+			ret = chunks[c].error;
+		max = MAX(max, chunks[c].max);
+		rows += chunks[c].num_rows;
+	}
+	if (ret == WAVEFORM_TXT_INVALID_FORMAT)
+		fprintf(stderr, "ERROR: No 2 or 4 columns of data inside the text file\n");
+	if (ret)
+		goto out;
 
-			if (max > 32752.0)
-				fprintf(stderr, "ERROR: DAC Waveform Samples > +/- 2047.0\n");
+	size = rows * tx_channels * 2 * rep;
+	if (scale == 0.0)
+		scale = 32752.0 / max;
 
-			while ((size % manager->alignment) != 0)
-				size *= 2;
+	if (max > 32752.0)
+		fprintf(stderr, "ERROR: DAC Waveform Samples > +/- 2047.0\n");
 
-			*buf = malloc(size);
-			if (*buf == NULL)
-				return -errno;
+	while ((size % manager->alignment) != 0)
+		size *= 2;
 
-			unsigned long long *sample = *((unsigned long long **) buf);
-			unsigned int *sample_32 = *((unsigned int **) buf);
-			unsigned short *sample_16 = *((unsigned short **) buf);
-
-			rewind(infile);
-
-			if (fgets(line, 80, infile) != NULL) {
-				if (strncmp(line, "TEXT", 4) == 0) {
-					size = 0;
-					i = 0;
-					while (fgets(line, 80, infile)) {
-						ret = sscanf(line, "%lf%*[, \t]%lf%*[, \t]%lf%*[, \t]%lf",
-								&i1, &q1, &i2, &q2);
-						if ((ret != 2 && ret != 4) && line_is_empty(line))
-							continue;
-
-						for (j = 0; j < (unsigned int) rep; j++) {
-							if (ret == 4 && tx_channels >= 4) {
-								sample[i++] = ((unsigned long long) convert(scale, q2, offset) << 48) |
-								    ((unsigned long long) convert(scale, i2, offset) << 32) |
-								    ((unsigned long long) convert(scale, q1, offset) << 16) |
-								    ((unsigned long long) convert(scale, i1, offset) << 0);
-
-								if (tx_channels == 8)
-									sample[i++] = ((unsigned long long) convert(scale, q2, offset) << 48) |
-									((unsigned long long) convert(scale, i2, offset) << 32) |
-									((unsigned long long) convert(scale, q1, offset) << 16) |
-									((unsigned long long) convert(scale, i1, offset) << 0);
-
-							} else if (ret == 2 && tx_channels >= 4) {
-								sample[i++] = ((unsigned long long) convert(scale, q1, offset) << 48) |
-								    ((unsigned long long) convert(scale, i1, offset) << 32) |
-								    ((unsigned long long) convert(scale, q1, offset) << 16) |
-								    ((unsigned long long) convert(scale, i1, offset) << 0);
-
-								if (tx_channels == 8)
-									sample[i++] = ((unsigned long long) convert(scale, q1, offset) << 48) |
-									((unsigned long long) convert(scale, i1, offset) << 32) |
-									((unsigned long long) convert(scale, q1, offset) << 16) |
-									((unsigned long long) convert(scale, i1, offset) << 0);
-
-							} else if (ret > 1 && tx_channels == 2) {
-								sample_32[i++] = ((unsigned int) convert(scale, q1, offset) << 16) |
-										((unsigned int) convert(scale, i1, offset) << 0);
-							} else if (ret > 1 && tx_channels == 1) {
-								sample_16[i++] = convert(scale, i1, offset);
-							}
-
-							size += tx_channels * 2;
-						}
-					}
-				}
-			}
+	*buf = malloc(size);
+	if (*buf == NULL) {
+		ret = -errno;
+		goto out;
+	}
 
-			/* When we are in 1 TX mode it is possible that the number of bytes
-			 * is not a multiple of 8, but only a multiple of 4. In this case
-			 * we'll send the same buffer twice to make sure that it becomes a
-			 * multiple of 8. (default manager->alignment)
-			 */
+	/* Each line holds I and Q of two TX, which the 8 channels repeat */
+	size = 0;
+	for (c = 0; c < num_chunks; c++) {
+		wave_pack_rows((uint16_t *)(*buf + size), chunks[c].rows, 4,
+				tx_channels, chunks[c].num_rows, rep, scale, offset);
+		size += chunks[c].num_rows * rep * tx_channels * 2;
+	}
 
-			while ((size % manager->alignment) != 0) {
-				memcpy(*buf + size, *buf, size);
-				size += size;
-			}
+	/* When we are in 1 TX mode it is possible that the number of bytes
+	 * is not a multiple of 8, but only a multiple of 4. In this case
+	 * we'll send the same buffer twice to make sure that it becomes a
+	 * multiple of 8. (default manager->alignment)
+	 */
+
+	while ((size % manager->alignment) != 0) {
+		memcpy(*buf + size, *buf, size);
+		size += size;
+	}
+
+	*count = size;
+out:
+	for (c = 0; c < num_chunks; c++)
+		g_free(chunks[c].rows);
+	g_free(chunks);
+
+	return ret;
+}
+
+static int analyse_wavefile(struct dac_data_manager *manager,
+		const char *file_name, char **buf, int *count, int tx_channels)
+{
+	int ret, rep;
+	unsigned int size, j, i = 0;
+	double max = 0.0, scale = 0.0;
+	double offset;
+	mat_t *matfp;
+	matvar_t **matvars;
+	GMappedFile *mapped;
+	GError *err = NULL;
+	const char *data;
+	size_t len;
+
+	*buf = NULL;
 
-			fclose(infile);
-			*count = size;
+	mapped = g_mapped_file_new(file_name, FALSE, &err);
+	if (!mapped) {
+		if (err->code == G_FILE_ERROR_NOENT)
+			ret = -ENOENT;
+		else if (err->code == G_FILE_ERROR_ACCES)
+			ret = -EACCES;
+		else
+			ret = -EIO;
+		g_error_free(err);
+		return ret;
+	}
 
+	offset = dac_offset_get_value(manager->dac1.iio_dac);
+	data = g_mapped_file_get_contents(mapped);
+	len = g_mapped_file_get_length(mapped);
+
+	if (len != 0) {
+		if (len >= 4 && strncmp(data, "TEXT", 4) == 0) {
+			ret = analyse_text_wavefile(manager, data, len, buf,
+					count, tx_channels);
+			g_mapped_file_unref(mapped);
+			return ret;
 		} else {
-			fclose(infile);
+			g_mapped_file_unref(mapped);
 			ret = 0;
 			/* Is it a MATLAB file?
 			 * http://na-wiki.csc.kth.se/mediawiki/index.php/MatIO
@@ -478,10 +679,6 @@ static int analyse_wavefile(struct dac_data_manager *manager,
 
 			*count = size * tx_channels * 2;
 
-			unsigned long long *sample = *((unsigned long long **) buf);
-			unsigned int *sample_32 = *((unsigned int **) buf);
-			unsigned short *sample_16 = *((unsigned short **) buf);
-
 			struct _complex_ref tx_data[4] = {{NULL, NULL}, {NULL, NULL}, {NULL, NULL}, {NULL, NULL}};
 			mat_complex_split_t *complex_data[4];
 
@@ -501,39 +698,18 @@ static int analyse_wavefile(struct dac_data_manager *manager,
 			}
 			replicate_tx_data_channels(tx_data, tx_channels);
 
-			switch (tx_channels) {
-			case 1:
-				for (i = 0 ; i < size; i++) {
-					sample_16[i] = convert(scale, tx_data[0].re[i], offset);
-				}
-				break;
-			case 2:
-				for (i = 0 ; i < size; i++) {
-					sample_32[i] = ((unsigned int) convert(scale, tx_data[0].im[i], offset) << 16) |
-						       ((unsigned int) convert(scale, tx_data[0].re[i], offset) << 0);
-				}
-				break;
-			case 4:
-				for (i = 0 ; i < size; i++) {
-					sample[i] = ((unsigned long long) convert(scale, tx_data[1].im[i], offset) << 48) |
-						    ((unsigned long long) convert(scale, tx_data[1].re[i], offset) << 32) |
-							((unsigned long long) convert(scale, tx_data[0].im[i], offset) << 16) |
-							((unsigned long long) convert(scale, tx_data[0].re[i], offset) << 0);
-				 }
-				break;
-			case 8:
-				for (i = 0, j = 0; i < size; i++) {
-					sample[j++] = ((unsigned long long) convert(scale, tx_data[3].im[i], offset) << 48) |
-						    ((unsigned long long) convert(scale, tx_data[3].re[i], offset) << 32) |
-							((unsigned long long) convert(scale, tx_data[2].im[i], offset) << 16) |
-							((unsigned long long) convert(scale, tx_data[2].re[i], offset) << 0);
-					sample[j++] = ((unsigned long long) convert(scale, tx_data[1].im[i], offset) << 48) |
-						    ((unsigned long long) convert(scale, tx_data[1].re[i], offset) << 32) |
-							((unsigned long long) convert(scale, tx_data[0].im[i], offset) << 16) |
-							((unsigned long long) convert(scale, tx_data[0].re[i], offset) << 0);
-				}
-				break;
+			/* I and Q of each TX in turn; with 8 channels, those of
+			 * the second DAC come first */
+			const double *columns[8];
+
+			for (i = 0; i < (unsigned int) tx_channels; i++) {
+				struct _complex_ref *tx =
+					&tx_data[(i / 2) ^ (tx_channels == 8 ? 2 : 0)];
+
+				columns[i] = i % 2 ? tx->im : tx->re;
 			}
+			wave_pack_columns((uint16_t *)*buf, columns, tx_channels,
+					size, scale, offset);
 
 			for (j = 0; j <= (unsigned int) rep; j++) {
 				Mat_VarFree(matvars[j]);
@@ -543,249 +719,1592 @@ static int analyse_wavefile(struct dac_data_manager *manager,
 			return ret;
 		}
 	} else {
-		fclose(infile);
+		g_mapped_file_unref(mapped);
 		return -EINVAL;
 	}
 	return 0;
 }
 
-static gboolean scale_spin_button_output_cb(GtkSpinButton *spin, gpointer data)
+/*
+ * Binary waveforms (.iq): a header, then the samples as the DAC takes
+ * them, already scaled: signed 16-bit little-endian words, one for each
+ * enabled channel in every frame (I then Q of each TX). They are read
+ * straight into the DMA buffer. All header fields are little-endian.
+ */
+#define WAVE_BIN_MAGIC "OSCW"
+#define WAVE_BIN_VERSION 1
+
+struct wave_bin_header {
+	char magic[4];
+	uint16_t version;
+	uint16_t channels;
+	uint32_t repeat;	/* each frame is sent this many times */
+	uint32_t header_size;	/* offset of the samples */
+	uint64_t sample_rate;	/* Hz, 0 if unknown */
+};
+
+/* Returns the file, positioned at the samples, if it is a binary waveform */
+static FILE * wave_bin_open(const char *file_name, struct wave_bin_header *hdr,
+		unsigned long long *frames)
 {
-	GtkAdjustment *adj;
-	gchar *text;
-	int value;
+	struct stat st;
+	FILE *fp;
 
-	adj = gtk_spin_button_get_adjustment(spin);
-	value = (int)gtk_adjustment_get_value(adj);
-	if (value > gtk_adjustment_get_lower(adj))
-		text = g_strdup_printf("%d dB", value);
-	else
-		text = g_strdup_printf("-Inf dB");
-	gtk_entry_set_text(GTK_ENTRY(spin), text);
-	g_free(text);
+	fp = fopen(file_name, "rb");
+	if (!fp)
+		return NULL;
 
-	return TRUE;
+	if (fread(hdr, sizeof(*hdr), 1, fp) != 1 ||
+			memcmp(hdr->magic, WAVE_BIN_MAGIC, 4))
+		goto err_close;
+
+	hdr->version = GUINT16_FROM_LE(hdr->version);
+	hdr->channels = GUINT16_FROM_LE(hdr->channels);
+	hdr->repeat = GUINT32_FROM_LE(hdr->repeat);
+	hdr->header_size = GUINT32_FROM_LE(hdr->header_size);
+	hdr->sample_rate = GUINT64_FROM_LE(hdr->sample_rate);
+
+	if (hdr->version != WAVE_BIN_VERSION || !hdr->channels ||
+			hdr->header_size < sizeof(*hdr) ||
+			fstat(fileno(fp), &st) || st.st_size < (off_t)hdr->header_size ||
+			fseek(fp, hdr->header_size, SEEK_SET)) {
+		fprintf(stderr, "ERROR: Invalid header in %s\n", file_name);
+		goto err_close;
+	}
+
+	if (!hdr->repeat)
+		hdr->repeat = 1;
+	*frames = (st.st_size - hdr->header_size) / (hdr->channels * 2);
+
+	return fp;
+
+err_close:
+	fclose(fp);
+	return NULL;
 }
 
-static int tx_enabled_channels_count(GtkTreeView *treeview, unsigned *enabled_mask)
+static void wave_samples_from_le(char *data, size_t len)
 {
-	GtkTreeIter iter;
-	gboolean enabled;
-	int num_enabled = 0;
-	int ch_pos = 0;
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+	uint16_t *words = (uint16_t *)data;
+	size_t i;
 
-	GtkTreeModel *model = gtk_tree_view_get_model(treeview);
-	gboolean next_iter = gtk_tree_model_get_iter_first(model, &iter);
+	for (i = 0; i < len / 2; i++)
+		words[i] = GUINT16_FROM_LE(words[i]);
+#endif
+}
 
+/* Send each of the @frames frames at the start of @data @repeat times; done
+ * in place from the end, so that no frame is overwritten before it is
+ * copied */
+static void wave_frames_repeat(char *data, unsigned long long frames,
+		size_t frame_size, unsigned int repeat)
+{
+	long long f;
+	unsigned int r;
 
-	if (enabled_mask)
-		*enabled_mask = 0;
+	if (repeat < 2)
+		return;
 
-	while (next_iter) {
-		gtk_tree_model_get(model, &iter, TX_CHANNEL_ACTIVE, &enabled, -1);
-		if (enabled) {
-			num_enabled++;
-			if (enabled_mask)
-				*enabled_mask |= 1 << ch_pos;
+	for (f = frames - 1; f >= 0; f--)
+		for (r = repeat; r > 0; r--)
+			memmove(data + (f * repeat + r - 1) * frame_size,
+					data + f * frame_size, frame_size);
+}
+
+/* Read @frames frames into @dst, which is @size bytes: each frame is
+ * repeated and the whole waveform is copied until the buffer is full */
+static int wave_bin_read(FILE *fp, const struct wave_bin_header *hdr,
+		unsigned long long frames, char *dst, size_t size)
+{
+	size_t frame_size = hdr->channels * 2;
+	size_t len = frames * frame_size;
+
+	if (fread(dst, 1, len, fp) != len)
+		return ferror(fp) ? -EIO : -EINVAL;
+
+	wave_samples_from_le(dst, len);
+
+	wave_frames_repeat(dst, frames, frame_size, hdr->repeat);
+	len *= hdr->repeat;
+
+	for (; len < size; len *= 2)
+		memcpy(dst + len, dst, MIN(len, size - len));
+
+	return 0;
+}
+
+/*
+ * Converted waveforms are cached, in memory and in the user cache directory,
+ * under a hash of the file contents and of everything the conversion
+ * depends on: the number of channels, the buffer alignment and the DAC
+ * offset. A file whose inode, size and nanosecond mtime and ctime have not
+ * changed since it was loaded is found without hashing it again. The disk
+ * cache is trimmed least recently used first: a hit touches its file.
+ */
+#define WAVE_CACHE_VERSION "2"
+#define WAVE_CACHE_DIR "waveforms"
+#define WAVE_CACHE_MEMORY ((size_t)256 << 20)
+#define WAVE_CACHE_DISK ((off_t)1 << 30)
+
+struct wave_cache_entry {
+	char *key;
+	char *data;
+	int size;
+
+	/* The file the entry was last loaded for */
+	char *file_name;
+	ino_t ino;
+	struct timespec mtim;
+	struct timespec ctim;
+	off_t file_size;
+	unsigned int channels;
+	unsigned int alignment;
+	double offset;
+};
+
+static void wave_cache_entry_free(gpointer data)
+{
+	struct wave_cache_entry *entry = data;
+
+	g_free(entry->key);
+	g_free(entry->file_name);
+	free(entry->data);
+	g_free(entry);
+}
+
+static char * wave_cache_dir(void)
+{
+	char *dir;
+
+	dir = g_build_filename(g_get_user_cache_dir(), "osc",
+			WAVE_CACHE_DIR, NULL);
+	if (g_mkdir_with_parents(dir, S_IRWXU) != 0) {
+		fprintf(stderr, "Can't create %s: %s\n", dir, strerror(errno));
+		g_free(dir);
+		return NULL;
+	}
+
+	return dir;
+}
+
+/* Mark the cached conversion @key as recently used */
+static void wave_cache_touch(const char *key)
+{
+	char *dir, *path;
+
+	dir = wave_cache_dir();
+	if (!dir)
+		return;
+
+	path = g_build_filename(dir, key, NULL);
+	if (utime(path, NULL) && errno != ENOENT)
+		fprintf(stderr, "Can't touch %s: %s\n", path, strerror(errno));
+	g_free(path);
+	g_free(dir);
+}
+
+static char * wave_cache_key(const char *file_name, unsigned int channels,
+		unsigned int alignment, double offset)
+{
+	GMappedFile *mapped;
+	GChecksum *sum;
+	char *settings, *key;
+
+	mapped = g_mapped_file_new(file_name, FALSE, NULL);
+	if (!mapped)
+		return NULL;
+
+	sum = g_checksum_new(G_CHECKSUM_SHA256);
+	g_checksum_update(sum, (const guchar *)g_mapped_file_get_contents(mapped),
+			g_mapped_file_get_length(mapped));
+	g_mapped_file_unref(mapped);
+
+	settings = g_strdup_printf("%s %u %u %.17g", WAVE_CACHE_VERSION,
+			channels, alignment, offset);
+	g_checksum_update(sum, (const guchar *)settings, strlen(settings) + 1);
+	g_free(settings);
+
+	key = g_strdup(g_checksum_get_string(sum));
+	g_checksum_free(sum);
+
+	return key;
+}
+
+struct wave_cache_file {
+	char *path;
+	time_t mtime;
+	off_t size;
+};
+
+static gint wave_cache_file_cmp(gconstpointer a, gconstpointer b)
+{
+	const struct wave_cache_file *fa = a, *fb = b;
+
+	return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+/* Remove the least recently used files once the disk cache grows too big */
+static void wave_cache_trim(const char *dir)
+{
+	GDir *gdir = g_dir_open(dir, 0, NULL);
+	GArray *files;
+	const char *name;
+	off_t total = 0;
+	unsigned int i;
+
+	if (!gdir)
+		return;
+
+	files = g_array_new(FALSE, FALSE, sizeof(struct wave_cache_file));
+	while ((name = g_dir_read_name(gdir))) {
+		struct wave_cache_file file;
+		struct stat st;
+
+		file.path = g_build_filename(dir, name, NULL);
+		if (stat(file.path, &st)) {
+			g_free(file.path);
+			continue;
 		}
-		ch_pos++;
-		next_iter = gtk_tree_model_iter_next(model, &iter);
+		file.mtime = st.st_mtime;
+		file.size = st.st_size;
+		total += st.st_size;
+		g_array_append_val(files, file);
 	}
+	g_dir_close(gdir);
 
-	return num_enabled;
+	g_array_sort(files, wave_cache_file_cmp);
+	for (i = 0; i < files->len; i++) {
+		struct wave_cache_file *file =
+			&g_array_index(files, struct wave_cache_file, i);
+
+		if (total > WAVE_CACHE_DISK && remove(file->path) == 0)
+			total -= file->size;
+		g_free(file->path);
+	}
+	g_array_free(files, TRUE);
 }
 
-static void enable_dds_channels(struct dac_buffer *db)
+static void wave_cache_add(struct dac_data_manager *manager,
+		struct wave_cache_entry *entry)
 {
-	GtkTreeView *treeview = GTK_TREE_VIEW(db->tx_channels_view);
-	GtkTreeIter iter;
-	gboolean enabled;
-	gint ch_index = 0;
+	GList *last;
+
+	manager->wave_cache = g_list_prepend(manager->wave_cache, entry);
+	manager->wave_cache_size += entry->size;
+
+	while (manager->wave_cache_size > WAVE_CACHE_MEMORY &&
+			manager->wave_cache->next) {
+		last = g_list_last(manager->wave_cache);
+		entry = last->data;
+		manager->wave_cache_size -= entry->size;
+		wave_cache_entry_free(entry);
+		manager->wave_cache = g_list_delete_link(manager->wave_cache, last);
+	}
+}
+
+static void wave_cache_entry_update(struct wave_cache_entry *entry,
+		const char *file_name, const struct stat *st,
+		unsigned int channels, unsigned int alignment, double offset)
+{
+	g_free(entry->file_name);
+	entry->file_name = g_strdup(file_name);
+	entry->ino = st->st_ino;
+	entry->mtim = st->st_mtim;
+	entry->ctim = st->st_ctim;
+	entry->file_size = st->st_size;
+	entry->channels = channels;
+	entry->alignment = alignment;
+	entry->offset = offset;
+}
+
+static bool wave_cache_entry_is_current(const struct wave_cache_entry *entry,
+		const char *file_name, const struct stat *st)
+{
+	return !strcmp(entry->file_name, file_name) &&
+		entry->ino == st->st_ino &&
+		entry->file_size == st->st_size &&
+		entry->mtim.tv_sec == st->st_mtim.tv_sec &&
+		entry->mtim.tv_nsec == st->st_mtim.tv_nsec &&
+		entry->ctim.tv_sec == st->st_ctim.tv_sec &&
+		entry->ctim.tv_nsec == st->st_ctim.tv_nsec;
+}
+
+/*
+ * Look up the converted @file_name. On a miss, *key is set to the key to
+ * store the conversion under, if it can be cached.
+ */
+static struct wave_cache_entry * wave_cache_get(
+		struct dac_data_manager *manager, const char *file_name,
+		unsigned int channels, char **key)
+{
+	struct wave_cache_entry *entry = NULL;
+	double offset = dac_offset_get_value(manager->dac1.iio_dac);
+	unsigned int alignment = manager->alignment;
+	char *dir, *path, *data;
+	struct stat st, cache_st;
+	GList *node;
+	FILE *fp;
+
+	*key = NULL;
+	if (stat(file_name, &st))
+		return NULL;
+
+	for (node = manager->wave_cache; node; node = g_list_next(node)) {
+		entry = node->data;
+		if (wave_cache_entry_is_current(entry, file_name, &st) &&
+				entry->channels == channels &&
+				entry->alignment == alignment &&
+				entry->offset == offset)
+			goto hit;
+	}
+
+	*key = wave_cache_key(file_name, channels, alignment, offset);
+	if (!*key)
+		return NULL;
+
+	for (node = manager->wave_cache; node; node = g_list_next(node)) {
+		entry = node->data;
+		if (!strcmp(entry->key, *key))
+			goto hit;
+	}
+
+	dir = wave_cache_dir();
+	if (!dir)
+		return NULL;
+	path = g_build_filename(dir, *key, NULL);
+	g_free(dir);
+
+	fp = fopen(path, "rb");
+	g_free(path);
+	if (!fp)
+		return NULL;
+
+	data = NULL;
+	if (fstat(fileno(fp), &cache_st) == 0 && cache_st.st_size > 0 &&
+			cache_st.st_size <= G_MAXINT) {
+		data = malloc(cache_st.st_size);
+		if (data && fread(data, 1, cache_st.st_size, fp) !=
+				(size_t)cache_st.st_size) {
+			free(data);
+			data = NULL;
+		}
+	}
+	fclose(fp);
+	if (!data)
+		return NULL;
+
+	entry = g_new0(struct wave_cache_entry, 1);
+	entry->key = *key;
+	entry->data = data;
+	entry->size = cache_st.st_size;
+	*key = NULL;
+	wave_cache_entry_update(entry, file_name, &st, channels, alignment, offset);
+	wave_cache_add(manager, entry);
+	wave_cache_touch(entry->key);
+
+	return entry;
+
+hit:
+	manager->wave_cache = g_list_remove_link(manager->wave_cache, node);
+	manager->wave_cache = g_list_concat(node, manager->wave_cache);
+	wave_cache_entry_update(entry, file_name, &st, channels, alignment, offset);
+	wave_cache_touch(entry->key);
+	g_free(*key);
+	*key = NULL;
+
+	return entry;
+}
+
+/* Keep the conversion of @file_name; the entry returned owns @data */
+static struct wave_cache_entry * wave_cache_put(
+		struct dac_data_manager *manager, char *key,
+		const char *file_name, unsigned int channels, char *data, int size)
+{
+	struct wave_cache_entry *entry;
+	GError *err = NULL;
+	char *dir, *path;
+	struct stat st;
+
+	if (stat(file_name, &st))
+		return NULL;
+
+	dir = wave_cache_dir();
+	if (dir) {
+		path = g_build_filename(dir, key, NULL);
+		if (!g_file_set_contents(path, data, size, &err)) {
+			fprintf(stderr, "%s\n", err->message);
+			g_error_free(err);
+		}
+		g_free(path);
+		wave_cache_trim(dir);
+		g_free(dir);
+	}
+
+	entry = g_new0(struct wave_cache_entry, 1);
+	entry->key = g_strdup(key);
+	entry->data = data;
+	entry->size = size;
+	wave_cache_entry_update(entry, file_name, &st, channels,
+			manager->alignment,
+			dac_offset_get_value(manager->dac1.iio_dac));
+	wave_cache_add(manager, entry);
+
+	return entry;
+}
+
+/*
+ * Streaming playback of binary waveforms that don't fit in one buffer, or
+ * when asked for: the DAC buffer is not cyclic, the kernel queues a few
+ * blocks of it. A reader thread keeps WAVE_STREAM_BLOCKS blocks of the file
+ * read ahead, looping at its end, and a pusher thread copies them into the
+ * buffer and pushes them. The pusher finding no block ready is counted as
+ * an underrun; the rate it sustains is shown under the file chooser.
+ */
+#define WAVE_STREAM_BLOCK_SIZE (4 << 20)
+#define WAVE_STREAM_BLOCKS 8
+#define WAVE_STREAM_KERNEL_BUFFERS 4
+#define IIO_DEFAULT_KERNEL_BUFFERS 4	/* restored for the cyclic buffers */
+#define WAVE_STREAM_POP_TIMEOUT 100000	/* us */
+
+struct wave_stream {
+	struct dac_data_manager *manager;
+	struct iio_device *dac;
+	struct iio_buffer *buf;
+	FILE *fp;
+	struct wave_bin_header hdr;
+	unsigned long long frames;	/* in the file */
+	unsigned long long next_frame;	/* to be read */
+	size_t frame_size;
+	unsigned int block_frames;	/* in the file, before repeat */
+	size_t block_size;		/* in the buffer */
+
+	char *blocks[WAVE_STREAM_BLOCKS];
+	GAsyncQueue *free_blocks;
+	GAsyncQueue *full_blocks;
+	GThread *reader;
+	GThread *pusher;
+	volatile gint stop;
+
+	/* Shared with the main loop */
+	GMutex lock;
+	guint64 frames_pushed;
+	gint64 start_time;
+	unsigned int underruns;
+	int error;
+	guint stats_timer;
+};
+
+static void wave_stream_set_error(struct wave_stream *stream, int error)
+{
+	g_mutex_lock(&stream->lock);
+	if (!stream->error)
+		stream->error = error;
+	g_mutex_unlock(&stream->lock);
+	g_atomic_int_set(&stream->stop, 1);
+}
+
+static int wave_stream_fill(struct wave_stream *stream, char *block)
+{
+	unsigned int done = 0;
+	size_t n;
+
+	while (done < stream->block_frames) {
+		if (stream->next_frame == stream->frames) {
+			if (fseeko(stream->fp, stream->hdr.header_size, SEEK_SET))
+				return -errno;
+			stream->next_frame = 0;
+		}
+
+		n = MIN(stream->block_frames - done,
+				stream->frames - stream->next_frame);
+		if (fread(block + done * stream->frame_size, stream->frame_size,
+					n, stream->fp) != n)
+			return ferror(stream->fp) ? -EIO : -EINVAL;
+		done += n;
+		stream->next_frame += n;
+	}
+
+	wave_samples_from_le(block, done * stream->frame_size);
+	wave_frames_repeat(block, done, stream->frame_size, stream->hdr.repeat);
+
+	return 0;
+}
+
+static gpointer wave_stream_reader(gpointer data)
+{
+	struct wave_stream *stream = data;
+	char *block;
+	int ret;
+
+	while (!g_atomic_int_get(&stream->stop)) {
+		block = g_async_queue_timeout_pop(stream->free_blocks,
+				WAVE_STREAM_POP_TIMEOUT);
+		if (!block)
+			continue;
+
+		ret = wave_stream_fill(stream, block);
+		if (ret < 0) {
+			wave_stream_set_error(stream, ret);
+			break;
+		}
+		g_async_queue_push(stream->full_blocks, block);
+	}
+
+	return NULL;
+}
+
+static gpointer wave_stream_pusher(gpointer data)
+{
+	struct wave_stream *stream = data;
+	bool started = false, starved = false;
+	char *block;
+	ssize_t ret;
+
+	while (!g_atomic_int_get(&stream->stop)) {
+		block = g_async_queue_try_pop(stream->full_blocks);
+		if (!block) {
+			if (started && !starved) {
+				g_mutex_lock(&stream->lock);
+				stream->underruns++;
+				g_mutex_unlock(&stream->lock);
+			}
+			starved = true;
+			block = g_async_queue_timeout_pop(stream->full_blocks,
+					WAVE_STREAM_POP_TIMEOUT);
+			if (!block)
+				continue;
+		}
+		starved = false;
+
+		memcpy(iio_buffer_start(stream->buf), block, stream->block_size);
+		g_async_queue_push(stream->free_blocks, block);
+
+		/* Fails once wave_stream_stop() cancelled the buffer */
+		ret = iio_buffer_push(stream->buf);
+		if (ret < 0) {
+			if (!g_atomic_int_get(&stream->stop))
+				wave_stream_set_error(stream, (int)ret);
+			break;
+		}
+
+		g_mutex_lock(&stream->lock);
+		if (!started)
+			stream->start_time = g_get_monotonic_time();
+		else
+			stream->frames_pushed += stream->block_size /
+				stream->frame_size;
+		g_mutex_unlock(&stream->lock);
+		started = true;
+	}
+
+	return NULL;
+}
+
+static gboolean wave_stream_stats_update(gpointer data)
+{
+	struct wave_stream *stream = data;
+	GtkTextBuffer *status = stream->manager->dac_buffer_module.load_status_buf;
+	double elapsed, rate;
+	unsigned int underruns;
+	char *msg, *file_rate;
+	int error;
+
+	g_mutex_lock(&stream->lock);
+	elapsed = (g_get_monotonic_time() - stream->start_time) / 1e6;
+	rate = stream->start_time && elapsed > 0 ?
+		stream->frames_pushed / elapsed : 0.0;
+	underruns = stream->underruns;
+	error = stream->error;
+	g_mutex_unlock(&stream->lock);
+
+	if (error) {
+		msg = g_strdup_printf("Streaming stopped: %s.", strerror(-error));
+		gtk_text_buffer_set_text(status, msg, -1);
+		g_free(msg);
+		stream->stats_timer = 0;
+		return FALSE;
+	}
+
+	if (stream->hdr.sample_rate)
+		file_rate = g_strdup_printf(" (file: %.3f MSPS)",
+				stream->hdr.sample_rate / 1e6);
+	else
+		file_rate = g_strdup("");
+	msg = g_strdup_printf("Streaming: %.3f MSPS sustained%s, %u underruns.",
+			rate / 1e6, file_rate, underruns);
+	gtk_text_buffer_set_text(status, msg, -1);
+	g_free(file_rate);
+	g_free(msg);
+
+	return TRUE;
+}
+
+static void wave_stream_stop(struct wave_stream *stream)
+{
+	unsigned int i;
+
+	g_atomic_int_set(&stream->stop, 1);
+
+	/* A push blocked on a stalled DAC or network backend returns */
+	if (stream->buf)
+		iio_buffer_cancel(stream->buf);
+	if (stream->pusher)
+		g_thread_join(stream->pusher);
+	if (stream->reader)
+		g_thread_join(stream->reader);
+	if (stream->stats_timer)
+		g_source_remove(stream->stats_timer);
+
+	/* Release the DAC, for the cyclic buffers that follow */
+	if (stream->buf)
+		iio_buffer_destroy(stream->buf);
+	iio_device_set_kernel_buffers_count(stream->dac,
+			IIO_DEFAULT_KERNEL_BUFFERS);
+
+	g_async_queue_unref(stream->free_blocks);
+	g_async_queue_unref(stream->full_blocks);
+	for (i = 0; i < WAVE_STREAM_BLOCKS; i++)
+		g_free(stream->blocks[i]);
+	g_mutex_clear(&stream->lock);
+	fclose(stream->fp);
+	g_free(stream);
+}
+
+/* Takes ownership of @fp, positioned at the samples; the buffer is set up
+ * for the enabled channels */
+static struct wave_stream * wave_stream_start(struct dac_data_manager *manager,
+		struct iio_device *dac, FILE *fp, const struct wave_bin_header *hdr,
+		unsigned long long frames)
+{
+	struct wave_stream *stream;
+	unsigned int i;
+
+	stream = g_new0(struct wave_stream, 1);
+	stream->manager = manager;
+	stream->dac = dac;
+	stream->fp = fp;
+	stream->hdr = *hdr;
+	stream->frames = frames;
+	stream->frame_size = hdr->channels * 2;
+	g_mutex_init(&stream->lock);
+
+	stream->block_frames = MAX(WAVE_STREAM_BLOCK_SIZE /
+			(stream->frame_size * hdr->repeat), 1);
+	stream->block_size = (size_t)stream->block_frames * hdr->repeat *
+		stream->frame_size;
+	while (stream->block_size % manager->alignment) {
+		stream->block_frames *= 2;
+		stream->block_size *= 2;
+	}
+
+	stream->free_blocks = g_async_queue_new();
+	stream->full_blocks = g_async_queue_new();
+	for (i = 0; i < WAVE_STREAM_BLOCKS; i++) {
+		stream->blocks[i] = g_try_malloc(stream->block_size);
+		if (!stream->blocks[i])
+			goto err_stop;
+		g_async_queue_push(stream->free_blocks, stream->blocks[i]);
+	}
+
+	iio_device_set_kernel_buffers_count(dac, WAVE_STREAM_KERNEL_BUFFERS);
+	stream->buf = iio_device_create_buffer(dac,
+			stream->block_size / stream->frame_size, false);
+	if (!stream->buf)
+		goto err_stop;
+
+	stream->reader = g_thread_new("Waveform reader", wave_stream_reader,
+			stream);
+	stream->pusher = g_thread_new("Waveform pusher", wave_stream_pusher,
+			stream);
+	stream->stats_timer = g_timeout_add(500, wave_stream_stats_update,
+			stream);
+
+	return stream;
+
+err_stop:
+	i = errno;
+	wave_stream_stop(stream);
+	errno = i;
+	return NULL;
+}
+
+static void dds_buffer_destroy(struct dac_data_manager *manager)
+{
+	if (manager->stream) {
+		wave_stream_stop(manager->stream);
+		manager->stream = NULL;
+	}
+	if (manager->dds_buffer) {
+		iio_buffer_destroy(manager->dds_buffer);
+		manager->dds_buffer = NULL;
+	}
+}
+
+static gboolean scale_spin_button_output_cb(GtkSpinButton *spin, gpointer data)
+{
+	GtkAdjustment *adj;
+	gchar *text;
+	int value;
+
+	adj = gtk_spin_button_get_adjustment(spin);
+	value = (int)gtk_adjustment_get_value(adj);
+	if (value > gtk_adjustment_get_lower(adj))
+		text = g_strdup_printf("%d dB", value);
+	else
+		text = g_strdup_printf("-Inf dB");
+	gtk_entry_set_text(GTK_ENTRY(spin), text);
+	g_free(text);
+
+	return TRUE;
+}
+
+static int tx_enabled_channels_count(GtkTreeView *treeview, unsigned *enabled_mask)
+{
+	GtkTreeIter iter;
+	gboolean enabled;
+	int num_enabled = 0;
+	int ch_pos = 0;
+
+	GtkTreeModel *model = gtk_tree_view_get_model(treeview);
+	gboolean next_iter = gtk_tree_model_get_iter_first(model, &iter);
+
+
+	if (enabled_mask)
+		*enabled_mask = 0;
+
+	while (next_iter) {
+		gtk_tree_model_get(model, &iter, TX_CHANNEL_ACTIVE, &enabled, -1);
+		if (enabled) {
+			num_enabled++;
+			if (enabled_mask)
+				*enabled_mask |= 1 << ch_pos;
+		}
+		ch_pos++;
+		next_iter = gtk_tree_model_iter_next(model, &iter);
+	}
+
+	return num_enabled;
+}
+
+static void enable_dds_channels(struct dac_buffer *db)
+{
+	GtkTreeView *treeview = GTK_TREE_VIEW(db->tx_channels_view);
+	GtkTreeIter iter;
+	gboolean enabled;
+	gint ch_index = 0;
+
+	GtkTreeModel *model = gtk_tree_view_get_model(treeview);
+	gboolean next_iter = gtk_tree_model_get_iter_first(model, &iter);
+
+	while (next_iter) {
+		gtk_tree_model_get(model, &iter, TX_CHANNEL_ACTIVE, &enabled,
+			TX_CHANNEL_REF_INDEX, &ch_index, -1);
+
+		struct iio_channel *channel = iio_device_get_channel(db->dac_with_scanelems, ch_index);
+
+		if (enabled)
+			iio_channel_enable(channel);
+		else
+			iio_channel_disable(channel);
+
+		next_iter = gtk_tree_model_iter_next(model, &iter);
+	}
+}
+
+static void enable_dds(struct dac_data_manager *manager, bool on_off)
+{
+	struct iio_device *dac1 = NULL;
+	struct iio_device *dac2 = NULL;
+	int ret;
+
+	if (on_off == manager->dds_activated && !manager->dds_disabled)
+		return;
+	manager->dds_activated = on_off;
+
+	dds_buffer_destroy(manager);
+
+	dac1 = manager->dac1.iio_dac;
+	if (manager->dacs_count == 2)
+		dac2 = manager->dac2.iio_dac;
+
+	ret = iio_channel_attr_write_bool(iio_device_find_channel(dac1, "altvoltage0", true), "raw", on_off);
+	if (ret < 0) {
+		fprintf(stderr, "Failed to toggle DDS: %d\n", ret);
+		return;
+	}
+	if (dac2) {
+		ret = iio_channel_attr_write_bool(iio_device_find_channel(dac2, "altvoltage0", true), "raw", on_off);
+		if (ret < 0) {
+			fprintf(stderr, "Failed to toggle DDS: %d\n", ret);
+			return;
+		}
+	}
+}
+
+/* Number of channels the waveforms are converted for */
+static unsigned int dac_buffer_channels(struct dac_data_manager *manager)
+{
+	unsigned int buffer_channels = 0;
+
+	if (manager->is_local) {
+#ifdef __linux__
+		unsigned int major, minor;
+		struct utsname uts;
+
+		uname(&uts);
+		sscanf(uts.release, "%u.%u", &major, &minor);
+		if (major < 2 || (major == 3 && minor < 14)) {
+			if (manager->dacs_count == 2)
+				buffer_channels = 8;
+			else if (manager->dac1.tx_count == 2)
+				buffer_channels = 4;
+			else
+				buffer_channels = 2;
+		} else {
+			buffer_channels = tx_enabled_channels_count(GTK_TREE_VIEW(manager->dac_buffer_module.tx_channels_view), NULL);
+		}
+#endif
+	} else {
+		buffer_channels = tx_enabled_channels_count(GTK_TREE_VIEW(manager->dac_buffer_module.tx_channels_view), NULL);
+	}
+
+	return buffer_channels;
+}
+
+static int process_dac_buffer_file (struct dac_data_manager *manager, const char *file_name, char **stat_msg)
+{
+	int ret, size = 0, s_size;
+	/*
+	struct stat st;
+	*/
+	char *buf = NULL, *tmp;
+	/*
+	FILE *infile;
+	*/
+	unsigned int buffer_channels;
+	struct wave_bin_header hdr;
+	unsigned long long frames = 0;
+	FILE *bin;
+	bool stream = false;
+	struct wave_cache_entry *cached = NULL;
+	char *key = NULL;
+
+	dds_buffer_destroy(manager);
+
+	buffer_channels = dac_buffer_channels(manager);
+
+	bin = wave_bin_open(file_name, &hdr, &frames);
+	if (bin) {
+		unsigned long long bytes = frames * hdr.channels * 2 * hdr.repeat;
+
+		while (bytes && (bytes % manager->alignment) != 0)
+			bytes *= 2;
+		stream = bytes > G_MAXINT || (manager->dac_buffer_module.stream_btn &&
+				gtk_toggle_button_get_active(GTK_TOGGLE_BUTTON(
+					manager->dac_buffer_module.stream_btn)));
+		if (!stream)
+			size = bytes;
+		ret = frames ? 0 : WAVEFORM_BIN_INVALID_FORMAT;
+	} else {
+		cached = wave_cache_get(manager, file_name, buffer_channels, &key);
+		if (cached) {
+			buf = cached->data;
+			size = cached->size;
+			ret = 0;
+		} else {
+			ret = analyse_wavefile(manager, file_name, &buf, &size, buffer_channels);
+			if (ret == 0 && key)
+				cached = wave_cache_put(manager, key, file_name,
+						buffer_channels, buf, size);
+		}
+		g_free(key);
+	}
+	if (ret < 0) {
+		if (stat_msg)
+			*stat_msg = g_strdup_printf("Error while parsing file: %s.", strerror(-ret));
+		return ret;
+	} else if (ret > 0) {
+		if (stat_msg)
+			*stat_msg = g_strdup_printf("Invalid data format");
+		if (bin)
+			fclose(bin);
+		return -EINVAL;
+	}
+
+/*
+	if (ret == -1 || buf == NULL) {
+		stat(file_name, &st);
+		buf = malloc(st.st_size);
+		if (buf == NULL) {
+			if (stat_msg)
+				*stat_msg = g_strdup_printf("Internal memory allocation failed.");
+			return -errno;
+		}
+		infile = fopen(file_name, "r");
+		size = fread(buf, 1, st.st_size, infile);
+		fclose(infile);
+	}
+*/
+	enable_dds(manager, false);
+	enable_dds_channels(&manager->dac_buffer_module);
+
+	struct iio_device *dac = manager->dac_buffer_module.dac_with_scanelems;
+
+	s_size = iio_device_get_sample_size(dac);
+	if (!s_size) {
+		fprintf(stderr, "Unable to create buffer due to sample size");
+		if (stat_msg)
+			*stat_msg = g_strdup_printf("Unable to create buffer due to sample size");
+		if (!cached)
+			free(buf);
+		if (bin)
+			fclose(bin);
+		return -EINVAL;
+	}
+
+	if (bin && s_size != hdr.channels * 2) {
+		if (stat_msg)
+			*stat_msg = g_strdup_printf("The waveform has %u channels, "
+					"%d are enabled.", hdr.channels, s_size / 2);
+		fclose(bin);
+		return -EINVAL;
+	}
+
+	if (stream) {
+		manager->stream = wave_stream_start(manager, dac, bin, &hdr, frames);
+		if (!manager->stream) {
+			ret = errno ? -errno : -ENOMEM;
+			fprintf(stderr, "Unable to start streaming: %s\n", strerror(-ret));
+			if (stat_msg)
+				*stat_msg = g_strdup_printf("Unable to start streaming: %s",
+						strerror(-ret));
+			return ret;
+		}
+		goto loaded;
+	}
+
+	manager->dds_buffer = iio_device_create_buffer(dac, size / s_size, true);
+	if (!manager->dds_buffer) {
+		fprintf(stderr, "Unable to create buffer: %s\n", strerror(errno));
+		if (stat_msg)
+			*stat_msg = g_strdup_printf("Unable to create iio buffer: %s", strerror(errno));
+		if (!cached)
+			free(buf);
+		if (bin)
+			fclose(bin);
+		return -errno;
+	}
+
+	if (bin) {
+		ret = wave_bin_read(bin, &hdr, frames,
+				iio_buffer_start(manager->dds_buffer), size);
+		fclose(bin);
+		if (ret < 0) {
+			if (stat_msg)
+				*stat_msg = g_strdup_printf("Error while reading file: %s.",
+						strerror(-ret));
+			iio_buffer_destroy(manager->dds_buffer);
+			manager->dds_buffer = NULL;
+			return ret;
+		}
+	} else {
+		memcpy(iio_buffer_start(manager->dds_buffer), buf,
+				iio_buffer_end(manager->dds_buffer) - iio_buffer_start(manager->dds_buffer));
+	}
+
+	iio_buffer_push(manager->dds_buffer);
+	if (!cached)
+		free(buf);
+
+loaded:
+	tmp = strdup(file_name);
+	if (manager->dac_buffer_module.dac_buf_filename)
+		free(manager->dac_buffer_module.dac_buf_filename);
+	 manager->dac_buffer_module.dac_buf_filename = tmp;
+
+	if (stat_msg && stream)
+		*stat_msg = g_strdup_printf("Streaming started.");
+	else if (stat_msg && bin && hdr.sample_rate)
+		*stat_msg = g_strdup_printf("Waveform loaded successfully "
+				"(made for %.3f MSPS).", hdr.sample_rate / 1e6);
+	else if (stat_msg)
+		*stat_msg = g_strdup_printf("Waveform loaded successfully.");
+
+	return 0;
+}
+
+static bool tx_channels_check_valid_setup(struct dac_buffer *dbuf)
+{
+	struct iio_device *dac = dbuf->dac_with_scanelems;
+	int enabled_channels;
+	unsigned mask;
+
+	enabled_channels = tx_enabled_channels_count(GTK_TREE_VIEW(dbuf->tx_channels_view), &mask);
+
+	return (dma_valid_selection(iio_device_get_name(dac) ?: iio_device_get_id(dac),
+			mask, dbuf->scan_elements_count) && enabled_channels > 0);
+}
+
+static void tx_channel_toggled(GtkCellRendererToggle* renderer, gchar* pathStr, struct dac_buffer *dbuf)
+{
+	GtkTreePath* path = gtk_tree_path_new_from_string(pathStr);
+	GtkTreeModel *model;
+	GtkTreeIter iter;
+	gboolean active;
+	gint ch_index;
+
+	if (!gtk_cell_renderer_get_sensitive(GTK_CELL_RENDERER(renderer)))
+		return;
+
+	model = gtk_tree_view_get_model(GTK_TREE_VIEW(dbuf->tx_channels_view));
+	gtk_tree_model_get_iter(model, &iter, path);
+	gtk_tree_model_get(model, &iter, TX_CHANNEL_ACTIVE, &active, TX_CHANNEL_REF_INDEX, &ch_index, -1);
+	active = !active;
+	gtk_tree_store_set(GTK_TREE_STORE(model), &iter, TX_CHANNEL_ACTIVE, active, -1);
+	gtk_tree_path_free(path);
+}
+
+/* A waveform synthesized from a description, see wave_synth.h. It is
+ * remembered, and saved in profiles, as the name of the buffer file with
+ * this prefix. */
+#define WAVE_SYNTH_PREFIX "synth:"
+
+static double dac_sample_rate_get(struct iio_device *dac)
+{
+	unsigned int i;
+	double rate;
+
+	for (i = 0; i < iio_device_get_channels_count(dac); i++) {
+		struct iio_channel *ch = iio_device_get_channel(dac, i);
+
+		if (iio_channel_is_output(ch) && !iio_channel_attr_read_double(ch,
+					"sampling_frequency", &rate) && rate > 0.0)
+			return rate;
+	}
+
+	if (!iio_device_attr_read_double(dac, "sampling_frequency", &rate) &&
+			rate > 0.0)
+		return rate;
+
+	return 0.0;
+}
+
+static void dac_buf_filename_set(struct dac_data_manager *manager,
+		const char *prefix, const char *name)
+{
+	char *tmp = malloc(strlen(prefix) + strlen(name) + 1);
+
+	if (!tmp)
+		return;
+
+	sprintf(tmp, "%s%s", prefix, name);
+	if (manager->dac_buffer_module.dac_buf_filename)
+		free(manager->dac_buffer_module.dac_buf_filename);
+	manager->dac_buffer_module.dac_buf_filename = tmp;
+}
+
+/* The sample rate of the DAC is the default one */
+static struct wave_synth * dac_synth_new(struct dac_data_manager *manager,
+		const char *spec, struct wave_synth_params *params,
+		char **stat_msg)
+{
+	struct wave_synth *synth;
+
+	wave_synth_params_init(params);
+	params->sample_rate = dac_sample_rate_get(
+			manager->dac_buffer_module.dac_with_scanelems);
+	if (wave_synth_params_parse(params, spec) < 0) {
+		if (stat_msg)
+			*stat_msg = g_strdup_printf("Invalid waveform description.");
+		errno = EINVAL;
+		return NULL;
+	}
+
+	synth = wave_synth_new(params);
+	if (!synth && stat_msg)
+		*stat_msg = g_strdup_printf("Unable to synthesize the waveform: %s%s",
+				strerror(errno), params->sample_rate > 0.0 ?
+				"" : " (sample rate unknown, set rate=)");
 
-	GtkTreeModel *model = gtk_tree_view_get_model(treeview);
-	gboolean next_iter = gtk_tree_model_get_iter_first(model, &iter);
+	return synth;
+}
 
-	while (next_iter) {
-		gtk_tree_model_get(model, &iter, TX_CHANNEL_ACTIVE, &enabled,
-			TX_CHANNEL_REF_INDEX, &ch_index, -1);
+/* Frames of the buffer: the period, repeated until the size of the buffer
+ * is aligned; 0 if that is too large */
+static unsigned int dac_synth_frames(struct dac_data_manager *manager,
+		struct wave_synth *synth, unsigned int s_size)
+{
+	unsigned int frames;
 
-		struct iio_channel *channel = iio_device_get_channel(db->dac_with_scanelems, ch_index);
+	for (frames = wave_synth_length(synth); frames <= G_MAXINT / s_size &&
+			(frames * s_size) % manager->alignment; frames *= 2);
 
-		if (enabled)
-			iio_channel_enable(channel);
-		else
-			iio_channel_disable(channel);
+	return frames <= G_MAXINT / s_size ? frames : 0;
+}
 
-		next_iter = gtk_tree_model_iter_next(model, &iter);
+/* The samples are synthesized a block at a time straight into @dst; the
+ * peak goes to the requested level and every TX gets the signal */
+static void dac_synth_fill(struct dac_data_manager *manager,
+		struct wave_synth *synth, double level, uint16_t *dst,
+		unsigned int frames, unsigned int tx_channels)
+{
+	double i[WAVE_SYNTH_BLOCK], q[WAVE_SYNTH_BLOCK];
+	unsigned int length = wave_synth_length(synth);
+	unsigned int start, count, c;
+	const double *columns[8];
+	double peak, scale, offset;
+
+	peak = wave_synth_peak(synth);
+	scale = peak > 0.0 ? 32752.0 * pow(10.0, level / 20.0) / peak : 0.0;
+	offset = dac_offset_get_value(manager->dac1.iio_dac);
+	for (c = 0; c < tx_channels; c++)
+		columns[c] = c % 2 ? q : i;
+
+	for (start = 0; start < frames; start += count) {
+		count = MIN(MIN(frames - start, length - start % length),
+				WAVE_SYNTH_BLOCK);
+		wave_synth_generate(synth, start % length, count, i, q);
+		wave_pack_columns(dst + (size_t)start * tx_channels, columns,
+				tx_channels, count, scale, offset);
 	}
 }
 
-static void enable_dds(struct dac_data_manager *manager, bool on_off)
+static int process_dac_buffer_synth(struct dac_data_manager *manager,
+		const char *spec, char **stat_msg)
 {
-	struct iio_device *dac1 = NULL;
-	struct iio_device *dac2 = NULL;
-	int ret;
+	struct iio_device *dac = manager->dac_buffer_module.dac_with_scanelems;
+	struct wave_synth_params params;
+	struct wave_synth *synth;
+	unsigned int frames;
+	int s_size;
 
-	if (on_off == manager->dds_activated && !manager->dds_disabled)
-		return;
-	manager->dds_activated = on_off;
+	dds_buffer_destroy(manager);
 
-	if (manager->dds_buffer) {
-		iio_buffer_destroy(manager->dds_buffer);
-		manager->dds_buffer = NULL;
-	}
+	synth = dac_synth_new(manager, spec, &params, stat_msg);
+	if (!synth)
+		return -errno;
 
-	dac1 = manager->dac1.iio_dac;
-	if (manager->dacs_count == 2)
-		dac2 = manager->dac2.iio_dac;
+	enable_dds(manager, false);
+	enable_dds_channels(&manager->dac_buffer_module);
 
-	ret = iio_channel_attr_write_bool(iio_device_find_channel(dac1, "altvoltage0", true), "raw", on_off);
-	if (ret < 0) {
-		fprintf(stderr, "Failed to toggle DDS: %d\n", ret);
-		return;
+	s_size = iio_device_get_sample_size(dac);
+	if (!s_size || s_size > 16) {
+		fprintf(stderr, "Unable to create buffer due to sample size");
+		if (stat_msg)
+			*stat_msg = g_strdup_printf("Unable to create buffer due to sample size");
+		wave_synth_free(synth);
+		return -EINVAL;
 	}
-	if (dac2) {
-		ret = iio_channel_attr_write_bool(iio_device_find_channel(dac2, "altvoltage0", true), "raw", on_off);
-		if (ret < 0) {
-			fprintf(stderr, "Failed to toggle DDS: %d\n", ret);
-			return;
-		}
+
+	frames = dac_synth_frames(manager, synth, s_size);
+	if (!frames) {
+		if (stat_msg)
+			*stat_msg = g_strdup_printf("The waveform is too large.");
+		wave_synth_free(synth);
+		return -EFBIG;
+	}
+
+	manager->dds_buffer = iio_device_create_buffer(dac, frames, true);
+	if (!manager->dds_buffer) {
+		fprintf(stderr, "Unable to create buffer: %s\n", strerror(errno));
+		if (stat_msg)
+			*stat_msg = g_strdup_printf("Unable to create iio buffer: %s", strerror(errno));
+		wave_synth_free(synth);
+		return -errno;
 	}
+
+	dac_synth_fill(manager, synth, params.level,
+			iio_buffer_start(manager->dds_buffer), frames, s_size / 2);
+	iio_buffer_push(manager->dds_buffer);
+
+	dac_buf_filename_set(manager, WAVE_SYNTH_PREFIX, spec);
+
+	if (stat_msg)
+		*stat_msg = g_strdup_printf("Waveform synthesized: %u samples "
+				"at %.3f MSPS.", wave_synth_length(synth),
+				params.sample_rate / 1e6);
+	wave_synth_free(synth);
+
+	return 0;
 }
 
-static int process_dac_buffer_file (struct dac_data_manager *manager, const char *file_name, char **stat_msg)
+/*
+ * Playlist: waveforms converted ahead of time, so that switching to one of
+ * them reads and converts nothing. The DAC has a single buffer, so a switch
+ * still replaces the cyclic buffer, but only the copy of the samples into
+ * it remains. In profiles, a buffer file name of
+ * "playlist:a.txt;b.mat;synth:..." loads a list and plays its first
+ * waveform; "playlist:next", "playlist:prev" or "playlist:<n>" then switch.
+ */
+#define WAVE_PLAYLIST_PREFIX "playlist:"
+#define WAVE_PLAYLIST_SEPARATOR ";"
+
+struct wave_playlist_entry {
+	char *name;		/* file name, or synth: description */
+	char *data;
+	int size;
+	unsigned int channels;	/* it was converted for */
+};
+
+static void wave_playlist_entry_free(gpointer data)
 {
-	int ret, size = 0, s_size;
-	/*
-	struct stat st;
-	*/
-	char *buf = NULL, *tmp;
-	/*
-	FILE *infile;
-	*/
-	unsigned int buffer_channels = 0;
+	struct wave_playlist_entry *entry = data;
 
-	if (manager->dds_buffer) {
-		iio_buffer_destroy(manager->dds_buffer);
-		manager->dds_buffer = NULL;
+	g_free(entry->name);
+	free(entry->data);
+	g_free(entry);
+}
+
+static int wave_playlist_convert(struct dac_data_manager *manager,
+		struct wave_playlist_entry *entry, char **stat_msg)
+{
+	unsigned int channels = dac_buffer_channels(manager);
+	struct wave_cache_entry *cached = NULL;
+	char *buf = NULL, *key = NULL;
+	int ret = 0, size = 0;
+
+	free(entry->data);
+	entry->data = NULL;
+
+	if (!channels || channels > 8) {
+		if (stat_msg)
+			*stat_msg = g_strdup_printf("Invalid channel selection.");
+		return -EINVAL;
 	}
 
-	if (manager->is_local) {
-#ifdef __linux__
-		unsigned int major, minor;
-		struct utsname uts;
+	if (g_str_has_prefix(entry->name, WAVE_SYNTH_PREFIX)) {
+		struct wave_synth_params params;
+		struct wave_synth *synth;
+		unsigned int frames;
 
-		uname(&uts);
-		sscanf(uts.release, "%u.%u", &major, &minor);
-		if (major < 2 || (major == 3 && minor < 14)) {
-			if (manager->dacs_count == 2)
-				buffer_channels = 8;
-			else if (manager->dac1.tx_count == 2)
-				buffer_channels = 4;
+		synth = dac_synth_new(manager, entry->name +
+				strlen(WAVE_SYNTH_PREFIX), &params, stat_msg);
+		if (!synth)
+			return -errno;
+
+		frames = dac_synth_frames(manager, synth, channels * 2);
+		size = frames * channels * 2;
+		buf = frames ? malloc(size) : NULL;
+		if (buf)
+			dac_synth_fill(manager, synth, params.level,
+					(uint16_t *)buf, frames, channels);
+		else
+			ret = frames ? -ENOMEM : -EFBIG;
+		wave_synth_free(synth);
+	} else if (g_str_has_suffix(entry->name, ".iq")) {
+		struct wave_bin_header hdr;
+		unsigned long long frames = 0, bytes;
+		FILE *bin = wave_bin_open(entry->name, &hdr, &frames);
+
+		if (!bin) {
+			if (stat_msg)
+				*stat_msg = g_strdup_printf("Invalid data format");
+			return -EINVAL;
+		}
+
+		bytes = frames * hdr.channels * 2 * hdr.repeat;
+		while (bytes && (bytes % manager->alignment) != 0)
+			bytes *= 2;
+		if (!bytes || hdr.channels != channels)
+			ret = -EINVAL;
+		else if (bytes > G_MAXINT)
+			ret = -EFBIG;
+		else if (!(buf = malloc(bytes)))
+			ret = -ENOMEM;
+		else
+			ret = wave_bin_read(bin, &hdr, frames, buf, bytes);
+		size = bytes;
+		fclose(bin);
+	} else if (g_str_has_suffix(entry->name, ".txt") ||
+			g_str_has_suffix(entry->name, ".mat")) {
+		cached = wave_cache_get(manager, entry->name, channels, &key);
+		if (!cached) {
+			ret = analyse_wavefile(manager, entry->name, &buf,
+					&size, channels);
+			if (ret == 0 && key)
+				cached = wave_cache_put(manager, key,
+						entry->name, channels, buf, size);
+		}
+		g_free(key);
+
+		/* The cache keeps its copy */
+		if (cached) {
+			size = cached->size;
+			buf = malloc(size);
+			if (buf)
+				memcpy(buf, cached->data, size);
 			else
-				buffer_channels = 2;
-		} else {
-			buffer_channels = tx_enabled_channels_count(GTK_TREE_VIEW(manager->dac_buffer_module.tx_channels_view), NULL);
+				ret = -ENOMEM;
 		}
-#endif
+		if (ret > 0)
+			ret = -EINVAL;
 	} else {
-		buffer_channels = tx_enabled_channels_count(GTK_TREE_VIEW(manager->dac_buffer_module.tx_channels_view), NULL);
+		ret = -EINVAL;
 	}
 
-	ret = analyse_wavefile(manager, file_name, &buf, &size, buffer_channels);
 	if (ret < 0) {
 		if (stat_msg)
-			*stat_msg = g_strdup_printf("Error while parsing file: %s.", strerror(-ret));
+			*stat_msg = g_strdup_printf("Unable to load %s: %s.",
+					entry->name, strerror(-ret));
+		if (!cached)
+			free(buf);
 		return ret;
-	} else if (ret > 0) {
+	}
+
+	entry->data = buf;
+	entry->size = size;
+	entry->channels = channels;
+
+	return 0;
+}
+
+static char * wave_playlist_label(const char *name)
+{
+	if (g_str_has_prefix(name, WAVE_SYNTH_PREFIX))
+		return g_strdup(name);
+
+	return g_path_get_basename(name);
+}
+
+static void wave_playlist_combo_update(struct dac_data_manager *manager)
+{
+	struct dac_buffer *dbuf = &manager->dac_buffer_module;
+	GtkListStore *store;
+	unsigned int i;
+	char *label;
+
+	if (!dbuf->playlist_combo)
+		return;
+
+	dbuf->playlist_updating = true;
+	store = GTK_LIST_STORE(gtk_combo_box_get_model(
+				GTK_COMBO_BOX(dbuf->playlist_combo)));
+	gtk_list_store_clear(store);
+	for (i = 0; manager->playlist && i < manager->playlist->len; i++) {
+		struct wave_playlist_entry *entry =
+			g_ptr_array_index(manager->playlist, i);
+
+		label = wave_playlist_label(entry->name);
+		gtk_combo_box_text_append_text(
+				GTK_COMBO_BOX_TEXT(dbuf->playlist_combo), label);
+		g_free(label);
+	}
+	dbuf->playlist_updating = false;
+}
+
+static int wave_playlist_play(struct dac_data_manager *manager,
+		unsigned int index, char **stat_msg)
+{
+	struct dac_buffer *dbuf = &manager->dac_buffer_module;
+	struct iio_device *dac = dbuf->dac_with_scanelems;
+	struct wave_playlist_entry *entry;
+	GString *names;
+	unsigned int i;
+	int ret, s_size;
+
+	if (!manager->playlist || index >= manager->playlist->len) {
 		if (stat_msg)
-			*stat_msg = g_strdup_printf("Invalid data format");
+			*stat_msg = g_strdup_printf("No such waveform in the playlist.");
 		return -EINVAL;
 	}
+	entry = g_ptr_array_index(manager->playlist, index);
 
-/*
-	if (ret == -1 || buf == NULL) {
-		stat(file_name, &st);
-		buf = malloc(st.st_size);
-		if (buf == NULL) {
-			if (stat_msg)
-				*stat_msg = g_strdup_printf("Internal memory allocation failed.");
-			return -errno;
-		}
-		infile = fopen(file_name, "r");
-		size = fread(buf, 1, st.st_size, infile);
-		fclose(infile);
-	}
-*/
+	dds_buffer_destroy(manager);
 	enable_dds(manager, false);
-	enable_dds_channels(&manager->dac_buffer_module);
+	enable_dds_channels(dbuf);
 
-	struct iio_device *dac = manager->dac_buffer_module.dac_with_scanelems;
+	/* The channels changed since it was converted */
+	if (entry->channels != dac_buffer_channels(manager)) {
+		ret = wave_playlist_convert(manager, entry, stat_msg);
+		if (ret < 0)
+			return ret;
+	}
 
 	s_size = iio_device_get_sample_size(dac);
-	if (!s_size) {
+	if (!s_size || entry->size % s_size) {
 		fprintf(stderr, "Unable to create buffer due to sample size");
 		if (stat_msg)
 			*stat_msg = g_strdup_printf("Unable to create buffer due to sample size");
-		free(buf);
 		return -EINVAL;
 	}
 
-	manager->dds_buffer = iio_device_create_buffer(dac, size / s_size, true);
+	manager->dds_buffer = iio_device_create_buffer(dac,
+			entry->size / s_size, true);
 	if (!manager->dds_buffer) {
 		fprintf(stderr, "Unable to create buffer: %s\n", strerror(errno));
 		if (stat_msg)
 			*stat_msg = g_strdup_printf("Unable to create iio buffer: %s", strerror(errno));
-		free(buf);
 		return -errno;
 	}
 
-	memcpy(iio_buffer_start(manager->dds_buffer), buf,
-			iio_buffer_end(manager->dds_buffer) - iio_buffer_start(manager->dds_buffer));
-
+	memcpy(iio_buffer_start(manager->dds_buffer), entry->data, entry->size);
 	iio_buffer_push(manager->dds_buffer);
-	free(buf);
+	manager->playlist_pos = index;
 
-	tmp = strdup(file_name);
-	if (manager->dac_buffer_module.dac_buf_filename)
-		free(manager->dac_buffer_module.dac_buf_filename);
-	 manager->dac_buffer_module.dac_buf_filename = tmp;
+	/* Saved in profiles as the whole list */
+	names = g_string_new(NULL);
+	for (i = 0; i < manager->playlist->len; i++) {
+		struct wave_playlist_entry *e =
+			g_ptr_array_index(manager->playlist, i);
+
+		if (i)
+			g_string_append(names, WAVE_PLAYLIST_SEPARATOR);
+		g_string_append(names, e->name);
+	}
+	dac_buf_filename_set(manager, WAVE_PLAYLIST_PREFIX, names->str);
+	g_string_free(names, TRUE);
+
+	if (dbuf->playlist_combo) {
+		dbuf->playlist_updating = true;
+		gtk_combo_box_set_active(GTK_COMBO_BOX(dbuf->playlist_combo),
+				index);
+		dbuf->playlist_updating = false;
+	}
 
 	if (stat_msg)
-		*stat_msg = g_strdup_printf("Waveform loaded successfully.");
+		*stat_msg = g_strdup_printf("Playing %u of %u: %s.", index + 1,
+				manager->playlist->len, entry->name);
 
 	return 0;
 }
 
-static bool tx_channels_check_valid_setup(struct dac_buffer *dbuf)
+static int wave_playlist_add(struct dac_data_manager *manager,
+		const char *name, char **stat_msg)
 {
-	struct iio_device *dac = dbuf->dac_with_scanelems;
-	int enabled_channels;
-	unsigned mask;
+	struct wave_playlist_entry *entry;
+	int ret;
 
-	enabled_channels = tx_enabled_channels_count(GTK_TREE_VIEW(dbuf->tx_channels_view), &mask);
+	entry = g_new0(struct wave_playlist_entry, 1);
+	entry->name = g_strdup(name);
+	ret = wave_playlist_convert(manager, entry, stat_msg);
+	if (ret < 0) {
+		wave_playlist_entry_free(entry);
+		return ret;
+	}
 
-	return (dma_valid_selection(iio_device_get_name(dac) ?: iio_device_get_id(dac),
-			mask, dbuf->scan_elements_count) && enabled_channels > 0);
+	if (!manager->playlist)
+		manager->playlist = g_ptr_array_new_with_free_func(
+				wave_playlist_entry_free);
+	g_ptr_array_add(manager->playlist, entry);
+	wave_playlist_combo_update(manager);
+
+	if (stat_msg)
+		*stat_msg = g_strdup_printf("Added to the playlist (%u waveforms).",
+				manager->playlist->len);
+
+	return 0;
 }
 
-static void tx_channel_toggled(GtkCellRendererToggle* renderer, gchar* pathStr, struct dac_buffer *dbuf)
+static void wave_playlist_clear(struct dac_data_manager *manager)
 {
-	GtkTreePath* path = gtk_tree_path_new_from_string(pathStr);
-	GtkTreeModel *model;
-	GtkTreeIter iter;
-	gboolean active;
-	gint ch_index;
+	if (manager->playlist)
+		g_ptr_array_free(manager->playlist, TRUE);
+	manager->playlist = NULL;
+	manager->playlist_pos = 0;
+	wave_playlist_combo_update(manager);
+}
 
-	if (!gtk_cell_renderer_get_sensitive(GTK_CELL_RENDERER(renderer)))
+/* @arg: what follows WAVE_PLAYLIST_PREFIX */
+static int wave_playlist_directive(struct dac_data_manager *manager,
+		const char *arg, char **stat_msg)
+{
+	unsigned int len = manager->playlist ? manager->playlist->len : 0;
+	gchar **names;
+	unsigned int i;
+	int ret = 0;
+	char *end;
+
+	if (!strcmp(arg, "next"))
+		return wave_playlist_play(manager,
+				len ? (manager->playlist_pos + 1) % len : 0, stat_msg);
+	if (!strcmp(arg, "prev"))
+		return wave_playlist_play(manager,
+				len ? (manager->playlist_pos + len - 1) % len : 0,
+				stat_msg);
+	i = strtoul(arg, &end, 10);
+	if (*arg && !*end)
+		return wave_playlist_play(manager, i, stat_msg);
+
+	/* A new list: all of it is converted before the first one plays */
+	wave_playlist_clear(manager);
+	names = g_strsplit(arg, WAVE_PLAYLIST_SEPARATOR, -1);
+	for (i = 0; !ret && names[i]; i++) {
+		g_strstrip(names[i]);
+		if (!*names[i])
+			continue;
+		if (stat_msg && *stat_msg) {
+			g_free(*stat_msg);
+			*stat_msg = NULL;
+		}
+		ret = wave_playlist_add(manager, names[i], stat_msg);
+	}
+	g_strfreev(names);
+
+	if (ret < 0) {
+		wave_playlist_clear(manager);
+		return ret;
+	}
+	if (stat_msg && *stat_msg) {
+		g_free(*stat_msg);
+		*stat_msg = NULL;
+	}
+
+	return wave_playlist_play(manager, 0, stat_msg);
+}
+
+static void waveform_playlist_add_clicked_cb(GtkButton *btn,
+		struct dac_buffer *dbuf)
+{
+	gchar *filename = dbuf->dac_buf_filename;
+	gchar *status_msg = NULL;
+
+	if (!filename || g_str_has_suffix(filename, "(null)"))
+		status_msg = g_strdup_printf("No file selected.");
+	else if (g_str_has_prefix(filename, WAVE_PLAYLIST_PREFIX))
+		status_msg = g_strdup_printf("Select a file or generate a waveform to add.");
+	else if (!tx_channels_check_valid_setup(dbuf))
+		status_msg = g_strdup_printf("Invalid channel selection.");
+	else
+		wave_playlist_add(dbuf->parent, filename, &status_msg);
+
+	gtk_text_buffer_set_text(dbuf->load_status_buf, status_msg, -1);
+	g_free(status_msg);
+}
+
+static void waveform_playlist_clear_clicked_cb(GtkButton *btn,
+		struct dac_buffer *dbuf)
+{
+	wave_playlist_clear(dbuf->parent);
+	gtk_text_buffer_set_text(dbuf->load_status_buf, "", -1);
+}
+
+static void waveform_playlist_changed_cb(GtkComboBox *combo,
+		struct dac_buffer *dbuf)
+{
+	gint index = gtk_combo_box_get_active(combo);
+	gchar *status_msg = NULL;
+
+	if (dbuf->playlist_updating || index < 0)
 		return;
 
-	model = gtk_tree_view_get_model(GTK_TREE_VIEW(dbuf->tx_channels_view));
-	gtk_tree_model_get_iter(model, &iter, path);
-	gtk_tree_model_get(model, &iter, TX_CHANNEL_ACTIVE, &active, TX_CHANNEL_REF_INDEX, &ch_index, -1);
-	active = !active;
-	gtk_tree_store_set(GTK_TREE_STORE(model), &iter, TX_CHANNEL_ACTIVE, active, -1);
-	gtk_tree_path_free(path);
+	wave_playlist_play(dbuf->parent, index, &status_msg);
+	gtk_text_buffer_set_text(dbuf->load_status_buf, status_msg, -1);
+	g_free(status_msg);
+}
+
+static void waveform_synth_button_clicked_cb(GtkWidget *btn, struct dac_buffer *dbuf)
+{
+	const char *spec = gtk_entry_get_text(GTK_ENTRY(dbuf->synth_entry));
+	gchar *status_msg;
+
+	if (!tx_channels_check_valid_setup(dbuf))
+		status_msg = g_strdup_printf("Invalid channel selection.");
+	else
+		process_dac_buffer_synth(dbuf->parent, spec, &status_msg);
+
+	gtk_text_buffer_set_text(dbuf->load_status_buf, status_msg, -1);
+	g_free(status_msg);
 }
 
 static void dac_buffer_config_file_set_cb (GtkFileChooser *chooser, struct dac_buffer *dbuf)
@@ -801,8 +2320,20 @@ static void waveform_load_button_clicked_cb (GtkButton *btn, struct dac_buffer *
 
 	if (!filename || g_str_has_suffix(filename, "(null)")) {
 		status_msg = g_strdup_printf("No file selected.");
-	} else if (!g_str_has_suffix(filename, ".txt") && !g_str_has_suffix(filename, ".mat")) {
-		status_msg = g_strdup_printf("Invalid file type. Please select a .txt or .mat file.");
+	} else if (g_str_has_prefix(filename, WAVE_SYNTH_PREFIX)) {
+		gtk_entry_set_text(GTK_ENTRY(dbuf->synth_entry),
+				filename + strlen(WAVE_SYNTH_PREFIX));
+		waveform_synth_button_clicked_cb(NULL, dbuf);
+		return;
+	} else if (g_str_has_prefix(filename, WAVE_PLAYLIST_PREFIX)) {
+		if (!tx_channels_check_valid_setup(dbuf))
+			status_msg = g_strdup_printf("Invalid channel selection.");
+		else
+			wave_playlist_directive(dbuf->parent, filename +
+					strlen(WAVE_PLAYLIST_PREFIX), &status_msg);
+	} else if (!g_str_has_suffix(filename, ".txt") && !g_str_has_suffix(filename, ".mat") &&
+			!g_str_has_suffix(filename, ".iq")) {
+		status_msg = g_strdup_printf("Invalid file type. Please select a .txt, .mat or .iq file.");
 	} else if (!tx_channels_check_valid_setup(dbuf)) {
 		status_msg = g_strdup_printf("Invalid channel selection.");
 	} else {
@@ -1086,6 +2617,13 @@ static GtkWidget *gui_dac_buffer_create(struct dac_buffer *d_buffer)
 	GtkWidget *fchooser_frame;
 	GtkWidget *fchooser_btn;
 	GtkWidget *fileload_btn;
+	GtkWidget *stream_btn;
+	GtkWidget *synth_entry;
+	GtkWidget *synth_btn;
+	GtkWidget *playlist_combo;
+	GtkWidget *playlist_add_btn;
+	GtkWidget *playlist_clear_btn;
+	GtkWidget *playlist_hbox;
 	GtkWidget *load_status_txt;
 	GtkWidget *tx_channels_frame;
 	GtkTextBuffer *load_status_tb;
@@ -1096,12 +2634,39 @@ static GtkWidget *gui_dac_buffer_create(struct dac_buffer *d_buffer)
 	fchooser_btn = gtk_file_chooser_button_new("Select a File",
 			GTK_FILE_CHOOSER_ACTION_OPEN);
 	fileload_btn = gtk_button_new_with_label("Load");
+	stream_btn = gtk_check_button_new_with_label("Stream from disk (.iq)");
+	synth_entry = gtk_entry_new();
+	synth_btn = gtk_button_new_with_label("Generate");
+	playlist_combo = gtk_combo_box_text_new();
+	playlist_add_btn = gtk_button_new_with_label("Add");
+	playlist_clear_btn = gtk_button_new_with_label("Clear");
+	playlist_hbox = gtk_hbox_new(FALSE, 0);
 	load_status_tb = gtk_text_buffer_new(NULL);
 	load_status_txt = gtk_text_view_new_with_buffer(load_status_tb);
 
 	gtk_alignment_set_padding(GTK_ALIGNMENT(dacbuf_align), 5, 5, 5, 5);
 
-	fchooser_frame = frame_with_table_create("<b>File Selection</b>", 2, 2);
+	fchooser_frame = frame_with_table_create("<b>File Selection</b>", 5, 2);
+	gtk_entry_set_text(GTK_ENTRY(synth_entry),
+			"tones count=8 start=1e6 step=1e6 level=-3");
+	gtk_widget_set_tooltip_text(synth_entry, "Synthesize a waveform instead:\n"
+			"tones count= start= step= phase=newman|zero\n"
+			"chirp start= stop= sweep=linear|log\n"
+			"qam order=4|16|64|256 sps= rolloff= span= prbs=7|9|15|23|31 symbols=\n"
+			"and for all: rate= length= level= (dBFS)");
+	gtk_widget_set_tooltip_text(stream_btn, "Send the waveform straight from "
+			"the file, looping at its end, instead of loading it into a "
+			"cyclic buffer. Waveforms too large for a buffer are always "
+			"streamed.");
+	gtk_widget_set_tooltip_text(playlist_combo, "Playlist: the waveforms "
+			"are converted when added, switching between them only "
+			"refills the buffer");
+	gtk_widget_set_tooltip_text(playlist_add_btn, "Add the loaded file or "
+			"the generated waveform to the playlist");
+	gtk_box_pack_start(GTK_BOX(playlist_hbox), playlist_add_btn,
+			FALSE, FALSE, 0);
+	gtk_box_pack_start(GTK_BOX(playlist_hbox), playlist_clear_btn,
+			FALSE, FALSE, 0);
 	tx_channels_frame = frame_with_table_create("<b>DAC Channels</b>", 1, 1);
 
 	gtk_text_view_set_editable(GTK_TEXT_VIEW(load_status_txt), false);
@@ -1117,8 +2682,18 @@ static GtkWidget *gui_dac_buffer_create(struct dac_buffer *d_buffer)
 		0, 1, 0, 1, GTK_FILL | GTK_EXPAND, GTK_FILL | GTK_EXPAND, 0, 0);
 	gtk_table_attach(GTK_TABLE(table), fileload_btn,
 		1, 2, 0, 1, GTK_FILL, GTK_FILL, 0, 0);
-	gtk_table_attach(GTK_TABLE(table), load_status_txt,
+	gtk_table_attach(GTK_TABLE(table), stream_btn,
 		0, 2, 1, 2, GTK_FILL, GTK_FILL, 0, 0);
+	gtk_table_attach(GTK_TABLE(table), synth_entry,
+		0, 1, 2, 3, GTK_FILL | GTK_EXPAND, GTK_FILL, 0, 0);
+	gtk_table_attach(GTK_TABLE(table), synth_btn,
+		1, 2, 2, 3, GTK_FILL, GTK_FILL, 0, 0);
+	gtk_table_attach(GTK_TABLE(table), playlist_combo,
+		0, 1, 3, 4, GTK_FILL | GTK_EXPAND, GTK_FILL, 0, 0);
+	gtk_table_attach(GTK_TABLE(table), playlist_hbox,
+		1, 2, 3, 4, GTK_FILL, GTK_FILL, 0, 0);
+	gtk_table_attach(GTK_TABLE(table), load_status_txt,
+		0, 2, 4, 5, GTK_FILL, GTK_FILL, 0, 0);
 
 	align = gtk_bin_get_child(GTK_BIN(tx_channels_frame));
 	table = gtk_bin_get_child(GTK_BIN(align));
@@ -1139,11 +2714,24 @@ static GtkWidget *gui_dac_buffer_create(struct dac_buffer *d_buffer)
 	d_buffer->load_status_buf = load_status_tb;
 	d_buffer->tx_channels_view = gtk_bin_get_child(GTK_BIN(channels_scrolled_view));
 	d_buffer->buffer_fchooser_btn = fchooser_btn;
+	d_buffer->stream_btn = stream_btn;
+	d_buffer->synth_entry = synth_entry;
+	d_buffer->playlist_combo = playlist_combo;
 
 	g_signal_connect(fchooser_btn, "file-set",
 		G_CALLBACK(dac_buffer_config_file_set_cb), d_buffer);
 	g_signal_connect(fileload_btn, "clicked",
 		G_CALLBACK(waveform_load_button_clicked_cb), d_buffer);
+	g_signal_connect(synth_btn, "clicked",
+		G_CALLBACK(waveform_synth_button_clicked_cb), d_buffer);
+	g_signal_connect(synth_entry, "activate",
+		G_CALLBACK(waveform_synth_button_clicked_cb), d_buffer);
+	g_signal_connect(playlist_combo, "changed",
+		G_CALLBACK(waveform_playlist_changed_cb), d_buffer);
+	g_signal_connect(playlist_add_btn, "clicked",
+		G_CALLBACK(waveform_playlist_add_clicked_cb), d_buffer);
+	g_signal_connect(playlist_clear_btn, "clicked",
+		G_CALLBACK(waveform_playlist_clear_clicked_cb), d_buffer);
 
 	gtk_widget_show(dacbuf_frame);
 
@@ -1521,10 +3109,8 @@ static void manage_dds_mode (GtkComboBox *box, struct dds_tx *tx)
 			}
 		}
 
-		if (!manager->dds_activated && manager->dds_buffer) {
-			iio_buffer_destroy(manager->dds_buffer);
-			manager->dds_buffer = NULL;
-		}
+		if (!manager->dds_activated)
+			dds_buffer_destroy(manager);
 		manager->dds_disabled = true;
 		enable_dds(manager, start_dds);
 
@@ -1956,11 +3542,11 @@ init_error:
 void dac_data_manager_free(struct dac_data_manager *manager)
 {
 	if (manager) {
-		if (manager->dds_buffer) {
-			iio_buffer_destroy(manager->dds_buffer);
-			manager->dds_buffer = NULL;
-		}
+		dds_buffer_destroy(manager);
 		g_slist_free(manager->dds_tones);
+		g_list_free_full(manager->wave_cache, wave_cache_entry_free);
+		if (manager->playlist)
+			g_ptr_array_free(manager->playlist, TRUE);
 		free(manager);
 	}
 }
@@ -2111,6 +3697,25 @@ void dac_data_manager_set_buffer_chooser_filename(struct dac_data_manager *manag
 
 	GtkWidget *fchooser = manager->dac_buffer_module.buffer_fchooser_btn;
 
+	/* Profiles can describe the waveform instead of naming a file */
+	if (g_str_has_prefix(filename, WAVE_SYNTH_PREFIX)) {
+		gtk_entry_set_text(GTK_ENTRY(manager->dac_buffer_module.synth_entry),
+				filename + strlen(WAVE_SYNTH_PREFIX));
+		waveform_synth_button_clicked_cb(NULL, &manager->dac_buffer_module);
+		return;
+	}
+	if (g_str_has_prefix(filename, WAVE_PLAYLIST_PREFIX)) {
+		char *tmp = strdup(filename);
+
+		if (!tmp)
+			return;
+		if (manager->dac_buffer_module.dac_buf_filename)
+			free(manager->dac_buffer_module.dac_buf_filename);
+		manager->dac_buffer_module.dac_buf_filename = tmp;
+		waveform_load_button_clicked_cb(NULL, &manager->dac_buffer_module);
+		return;
+	}
+
 	gtk_file_chooser_set_filename(GTK_FILE_CHOOSER(fchooser), filename);
 	g_signal_emit_by_name(fchooser, "file-set", NULL);
 	waveform_load_button_clicked_cb(NULL, &manager->dac_buffer_module);
@@ -38,6 +38,7 @@
 #define ARRAY_SIZE(x) (!sizeof(x) ?: sizeof(x) / sizeof((x)[0]))
 #define MHZ_TO_HZ(x) ((x) * 1000000)
 #define MHZ_TO_KHZ(x) ((x) * 1000)
+#define MS_TO_US(x) ((x) * 1000)
 #define HZ_TO_MHZ(x) ((x) / 1E6)
 
 #define HANNING_ENBW 1.50
@@ -52,10 +53,14 @@ typedef struct _plugin_setup {
 	double stop_freq;
 	double resolution_bw;
 	unsigned int fft_size;
+	bool adaptive;		/* fft_size from the RBW and the sweep time */
+	double sweep_time;	/* ms, in the adaptive mode */
+	double freq_step;	/* MHz, between the LO of consecutive steps */
 	enum receivers rx;
 	GSList *rx_profiles;
 	unsigned int profile_count;
 	unsigned int profile_slot;
+	char *profiles_key;	/* of the fastlock cache, for rx_profiles */
 } plugin_setup;
 
 typedef struct _fastlock_profile {
@@ -66,13 +71,19 @@ typedef struct _fastlock_profile {
 
 /* Plugin Global Variables */
 static const double sweep_freq_step = 56; /* 56 MHz */
+static const double sweep_adaptive_step = 48; /* 8 MHz of overlap */
+static const double sweep_retune_time = 200; /* us, when not measured yet */
 static const double sampling_rate = 61.44; /* 61.44 MSPS */
 
+/* libiio's, restored on the capture device when a sweep stops */
+#define IIO_DEFAULT_KERNEL_BUFFERS 4
+
 static struct iio_context *ctx;
 static struct iio_device *dev, *cap;
 static struct iio_channel *alt_ch0;
 static struct iio_buffer *capture_buffer;
 static bool is_2rx_2tx;
+static bool ctx_is_local;
 static char *rx_fastlock_store_name;
 static char *rx_fastlock_save_name;
 static GtkWidget *spectrum_window;
@@ -83,19 +94,36 @@ static GThread *freq_sweep_thread;
 static GThread *capture_thread;
 static GThread *fft_thread;
 
-/* Threads Synchronization */
-static GCond profile_applied_cond,
-		capture_done_cond,
-		demux_done_cond,
-		fft_done_cond;
-static GMutex profile_applied_mutex,
-		capture_done_mutex,
-		demux_done_mutex,
-		fft_done_mutex;
-static bool profile_applied,
-		capture_done,
-		demux_done,
-		fft_done;
+/* Threads Synchronization
+ * The threads hand sweep steps to each other through single producer,
+ * single consumer rings: while the capture of a step is demuxed and the
+ * profile of the next one is recalled, the FFT of the previous steps can
+ * still be running. */
+#define SWEEP_SLOTS 4		/* steps demuxed ahead of the FFT */
+#define SWEEP_RING_SIZE 8	/* power of two, above SWEEP_SLOTS */
+#define SWEEP_CHANNELS 2	/* I and Q of the receiver */
+#define SWEEP_SPINS 64		/* yields before a waiting thread sleeps */
+#define SWEEP_SLEEP_US 20
+
+struct sweep_ring {
+	unsigned int head;	/* written by the producer only */
+	unsigned int tail;	/* written by the consumer only */
+	unsigned int items[SWEEP_RING_SIZE];
+};
+
+/* The samples of a step, between the demux and the FFT */
+struct sweep_step {
+	struct iio_channel *chn[SWEEP_CHANNELS];
+	gfloat *data[SWEEP_CHANNELS];
+	unsigned int count[SWEEP_CHANNELS];
+	unsigned int size;
+};
+
+static struct sweep_ring captured_ring,	/* Data Capture -> Frequency Sweep */
+		applied_ring,		/* Frequency Sweep -> Data Capture */
+		demuxed_ring,		/* Data Capture -> Do FFT, step slots */
+		free_ring;		/* Do FFT -> Data Capture, step slots */
+static struct sweep_step sweep_steps[SWEEP_SLOTS];
 static bool kill_sweep_thread,
 		kill_capture_thread,
 		kill_fft_thread;
@@ -104,9 +132,12 @@ static bool kill_sweep_thread,
 static GtkWidget *center_freq;
 static GtkWidget *freq_bw;
 static GtkWidget *available_RBWs;
+static GtkWidget *adaptive_rbw;
+static GtkWidget *sweep_time;
 static GtkWidget *receiver1;
 static GtkWidget *start_button;
 static GtkWidget *stop_button;
+static GtkWidget *sweep_stats_label;
 
 /* Default Plugin Variables */
 static gint this_page;
@@ -114,44 +145,215 @@ static GtkNotebook *nbook;
 static GtkWidget *analyzer_panel;
 static gboolean plugin_detached;
 
-#if DEBUG
-GTimer *gtimer;
-double loop_durations_sum;
-unsigned long long loop_count;
-#endif
+/* Sweep Telemetry
+ * Each stage adds up the time it spends on every step, written by its own
+ * thread only. The panel shows the figures of the last second, the
+ * "save_sweep_stats" profile directive those of the whole sweep. */
+enum sweep_stage {
+	STAGE_RECALL,	/* fastlock recall of the profile of the next step */
+	STAGE_LOAD,	/* fastlock load of the profile after it */
+	STAGE_REFILL,
+	STAGE_DEMUX,
+	STAGE_FFT,	/* FFT and stitching into the spectrum, by the plot */
+	STAGE_COUNT
+};
+
+static const char * const sweep_stage_names[] = {
+	"recall", "load", "refill", "demux", "FFT",
+};
+
+struct sweep_stats {
+	guint64 ns[STAGE_COUNT];
+	guint64 steps[STAGE_COUNT];
+	guint64 sweeps;
+	gint64 time;	/* us, when the snapshot was taken */
+};
+
+static struct sweep_stats sweep_stats,
+		sweep_stats_start,	/* when the sweep started */
+		sweep_stats_last;	/* shown in the panel last */
+static guint sweep_stats_timer;
+
+static guint64 sweep_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (guint64)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* @start: sweep_time_ns() when the stage started */
+static void sweep_stats_add(enum sweep_stage stage, guint64 start)
+{
+	__atomic_fetch_add(&sweep_stats.ns[stage], sweep_time_ns() - start,
+			__ATOMIC_RELAXED);
+	__atomic_fetch_add(&sweep_stats.steps[stage], 1, __ATOMIC_RELAXED);
+}
+
+static void sweep_stats_snapshot(struct sweep_stats *snap)
+{
+	unsigned int i;
+
+	for (i = 0; i < STAGE_COUNT; i++) {
+		snap->ns[i] = __atomic_load_n(&sweep_stats.ns[i], __ATOMIC_RELAXED);
+		snap->steps[i] = __atomic_load_n(&sweep_stats.steps[i],
+				__ATOMIC_RELAXED);
+	}
+	snap->sweeps = __atomic_load_n(&sweep_stats.sweeps, __ATOMIC_RELAXED);
+	snap->time = g_get_monotonic_time();
+}
+
+static double sweep_stats_rate(const struct sweep_stats *from,
+		const struct sweep_stats *to, guint64 from_count, guint64 to_count)
+{
+	if (to->time <= from->time)
+		return 0.0;
+
+	return (to_count - from_count) * 1e6 / (to->time - from->time);
+}
+
+/* Mean time of a stage per step, in us */
+static double sweep_stats_mean(const struct sweep_stats *from,
+		const struct sweep_stats *to, enum sweep_stage stage)
+{
+	guint64 steps = to->steps[stage] - from->steps[stage];
+
+	return steps ? (to->ns[stage] - from->ns[stage]) / 1e3 / steps : 0.0;
+}
+
+static void sweep_stats_show(const struct sweep_stats *from,
+		const struct sweep_stats *to)
+{
+	char buf[256];
+	unsigned int i;
+	int len;
+
+	len = snprintf(buf, sizeof(buf), "%.2f sweeps/s, %.0f segments/s\n",
+			sweep_stats_rate(from, to, from->sweeps, to->sweeps),
+			sweep_stats_rate(from, to, from->steps[STAGE_FFT],
+				to->steps[STAGE_FFT]));
+	for (i = 0; i < STAGE_COUNT && len < (int)sizeof(buf); i++)
+		len += snprintf(buf + len, sizeof(buf) - len, "%s%s %.0f us",
+				i ? ", " : "", sweep_stage_names[i],
+				sweep_stats_mean(from, to, i));
+
+	gtk_label_set_text(GTK_LABEL(sweep_stats_label), buf);
+}
+
+static gboolean sweep_stats_update(gpointer data)
+{
+	struct sweep_stats now;
+
+	sweep_stats_snapshot(&now);
+	sweep_stats_show(&sweep_stats_last, &now);
+	sweep_stats_last = now;
+
+	return TRUE;
+}
+
+/* One line per call: build, board, sweep settings, then the figures */
+static int sweep_stats_save(const char *path)
+{
+	struct sweep_stats now;
+	unsigned int i;
+	FILE *fp;
+
+	fp = osc_get_log_file(path);
+	if (!fp) {
+		fprintf(stderr, "Unable to open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+
+	sweep_stats_snapshot(&now);
+	fprintf(fp, "%s, \"%s\", %.3f, %.3f, %u, %.3f, %.1f",
+			OSC_VERSION, iio_context_get_description(ctx),
+			psetup.start_freq, psetup.stop_freq, psetup.fft_size,
+			sweep_stats_rate(&sweep_stats_start, &now,
+				sweep_stats_start.sweeps, now.sweeps),
+			sweep_stats_rate(&sweep_stats_start, &now,
+				sweep_stats_start.steps[STAGE_FFT],
+				now.steps[STAGE_FFT]));
+	for (i = 0; i < STAGE_COUNT; i++)
+		fprintf(fp, ", %.1f", sweep_stats_mean(&sweep_stats_start, &now, i));
+	fprintf(fp, "\n");
+	fclose(fp);
+
+	return 0;
+}
+
+static void sweep_ring_reset(struct sweep_ring *ring)
+{
+	ring->head = 0;
+	ring->tail = 0;
+}
+
+/* No ring ever holds more than SWEEP_SLOTS items, so there is always room */
+static void sweep_ring_push(struct sweep_ring *ring, unsigned int item)
+{
+	unsigned int head = ring->head;
+
+	ring->items[head % SWEEP_RING_SIZE] = item;
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+/* Waits for an item; false if @kill got set first. The other thread is
+ * usually about to produce one, so it yields for a while before sleeping. */
+static bool sweep_ring_pop(struct sweep_ring *ring, unsigned int *item,
+		const bool *kill)
+{
+	unsigned int tail = ring->tail, spins = 0;
+
+	while (__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == tail) {
+		if (__atomic_load_n(kill, __ATOMIC_RELAXED))
+			return false;
+		if (++spins < SWEEP_SPINS)
+			g_thread_yield();
+		else
+			g_usleep(SWEEP_SLEEP_US);
+	}
+
+	*item = ring->items[tail % SWEEP_RING_SIZE];
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+
+	return true;
+}
 
 static ssize_t demux_sample(const struct iio_channel *chn,
 		void *sample, size_t size, void *d)
 {
-	struct extra_info *info = iio_channel_get_data(chn);
-	struct extra_dev_info *dev_info = iio_device_get_data(info->dev);
+	struct sweep_step *step = d;
 	const struct iio_data_format *format = iio_channel_get_data_format(chn);
+	unsigned int c;
+	gfloat *out;
+
+	for (c = 0; c < SWEEP_CHANNELS && step->chn[c] != chn; c++);
 
 	/* Prevent buffer overflow */
-	if ((unsigned long) info->offset == (unsigned long) dev_info->sample_count)
+	if (c == SWEEP_CHANNELS || step->count[c] == step->size)
 		return 0;
+	out = step->data[c] + step->count[c]++;
 
 	if (size == 1) {
 		int8_t val;
 		iio_channel_convert(chn, &val, sample);
 		if (format->is_signed)
-			*(info->data_ref + info->offset++) = (gfloat) val;
+			*out = (gfloat) val;
 		else
-			*(info->data_ref + info->offset++) = (gfloat) (uint8_t)val;
+			*out = (gfloat) (uint8_t)val;
 	} else if (size == 2) {
 		int16_t val;
 		iio_channel_convert(chn, &val, sample);
 		if (format->is_signed)
-			*(info->data_ref + info->offset++) = (gfloat) val;
+			*out = (gfloat) val;
 		else
-			*(info->data_ref + info->offset++) = (gfloat) (uint16_t)val;
+			*out = (gfloat) (uint16_t)val;
 	} else {
 		int32_t val;
 		iio_channel_convert(chn, &val, sample);
 		if (format->is_signed)
-			*(info->data_ref + info->offset++) = (gfloat) val;
+			*out = (gfloat) val;
 		else
-			*(info->data_ref + info->offset++) = (gfloat) (uint32_t)val;
+			*out = (gfloat) (uint32_t)val;
 	}
 
 	return size;
@@ -253,6 +455,35 @@ static void init_device_list(struct iio_context *ctx)
 	}
 }
 
+/*
+ * In the adaptive mode the steps of the sweep overlap, and the FFT size is
+ * the one of the RBW, unless the sweep time doesn't leave enough time to
+ * capture that many samples at each step. Then the RBW is as fine as the
+ * sweep time allows. The capture buffer is kept for the whole sweep, so all
+ * steps use the same FFT size.
+ */
+static unsigned int adaptive_fft_size(plugin_setup *setup, unsigned int fft_size)
+{
+	static const struct sweep_stats none;
+	double retune, dwell;
+	unsigned int steps;
+
+	/* The retune time measured during the last sweep, if any */
+	retune = sweep_stats.steps[STAGE_RECALL] ?
+		sweep_stats_mean(&none, &sweep_stats, STAGE_RECALL) :
+		sweep_retune_time;
+
+	/* As many as build_profiles_for_entire_sweep() makes */
+	steps = ceil((setup->stop_freq - setup->start_freq) / setup->freq_step);
+	dwell = MS_TO_US(setup->sweep_time) / steps - retune;
+
+	/* Samples captured in the dwell time, sampling_rate is in MSPS */
+	while (fft_size > 32 && fft_size > dwell * sampling_rate)
+		fft_size >>= 1;
+
+	return fft_size;
+}
+
 static bool plugin_gather_user_setup(plugin_setup *setup)
 {
 	double center, bw, start_freq, stop_freq;
@@ -267,12 +498,20 @@ static bool plugin_gather_user_setup(plugin_setup *setup)
 	start_freq = center - bw / 2;
 	stop_freq = center + bw / 2;
 	setup->fft_size = 65536 >> rbw_index;
+	setup->adaptive = gtk_toggle_button_get_active(
+			GTK_TOGGLE_BUTTON(adaptive_rbw));
+	setup->sweep_time = gtk_spin_button_get_value(
+			GTK_SPIN_BUTTON(sweep_time));
+	setup->freq_step = setup->adaptive ? sweep_adaptive_step :
+		sweep_freq_step;
 
 	if ((setup->start_freq != start_freq) || (setup->stop_freq != stop_freq)) {
 		setup->start_freq = start_freq;
 		setup->stop_freq = stop_freq;
 		data_is_new = true;
 	}
+	if (setup->adaptive)
+		setup->fft_size = adaptive_fft_size(setup, setup->fft_size);
 
 	if (!is_2rx_2tx) {
 		setup->rx = RX1;
@@ -287,24 +526,155 @@ static bool plugin_gather_user_setup(plugin_setup *setup)
 	return data_is_new;
 }
 
+/*
+ * Harvesting the fastlock profiles retunes the LO through every step of the
+ * sweep. They are cached in the user cache directory, under a hash of the
+ * device, of the sweep and of what the synthesizer calibration depends on:
+ * the reference clock and whether the LO is external. Changing any of them
+ * gets the profiles harvested again.
+ */
+#define FASTLOCK_CACHE_VERSION "1"
+#define FASTLOCK_CACHE_DIR "fastlock"
+
+static char * fastlock_cache_key(plugin_setup *setup)
+{
+	long long xo_freq = 0;
+	bool external = false;
+	GChecksum *sum;
+	char *settings, *key;
+
+	iio_device_attr_read_longlong(dev, "xo_correction", &xo_freq);
+	iio_channel_attr_read_bool(alt_ch0, "external", &external);
+
+	settings = g_strdup_printf("%s %s %s %lld %d %.17g %.17g %.17g",
+			FASTLOCK_CACHE_VERSION, iio_context_get_description(ctx),
+			PHY_DEVICE, xo_freq, external, setup->start_freq,
+			setup->stop_freq, setup->freq_step);
+	sum = g_checksum_new(G_CHECKSUM_SHA256);
+	g_checksum_update(sum, (const guchar *)settings, strlen(settings) + 1);
+	g_free(settings);
+
+	key = g_strdup(g_checksum_get_string(sum));
+	g_checksum_free(sum);
+
+	return key;
+}
+
+static char * fastlock_cache_path(const char *key)
+{
+	char *dir, *path;
+
+	dir = g_build_filename(g_get_user_cache_dir(), "osc",
+			FASTLOCK_CACHE_DIR, NULL);
+	if (g_mkdir_with_parents(dir, S_IRWXU) != 0) {
+		fprintf(stderr, "Can't create %s: %s\n", dir, strerror(errno));
+		g_free(dir);
+		return NULL;
+	}
+	path = g_build_filename(dir, key, NULL);
+	g_free(dir);
+
+	return path;
+}
+
+/* One "frequency profile" line per step; it must match the sweep exactly */
+static bool fastlock_cache_load(plugin_setup *setup, const char *path)
+{
+	double f, start = setup->start_freq + sweep_freq_step / 2;
+	GSList *profiles = NULL;
+	fastlock_profile *profile;
+	long long frequency;
+	unsigned int i = 0;
+	char line[128];
+	bool valid = true;
+	int pos = 0;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return false;
+
+	for (f = start; valid && (f - sweep_freq_step / 2) < setup->stop_freq;
+			f += setup->freq_step) {
+		valid = fgets(line, sizeof(line), fp) &&
+			sscanf(line, "%lld %n", &frequency, &pos) == 1 &&
+			frequency == (long long)MHZ_TO_HZ(f);
+		profile = valid ? malloc(sizeof(fastlock_profile)) : NULL;
+		if (!profile) {
+			valid = false;
+			break;
+		}
+		g_strlcpy(profile->data, g_strchomp(line + pos),
+				sizeof(profile->data));
+		profile->frequency = frequency;
+		profile->index = i++;
+		profiles = g_slist_prepend(profiles, profile);
+	}
+	valid = valid && !fgets(line, sizeof(line), fp);
+	fclose(fp);
+
+	if (!valid) {
+		g_slist_free_full(profiles, (GDestroyNotify)free);
+		return false;
+	}
+	setup->rx_profiles = g_slist_reverse(profiles);
+
+	return true;
+}
+
+static void fastlock_cache_save(plugin_setup *setup, const char *path)
+{
+	GString *contents = g_string_new(NULL);
+	GError *err = NULL;
+	GSList *node;
+
+	for (node = setup->rx_profiles; node; node = g_slist_next(node)) {
+		fastlock_profile *profile = node->data;
+
+		g_string_append_printf(contents, "%lld %s\n",
+				profile->frequency, profile->data);
+	}
+
+	if (!g_file_set_contents(path, contents->str, contents->len, &err)) {
+		fprintf(stderr, "%s\n", err->message);
+		g_error_free(err);
+	}
+	g_string_free(contents, TRUE);
+}
+
 static void build_profiles_for_entire_sweep(plugin_setup *setup)
 {
 	double start, stop, step, f;
-	fastlock_profile *profile;
+	fastlock_profile *profile = NULL;
 	static unsigned char prev_alc = 0;
 	unsigned char alc;
 	char *last_byte;
 	unsigned int i = 0;
+	char *key, *path;
 
 	g_return_if_fail(setup);
 
+	/* The profiles are still good */
+	key = fastlock_cache_key(setup);
+	if (setup->rx_profiles && setup->profiles_key &&
+			!strcmp(key, setup->profiles_key)) {
+		g_free(key);
+		return;
+	}
+	g_free(setup->profiles_key);
+	setup->profiles_key = key;
+
 	/* Clear any previous profiles */
 	g_slist_free_full(setup->rx_profiles, (GDestroyNotify)free);
 	setup->rx_profiles = NULL;
 
+	path = fastlock_cache_path(key);
+	if (path && fastlock_cache_load(setup, path))
+		goto done;
+
 	start = setup->start_freq + sweep_freq_step / 2;
 	stop = setup->stop_freq;
-	step = sweep_freq_step;
+	step = setup->freq_step;
 
 	for (f = start; (f - sweep_freq_step / 2) < stop; f += step) {
 		iio_channel_attr_write_longlong(alt_ch0, "frequency",
@@ -313,7 +683,7 @@ static void build_profiles_for_entire_sweep(plugin_setup *setup)
 					rx_fastlock_store_name, 0);
 		profile = malloc(sizeof(fastlock_profile));
 		if (!profile)
-			return;
+			break;
 		iio_channel_attr_read(alt_ch0, rx_fastlock_save_name,
 					profile->data, sizeof(profile->data));
 		profile->frequency = (long long)MHZ_TO_HZ(f);
@@ -332,6 +702,15 @@ static void build_profiles_for_entire_sweep(plugin_setup *setup)
 
 	}
 	setup->rx_profiles = g_slist_reverse(setup->rx_profiles);
+	if (path && !profile) {
+		g_free(setup->profiles_key);
+		setup->profiles_key = NULL;
+	} else if (path) {
+		fastlock_cache_save(setup, path);
+	}
+
+done:
+	g_free(path);
 	setup->profile_count = g_slist_length(setup->rx_profiles);
 	#if DEBUG
 	log_before_sweep_starts(setup);
@@ -356,6 +735,7 @@ static void configure_spectrum_window(plugin_setup *setup)
 	osc_plot_spect_set_len(OSC_PLOT(spectrum_window), setup->profile_count);
 	osc_plot_spect_set_start_f(OSC_PLOT(spectrum_window), setup->start_freq);
 	osc_plot_spect_set_filter_bw(OSC_PLOT(spectrum_window), sweep_freq_step);
+	osc_plot_spect_set_step(OSC_PLOT(spectrum_window), setup->freq_step);
 	osc_plot_set_visible(OSC_PLOT(spectrum_window), true);
 }
 
@@ -375,7 +755,7 @@ static bool configure_data_capture(plugin_setup *setup)
 	struct iio_channel *chn;
 	struct extra_info *info;
 	struct extra_dev_info *dev_info;
-	unsigned int i;
+	unsigned int i, c = 0, s;
 
 	g_return_val_if_fail(setup, false);
 
@@ -409,9 +789,16 @@ static bool configure_data_capture(plugin_setup *setup)
 			g_free(info->data_ref);
 			info->data_ref = NULL;
 		}
-		if (i / 2 == setup->rx) {
+		if (i / 2 == setup->rx && c < SWEEP_CHANNELS) {
 			iio_channel_enable(chn);
 			info->data_ref = (gfloat *) g_new0(gfloat, setup->fft_size);
+			for (s = 0; s < SWEEP_SLOTS; s++) {
+				g_free(sweep_steps[s].data[c]);
+				sweep_steps[s].data[c] = g_new0(gfloat, setup->fft_size);
+				sweep_steps[s].chn[c] = chn;
+				sweep_steps[s].size = setup->fft_size;
+			}
+			c++;
 		} else {
 			iio_channel_disable(chn);
 		}
@@ -422,79 +809,61 @@ static bool configure_data_capture(plugin_setup *setup)
 
 static gpointer capture_data_thread_func(plugin_setup *setup)
 {
-	while (!kill_capture_thread) {
+	struct sweep_step *step;
+	unsigned int slot, c;
+	bool stale = false;
+	guint64 start;
+	ssize_t ret;
 
-		/* Clean iio buffer */
-		if (capture_buffer) {
-			iio_buffer_destroy(capture_buffer);
-			capture_buffer = NULL;
-		}
+	/* The buffer is kept for the whole sweep. With a single kernel block,
+	 * a refill only hands that block to the DMA, so the samples it returns
+	 * were all captured after the profile recalled before it. That only
+	 * holds for the local backend: the others queue or stream the block
+	 * again as soon as it is read, so the first refill after a recall may
+	 * straddle it and is thrown away. */
+	iio_device_set_kernel_buffers_count(cap, 1);
+	capture_buffer = iio_device_create_buffer(cap, setup->fft_size, false);
+	if (!capture_buffer)
+		fprintf(stderr, "Could not create iio buffer in %s\n", __func__);
 
-		/* Capture new data */
-		capture_buffer = iio_device_create_buffer(cap, setup->fft_size, false);
-		if (!capture_buffer) {
-			fprintf(stderr, "Could not create iio buffer in %s\n", __func__);
-			break;
-		}
-
-		/* Reset the data offset for all channels */
-		unsigned int i;
-		for (i = 0; i < iio_device_get_channels_count(cap); i++) {
-			struct iio_channel *ch = iio_device_get_channel(cap, i);
-			struct extra_info *info = iio_channel_get_data(ch);
-			info->offset = 0;
-		}
+	while (capture_buffer && !kill_capture_thread) {
 
 		/* Get captured data */
-		ssize_t ret = iio_buffer_refill(capture_buffer);
+		start = sweep_time_ns();
+		ret = stale ? iio_buffer_refill(capture_buffer) : 0;
+		if (ret >= 0)
+			ret = iio_buffer_refill(capture_buffer);
 		if (ret < 0) {
 			fprintf(stderr, "Error while refilling iio buffer: %s\n", strerror(-ret));
 			break;
 		}
+		sweep_stats_add(STAGE_REFILL, start);
 
-		/* Signal the "Frequency Sweep" thread that data capture has completed */
-		g_mutex_lock(&capture_done_mutex);
-		capture_done = true;
-		g_cond_signal(&capture_done_cond);
-		g_mutex_unlock(&capture_done_mutex);
-
-		/* Block until the "Do FFT" thread has finished doing a FFT*/
-		g_mutex_lock(&fft_done_mutex);
-		while (!fft_done)
-			g_cond_wait(&fft_done_cond, &fft_done_mutex);
-		fft_done = false;
-		g_mutex_unlock(&fft_done_mutex);
-		if (kill_capture_thread)
-			break;
+		/* Let the "Frequency Sweep" thread recall the next profile */
+		sweep_ring_push(&captured_ring, 0);
 
-		/* Demux captured data */
+		/* Demux captured data into a step slot the "Do FFT" thread is
+		 * done with, while the next profile gets applied */
+		if (!sweep_ring_pop(&free_ring, &slot, &kill_capture_thread))
+			break;
+		start = sweep_time_ns();
+		step = &sweep_steps[slot];
+		for (c = 0; c < SWEEP_CHANNELS; c++)
+			step->count[c] = 0;
 		ret /= iio_buffer_step(capture_buffer);
 		if ((unsigned)ret >= setup->fft_size)
-			iio_buffer_foreach_sample(capture_buffer, demux_sample, NULL);
-
-		/* Signal the "Do FFT" thread that data demux has completed */
-		g_mutex_lock(&demux_done_mutex);
-		demux_done = true;
-		g_cond_signal(&demux_done_cond);
-		g_mutex_unlock(&demux_done_mutex);
-
-		/* Block until the "Data Capture" thread has recalled a new profile */
-		g_mutex_lock(&profile_applied_mutex);
-		while (!profile_applied)
-			g_cond_wait(&profile_applied_cond, &profile_applied_mutex);
-		profile_applied = false;
-		g_mutex_unlock(&profile_applied_mutex);
-		if (kill_capture_thread)
+			iio_buffer_foreach_sample(capture_buffer, demux_sample, step);
+		sweep_stats_add(STAGE_DEMUX, start);
+		sweep_ring_push(&demuxed_ring, slot);
+
+		/* Block until the "Frequency Sweep" thread has recalled a new profile */
+		if (!sweep_ring_pop(&applied_ring, &slot, &kill_capture_thread))
 			break;
+		stale = !ctx_is_local;
 	}
 
-	/* Wake-up the "Frequency Sweep" thread and kill it */
-	kill_sweep_thread = true;
-	g_mutex_lock(&capture_done_mutex);
-	capture_done = true;
-	g_cond_signal(&capture_done_cond);
-	g_mutex_unlock(&capture_done_mutex);
-
+	/* Kill the "Frequency Sweep" thread */
+	__atomic_store_n(&kill_sweep_thread, true, __ATOMIC_RELAXED);
 	g_thread_join(freq_sweep_thread);
 
 	return NULL;
@@ -504,20 +873,15 @@ static gpointer profile_load_thread_func(plugin_setup *setup)
 {
 	GSList *node = g_slist_nth(setup->rx_profiles, 1);
 	fastlock_profile *profile;
+	unsigned int item;
+	guint64 start;
 	ssize_t ret;
 
-	while (!kill_sweep_thread) {
-
-		/* Block until the "Capture" thread has finished a data capture */
-		g_mutex_lock(&capture_done_mutex);
-		while (!capture_done)
-			g_cond_wait(&capture_done_cond, &capture_done_mutex);
-		capture_done = false;
-		g_mutex_unlock(&capture_done_mutex);
-		if (kill_sweep_thread)
-			break;
+	/* Wait until the "Capture" thread has finished a data capture */
+	while (sweep_ring_pop(&captured_ring, &item, &kill_sweep_thread)) {
 
 		/* Recall profile at slot 0 or 1 (alternative) */
+		start = sweep_time_ns();
 		ret = iio_channel_attr_write_longlong(alt_ch0,
 			"fastlock_recall", setup->profile_slot);
 		setup->profile_slot = (setup->profile_slot + 1) % 2;
@@ -528,22 +892,16 @@ static gpointer profile_load_thread_func(plugin_setup *setup)
 			"attribute in %s\n", __func__);
 
 		/* Signal the "Data Capture" thread that a new profile has been applied */
-		g_mutex_lock(&profile_applied_mutex);
-		profile_applied = true;
-		g_cond_signal(&profile_applied_cond);
-		g_mutex_unlock(&profile_applied_mutex);
+		sweep_ring_push(&applied_ring, 0);
+		sweep_stats_add(STAGE_RECALL, start);
 
 		/* Move to the next fastlock profile */
 		node = g_slist_next(node);
 		if (!node) {
 			node = setup->rx_profiles;
-			#if DEBUG
-			g_timer_stop(gtimer);
-			loop_durations_sum += g_timer_elapsed(gtimer, NULL);
-			loop_count++;
-			g_timer_start(gtimer);
-			#endif
+			__atomic_fetch_add(&sweep_stats.sweeps, 1, __ATOMIC_RELAXED);
 		}
+		start = sweep_time_ns();
 		profile = node->data;
 		profile->data[0] = '0' + setup->profile_slot;
 		ret = iio_channel_attr_write(alt_ch0, "fastlock_load",
@@ -551,15 +909,11 @@ static gpointer profile_load_thread_func(plugin_setup *setup)
 		if (ret < 0)
 			fprintf(stderr, "Could not write to fastlock_load"
 				"attribute in %s\n", __func__);
+		sweep_stats_add(STAGE_LOAD, start);
 	}
 
-	/* Wake-up and kill "Do FFT" thread */
-	kill_fft_thread = true;
-	g_mutex_lock(&demux_done_mutex);
-	demux_done = true;
-	g_cond_signal(&demux_done_cond);
-	g_mutex_unlock(&demux_done_mutex);
-
+	/* Kill "Do FFT" thread */
+	__atomic_store_n(&kill_fft_thread, true, __ATOMIC_RELAXED);
 	g_thread_join(fft_thread);
 
 	return NULL;
@@ -567,27 +921,32 @@ static gpointer profile_load_thread_func(plugin_setup *setup)
 
 static gpointer do_fft_thread_func(plugin_setup *setup)
 {
-	while (!kill_fft_thread) {
-
-		/* Block until the "Data Capture" thread finishes to demux data */
-		g_mutex_lock(&demux_done_mutex);
-		while (!demux_done)
-			g_cond_wait(&demux_done_cond, &demux_done_mutex);
-		demux_done = false;
-		g_mutex_unlock(&demux_done_mutex);
-		if (kill_fft_thread)
-			break;
+	struct sweep_step *step;
+	struct extra_info *info;
+	unsigned int slot, c;
+	guint64 start;
+
+	/* Wait for the "Data Capture" thread to demux a step */
+	while (sweep_ring_pop(&demuxed_ring, &slot, &kill_fft_thread)) {
+
+		/* The plot reads the samples from the channels, and only from
+		 * this thread: the slot can be reused once they are copied */
+		start = sweep_time_ns();
+		step = &sweep_steps[slot];
+		for (c = 0; c < SWEEP_CHANNELS; c++) {
+			if (!step->chn[c] || !step->count[c])
+				continue;
+			info = iio_channel_get_data(step->chn[c]);
+			memcpy(info->data_ref, step->data[c],
+					step->count[c] * sizeof(*step->data[c]));
+		}
+		sweep_ring_push(&free_ring, slot);
 
 		/* Tell the oscplot object to process the captured data, perform FFT
 		 * and concatenate with the rest of the FFTs in order to build the spectrum */
 		if (spectrum_window)
 			osc_plot_data_update(OSC_PLOT(spectrum_window));
-
-		/* Signal the "Data Capture" thread that the FFT has finished */
-		g_mutex_lock(&fft_done_mutex);
-		fft_done = true;
-		g_cond_signal(&fft_done_cond);
-		g_mutex_unlock(&fft_done_mutex);
+		sweep_stats_add(STAGE_FFT, start);
 	}
 
 	return NULL;
@@ -667,10 +1026,12 @@ static bool setup_before_sweep_start(plugin_setup *setup)
 	kill_sweep_thread = false;
 	kill_fft_thread = false;
 
-	capture_done = false;
-	profile_applied = false;
-	demux_done = false;
-	fft_done = true;
+	sweep_ring_reset(&captured_ring);
+	sweep_ring_reset(&applied_ring);
+	sweep_ring_reset(&demuxed_ring);
+	sweep_ring_reset(&free_ring);
+	for (i = 0; i < SWEEP_SLOTS; i++)
+		sweep_ring_push(&free_ring, i);
 
 	return true;
 
@@ -682,19 +1043,13 @@ static void start_sweep_clicked(GtkButton *btn, gpointer data)
 {
 	gtk_widget_set_sensitive(GTK_WIDGET(btn), false);
 
-#if DEBUG
-	gtimer = g_timer_new();
-	loop_durations_sum = 0;
-	loop_count = 0;
-#endif
-
 	/* This capture process and the capture process from osc.c are designed
 	 * to access the same iio devices but they do it from different threads,
 	 * thus should not run simultaneously. */
 	plugin_osc_stop_all_plots();
 
-	if (plugin_gather_user_setup(&psetup))
-		build_profiles_for_entire_sweep(&psetup);
+	plugin_gather_user_setup(&psetup);
+	build_profiles_for_entire_sweep(&psetup);
 	if (!configure_data_capture(&psetup))
 		goto abort;
 	if (!spectrum_window)
@@ -706,12 +1061,18 @@ static void start_sweep_clicked(GtkButton *btn, gpointer data)
 	if (!setup_before_sweep_start(&psetup))
 		goto abort;
 
-	capture_thread = g_thread_new("Data Capture",
-				(GThreadFunc)capture_data_thread_func, &psetup);
-	freq_sweep_thread = g_thread_new("Frequency Sweep",
-				(GThreadFunc)profile_load_thread_func, &psetup);
+	memset(&sweep_stats, 0, sizeof(sweep_stats));
+	sweep_stats_snapshot(&sweep_stats_start);
+	sweep_stats_last = sweep_stats_start;
+	sweep_stats_timer = g_timeout_add_seconds(1, sweep_stats_update, NULL);
+
+	/* Each thread joins the one started before it */
 	fft_thread = g_thread_new("Do FFT",
 				(GThreadFunc)do_fft_thread_func, &psetup);
+	freq_sweep_thread = g_thread_new("Frequency Sweep",
+				(GThreadFunc)profile_load_thread_func, &psetup);
+	capture_thread = g_thread_new("Data Capture",
+				(GThreadFunc)capture_data_thread_func, &psetup);
 
 	gtk_widget_set_sensitive(GTK_WIDGET(stop_button), true);
 
@@ -729,19 +1090,32 @@ static void stop_sweep_clicked(GtkButton *btn, gpointer data)
 	if (spectrum_window)
 		osc_plot_draw_stop(OSC_PLOT(spectrum_window));
 	if (capture_thread) {
-		kill_capture_thread = true;
+		__atomic_store_n(&kill_capture_thread, true, __ATOMIC_RELAXED);
 		g_thread_join(capture_thread);
 		capture_thread = NULL;
 	}
 	if (capture_buffer) {
 		iio_buffer_destroy(capture_buffer);
 		capture_buffer = NULL;
+		iio_device_set_kernel_buffers_count(cap,
+				IIO_DEFAULT_KERNEL_BUFFERS);
+	}
+
+	/* Leave the figures of the whole sweep in the panel */
+	if (sweep_stats_timer) {
+		g_source_remove(sweep_stats_timer);
+		sweep_stats_timer = 0;
+		sweep_stats_snapshot(&sweep_stats_last);
+		sweep_stats_show(&sweep_stats_start, &sweep_stats_last);
 	}
 
 	gtk_widget_set_sensitive(GTK_WIDGET(start_button), true);
-#if DEBUG
-fprintf(stderr, "Average Sweep Duration: %f\n", loop_durations_sum / loop_count);
-#endif
+}
+
+static void adaptive_rbw_toggled(GtkToggleButton *btn, gpointer data)
+{
+	gtk_widget_set_sensitive(GTK_WIDGET(data),
+			gtk_toggle_button_get_active(btn));
 }
 
 static void center_freq_changed(GtkSpinButton *btn, gpointer data)
@@ -778,6 +1152,37 @@ static int handle_external_request (const char *request)
 	return ret;
 }
 
+static int analyzer_handle_driver(const char *attrib, const char *value)
+{
+	GtkWidget *btn;
+
+	if (MATCH_ATTRIB("sweep")) {
+		btn = atoi(value) ? start_button : stop_button;
+		if (gtk_widget_is_sensitive(btn))
+			gtk_button_clicked(GTK_BUTTON(btn));
+	} else if (MATCH_ATTRIB("cycle")) {
+		osc_process_gtk_events(atoi(value));
+	} else if (MATCH_ATTRIB("save_sweep_stats")) {
+		return sweep_stats_save(value);
+	} else if (MATCH_ATTRIB("adaptive_rbw")) {
+		gtk_toggle_button_set_active(GTK_TOGGLE_BUTTON(adaptive_rbw),
+				!!atoi(value));
+	} else if (MATCH_ATTRIB("sweep_time")) {
+		gtk_spin_button_set_value(GTK_SPIN_BUTTON(sweep_time),
+				atof(value));
+	} else {
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+static int analyzer_handle(int line, const char *attrib, const char *value)
+{
+	return osc_plugin_default_handle(ctx, line, attrib, value,
+			analyzer_handle_driver);
+}
+
 static GtkWidget * analyzer_init(GtkWidget *notebook, const char *ini_fn)
 {
 	GtkBuilder *builder;
@@ -797,6 +1202,8 @@ static GtkWidget * analyzer_init(GtkWidget *notebook, const char *ini_fn)
 	if (!alt_ch0)
 		return NULL;
 
+	ctx_is_local = !strcmp(iio_context_get_name(ctx), "local");
+
 	ch1 = iio_device_find_channel(dev, "voltage1", false);
 	is_2rx_2tx = ch1 && iio_channel_find_attr(ch1, "hardwaregain");
 
@@ -826,12 +1233,18 @@ static GtkWidget * analyzer_init(GtkWidget *notebook, const char *ini_fn)
 				"spin_freq_bw"));
 	available_RBWs = GTK_WIDGET(gtk_builder_get_object(builder,
 				"cmb_available_rbw"));
+	adaptive_rbw = GTK_WIDGET(gtk_builder_get_object(builder,
+				"check_adaptive_rbw"));
+	sweep_time = GTK_WIDGET(gtk_builder_get_object(builder,
+				"spin_sweep_time"));
 	receiver1 = GTK_WIDGET(gtk_builder_get_object(builder,
 				"radiobutton_rx1"));
 	start_button = GTK_WIDGET(gtk_builder_get_object(builder,
 				"start_sweep_btn"));
 	stop_button = GTK_WIDGET(gtk_builder_get_object(builder,
 				"stop_sweep_btn"));
+	sweep_stats_label = GTK_WIDGET(gtk_builder_get_object(builder,
+				"label_sweep_stats"));
 
 	/* Widgets initialization */
 	gtk_spin_button_set_range(GTK_SPIN_BUTTON(center_freq),
@@ -858,6 +1271,8 @@ static GtkWidget * analyzer_init(GtkWidget *notebook, const char *ini_fn)
 			G_CALLBACK(center_freq_changed), NULL);
 	g_signal_connect_swapped(freq_bw, "value-changed",
 			G_CALLBACK(center_freq_changed), center_freq);
+	g_signal_connect(adaptive_rbw, "toggled",
+			G_CALLBACK(adaptive_rbw_toggled), sweep_time);
 
 	return analyzer_panel;
 }
@@ -878,9 +1293,13 @@ static void analyzer_get_preferred_size(int *width, int *height)
 
 static void context_destroy(const char *ini_fn)
 {
+	if (sweep_stats_timer)
+		g_source_remove(sweep_stats_timer);
 	if (capture_buffer) {
 		iio_buffer_destroy(capture_buffer);
 		capture_buffer = NULL;
+		iio_device_set_kernel_buffers_count(cap,
+				IIO_DEFAULT_KERNEL_BUFFERS);
 	}
 	g_source_remove_by_user_data(ctx);
 
@@ -901,6 +1320,7 @@ struct osc_plugin plugin = {
 	.name = THIS_DRIVER,
 	.identify = analyzer_identify,
 	.init = analyzer_init,
+	.handle_item = analyzer_handle,
 	.handle_external_request = handle_external_request,
 	.update_active_page = update_active_page,
 	.get_preferred_size = analyzer_get_preferred_size,
@@ -0,0 +1,87 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stddef.h>
+#include <math.h>
+
+#include "sample_ops.h"
+
+/*
+ * Every combination of operations gets its own kernel. The generic body below
+ * is always inlined with a constant set of flags, so the compiler removes the
+ * tests on the flags and is left with a straight, branch-free loop that it
+ * can vectorize. This file is built with VECTORIZE_CFLAGS (see Makefile);
+ * -fno-trapping-math is what allows the inverse to be if-converted.
+ */
+static inline __attribute__((always_inline)) void sample_ops_apply(
+		const float * __restrict in, float * __restrict out,
+		unsigned int count, const struct sample_op_params *params,
+		const unsigned int flags)
+{
+	const float mul = params->multiply_value;
+	const float add = params->add_value;
+	const float lo = params->clamp_min;
+	const float hi = params->clamp_max;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		float val = in[i];
+
+		if (flags & SAMPLE_OP_INVERSE)
+			val = (val != 0.0f) ? 1.0f / val : SAMPLE_OP_INVERSE_OF_ZERO;
+		if (flags & SAMPLE_OP_MULTIPLY)
+			val *= mul;
+		if (flags & SAMPLE_OP_ADD)
+			val += add;
+		if (flags & SAMPLE_OP_ABS)
+			val = fabsf(val);
+		if (flags & SAMPLE_OP_CLAMP) {
+			val = (val < lo) ? lo : val;
+			val = (val > hi) ? hi : val;
+		}
+		out[i] = val;
+	}
+}
+
+#define SAMPLE_OP_KERNEL(n) \
+static void sample_op_kernel_##n(const float *in, float *out, \
+		unsigned int count, const struct sample_op_params *params) \
+{ \
+	sample_ops_apply(in, out, count, params, n); \
+}
+
+#define SAMPLE_OP_KERNEL_8(n) \
+	SAMPLE_OP_KERNEL(n##0) SAMPLE_OP_KERNEL(n##1) \
+	SAMPLE_OP_KERNEL(n##2) SAMPLE_OP_KERNEL(n##3) \
+	SAMPLE_OP_KERNEL(n##4) SAMPLE_OP_KERNEL(n##5) \
+	SAMPLE_OP_KERNEL(n##6) SAMPLE_OP_KERNEL(n##7)
+
+/* Kernel names are octal literals, so that they can be pasted together */
+SAMPLE_OP_KERNEL_8(0)
+SAMPLE_OP_KERNEL_8(01)
+SAMPLE_OP_KERNEL_8(02)
+SAMPLE_OP_KERNEL_8(03)
+
+#define SAMPLE_OP_ENTRY_8(n) \
+	sample_op_kernel_##n##0, sample_op_kernel_##n##1, \
+	sample_op_kernel_##n##2, sample_op_kernel_##n##3, \
+	sample_op_kernel_##n##4, sample_op_kernel_##n##5, \
+	sample_op_kernel_##n##6, sample_op_kernel_##n##7
+
+static const sample_op_kernel sample_op_kernels[SAMPLE_OP_ALL + 1] = {
+	SAMPLE_OP_ENTRY_8(0),
+	SAMPLE_OP_ENTRY_8(01),
+	SAMPLE_OP_ENTRY_8(02),
+	SAMPLE_OP_ENTRY_8(03),
+};
+
+sample_op_kernel sample_op_kernel_get(unsigned int flags)
+{
+	if (!flags || (flags & ~SAMPLE_OP_ALL))
+		return NULL;
+
+	return sample_op_kernels[flags];
+}
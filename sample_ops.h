@@ -0,0 +1,41 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __SAMPLE_OPS_H__
+#define __SAMPLE_OPS_H__
+
+/* Element-wise operations that can be applied to a block of samples.
+ * The operations are always applied in the order in which they are listed.
+ */
+enum sample_op_flags {
+	SAMPLE_OP_INVERSE	= 1 << 0,
+	SAMPLE_OP_MULTIPLY	= 1 << 1,
+	SAMPLE_OP_ADD		= 1 << 2,
+	SAMPLE_OP_ABS		= 1 << 3,
+	SAMPLE_OP_CLAMP		= 1 << 4,
+	SAMPLE_OP_ALL		= (1 << 5) - 1,
+};
+
+/* Value returned by the inverse operation for a zero input sample */
+#define SAMPLE_OP_INVERSE_OF_ZERO 65535.0f
+
+struct sample_op_params {
+	float multiply_value;
+	float add_value;
+	float clamp_min;
+	float clamp_max;
+};
+
+typedef void (*sample_op_kernel)(const float *in, float *out,
+		unsigned int count, const struct sample_op_params *params);
+
+/* Returns the kernel that applies all operations in @flags in one pass, or
+ * NULL if @flags is 0 (nothing to do) or contains unknown operations.
+ */
+sample_op_kernel sample_op_kernel_get(unsigned int flags);
+
+#endif /* __SAMPLE_OPS_H__ */
@@ -0,0 +1,174 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdlib.h>
+#include <math.h>
+
+#include "tone_dft.h"
+
+struct tone_dft * tone_dft_new(unsigned int size, unsigned int count)
+{
+	struct tone_dft *dft;
+	unsigned int i;
+
+	if (size < 2 || !count)
+		return NULL;
+
+	dft = calloc(1, sizeof(*dft));
+	if (!dft)
+		return NULL;
+
+	dft->size = size;
+	dft->count = count;
+	dft->window = malloc(size * sizeof(*dft->window));
+	dft->bin = calloc(count, sizeof(*dft->bin));
+	dft->coeff = malloc(2 * count * sizeof(*dft->coeff));
+	dft->out = calloc(count, sizeof(*dft->out));
+	dft->s1 = malloc(2 * count * sizeof(*dft->s1));
+	dft->s2 = malloc(2 * count * sizeof(*dft->s2));
+	if (!dft->window || !dft->bin || !dft->coeff || !dft->out ||
+			!dft->s1 || !dft->s2) {
+		tone_dft_destroy(dft);
+		return NULL;
+	}
+
+	/* Same window as the FFT plot */
+	for (i = 0; i < size; i++) {
+		dft->window[i] = 0.5 * (1.0 - cos(2.0 * M_PI * i / (size - 1)));
+		dft->window_sum += dft->window[i];
+	}
+
+	for (i = 0; i < count; i++)
+		tone_dft_set_bin(dft, i, 0.0);
+
+	return dft;
+}
+
+void tone_dft_destroy(struct tone_dft *dft)
+{
+	if (!dft)
+		return;
+
+	free(dft->window);
+	free(dft->bin);
+	free(dft->coeff);
+	free(dft->out);
+	free(dft->s1);
+	free(dft->s2);
+	free(dft);
+}
+
+/* @bin is in units of size / sample rate; negative bins are the lower half
+ * of the spectrum of a complex input. */
+void tone_dft_set_bin(struct tone_dft *dft, unsigned int index, double bin)
+{
+	double coeff = 2.0 * cos(2.0 * M_PI * bin / dft->size);
+
+	if (index >= dft->count)
+		return;
+
+	dft->bin[index] = bin;
+	dft->coeff[index] = coeff;
+	dft->coeff[dft->count + index] = coeff;
+}
+
+void tone_dft_set_freq(struct tone_dft *dft, unsigned int index,
+		double freq, double sample_rate)
+{
+	tone_dft_set_bin(dft, index, freq * dft->size / sample_rate);
+}
+
+/*
+ * Runs the Goertzel filters of all bins over one block. The bins are the
+ * inner loop, so the filters advance side by side and the compiler can
+ * vectorize across them; each filter on its own is a serial recursion.
+ * The state is kept in double, as the recursion accumulates over the
+ * whole block.
+ */
+static void goertzel_run(const float *in, const double * __restrict window,
+		const double * __restrict coeff, double * __restrict s1,
+		double * __restrict s2, unsigned int count, unsigned int size)
+{
+	unsigned int n, k;
+
+	for (k = 0; k < count; k++) {
+		s1[k] = 0.0;
+		s2[k] = 0.0;
+	}
+
+	for (n = 0; n < size; n++) {
+		double x = in[n] * window[n];
+
+		for (k = 0; k < count; k++) {
+			double s0 = x + coeff[k] * s1[k] - s2[k];
+
+			s2[k] = s1[k];
+			s1[k] = s0;
+		}
+	}
+}
+
+/* Turn the final filter state into the DFT value referenced to the first
+ * sample of the block, which is what an FFT would return for that bin */
+static double complex goertzel_result(double s1, double s2, double w,
+		unsigned int size)
+{
+	double complex y = s1 - cexp(-I * w) * s2;
+
+	return y * cexp(-I * w * (size - 1));
+}
+
+/* @in_q may be NULL for a real input */
+void tone_dft_process(struct tone_dft *dft, const float *in_i,
+		const float *in_q)
+{
+	unsigned int k, count = dft->count;
+
+	goertzel_run(in_i, dft->window, dft->coeff, dft->s1, dft->s2,
+			count, dft->size);
+	if (in_q)
+		goertzel_run(in_q, dft->window, dft->coeff + count,
+				dft->s1 + count, dft->s2 + count,
+				count, dft->size);
+
+	for (k = 0; k < count; k++) {
+		double w = 2.0 * M_PI * dft->bin[k] / dft->size;
+
+		dft->out[k] = goertzel_result(dft->s1[k], dft->s2[k],
+				w, dft->size);
+		if (in_q)
+			dft->out[k] += I * goertzel_result(dft->s1[count + k],
+					dft->s2[count + k], w, dft->size);
+	}
+
+	dft->real_input = !in_q;
+}
+
+/* Peak amplitude of a tone sitting on the bin, in input units */
+double tone_dft_amplitude(const struct tone_dft *dft, unsigned int index)
+{
+	double amplitude;
+
+	if (index >= dft->count)
+		return 0.0;
+
+	amplitude = cabs(dft->out[index]) / dft->window_sum;
+
+	/* A real tone splits its power between the two sides */
+	if (dft->real_input)
+		amplitude *= 2.0;
+
+	return amplitude;
+}
+
+/* Phase in radians, relative to the first sample of the block */
+double tone_dft_phase(const struct tone_dft *dft, unsigned int index)
+{
+	if (index >= dft->count)
+		return 0.0;
+
+	return carg(dft->out[index]);
+}
@@ -0,0 +1,53 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __TONE_DFT_H__
+#define __TONE_DFT_H__
+
+#include <stdbool.h>
+#include <complex.h>
+
+/* Sparse DFT: evaluates a few bins of a Hann windowed block with the
+ * Goertzel algorithm, at O(size) cost per bin instead of the O(size log size)
+ * of a full FFT. The bins are the same ones the FFT plot shows, so results
+ * can be compared directly with the plot; fractional bins are allowed.
+ *
+ * Plugins can run it on the raw capture to measure specific tones, e.g.:
+ *	dft = tone_dft_new(size, 1);
+ *	tone_dft_set_freq(dft, 0, tone_freq, sample_rate);
+ *	tone_dft_process(dft, data[0], data[1]);
+ *	amplitude = tone_dft_amplitude(dft, 0);
+ */
+struct tone_dft {
+	unsigned int size;
+	unsigned int count;
+
+	double *window;
+	double window_sum;
+
+	/* Per bin: position, 2 * cos(w), and the result of the last block */
+	double *bin;
+	double *coeff;
+	double complex *out;
+	bool real_input;
+
+	/* Filter state: I lanes first, then Q lanes */
+	double *s1;
+	double *s2;
+};
+
+struct tone_dft * tone_dft_new(unsigned int size, unsigned int count);
+void tone_dft_destroy(struct tone_dft *dft);
+void tone_dft_set_bin(struct tone_dft *dft, unsigned int index, double bin);
+void tone_dft_set_freq(struct tone_dft *dft, unsigned int index,
+		double freq, double sample_rate);
+void tone_dft_process(struct tone_dft *dft, const float *in_i,
+		const float *in_q);
+double tone_dft_amplitude(const struct tone_dft *dft, unsigned int index);
+double tone_dft_phase(const struct tone_dft *dft, unsigned int index);
+
+#endif /* __TONE_DFT_H__ */
@@ -0,0 +1,201 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <string.h>
+
+#include "wave_pack.h"
+
+/*
+ * The generic bodies below are inlined with a constant number of channels
+ * (and row length), which lets the compiler unroll the interleave and
+ * vectorize the conversion. This file is built with VECTORIZE_CFLAGS (see
+ * Makefile). Values go through a float and are truncated, like the
+ * conversion they replace, but saturate instead of wrapping around.
+ */
+static inline __attribute__((always_inline)) uint16_t wave_pack_value(
+		double val, double lo, double hi)
+{
+	val = val < lo ? lo : val;
+	val = val > hi ? hi : val;
+
+	return (uint16_t)(int32_t)val;
+}
+
+/* Signed samples stay in +/- 32767, offset binary ones (offset 32768) in
+ * 1 to 65535 */
+static void wave_pack_range(double offset, double *lo, double *hi)
+{
+	*lo = offset - 32767.0 < -32767.0 ? -32767.0 : offset - 32767.0;
+	*hi = offset + 32767.0 > 65535.0 ? 65535.0 : offset + 32767.0;
+}
+
+/* Frames converted at a time: the columns are converted one by one, which
+ * vectorizes well, into a block small enough to stay in the cache while it
+ * is interleaved */
+#define WAVE_PACK_BLOCK 256
+
+/* Word c of a frame comes from column c % m: the columns fanned out to the
+ * other channels are only converted once */
+static inline __attribute__((always_inline)) void wave_pack_columns_n(
+		uint16_t * __restrict dst, const double *const *columns,
+		unsigned int count, double scale, double offset,
+		const unsigned int n, const unsigned int m)
+{
+	uint16_t block[8][WAVE_PACK_BLOCK];
+	double lo, hi;
+	unsigned int start, len, i, c;
+
+	wave_pack_range(offset, &lo, &hi);
+
+	for (start = 0; start < count; start += len) {
+		len = count - start < WAVE_PACK_BLOCK ?
+			count - start : WAVE_PACK_BLOCK;
+
+		for (c = 0; c < m; c++) {
+			const double * __restrict col = columns[c] + start;
+
+			for (i = 0; i < len; i++)
+				block[c][i] = wave_pack_value(
+						(float)col[i] * scale + offset,
+						lo, hi);
+		}
+
+		for (i = 0; i < len; i++)
+			for (c = 0; c < n; c++)
+				dst[i * n + c] = block[c % m][i];
+		dst += len * n;
+	}
+}
+
+static inline __attribute__((always_inline)) void wave_pack_rows_n(
+		uint16_t * __restrict dst, const float * __restrict rows,
+		unsigned int count, unsigned int repeat,
+		double scale, double offset, const unsigned int row_len,
+		const unsigned int n)
+{
+	uint16_t frame[8];
+	double lo, hi;
+	unsigned int i, c, r;
+
+	wave_pack_range(offset, &lo, &hi);
+
+	if (repeat == 1) {
+		for (i = 0; i < count; i++)
+			for (c = 0; c < n; c++)
+				dst[i * n + c] = wave_pack_value(
+						rows[i * row_len + c % row_len] *
+						scale + offset, lo, hi);
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		for (c = 0; c < n; c++)
+			frame[c] = wave_pack_value(rows[i * row_len + c % row_len] *
+					scale + offset, lo, hi);
+		for (r = 0; r < repeat; r++, dst += n)
+			memcpy(dst, frame, n * sizeof(*dst));
+	}
+}
+
+static void wave_pack_columns_generic(uint16_t *dst,
+		const double *const *columns, unsigned int num_channels,
+		unsigned int count, double scale, double offset)
+{
+	double lo, hi;
+	unsigned int i, c;
+
+	wave_pack_range(offset, &lo, &hi);
+	for (i = 0; i < count; i++)
+		for (c = 0; c < num_channels; c++)
+			*dst++ = wave_pack_value((float)columns[c][i] * scale +
+					offset, lo, hi);
+}
+
+void wave_pack_columns(uint16_t *dst, const double *const *columns,
+		unsigned int num_channels, unsigned int count,
+		double scale, double offset)
+{
+	unsigned int m, c;
+
+	/* The shortest period of the columns, e.g. 4 for one pair of TX
+	 * replicated to 8 channels */
+	for (m = 1; m < num_channels; m *= 2) {
+		for (c = m; c < num_channels; c++)
+			if (columns[c] != columns[c % m])
+				break;
+		if (c == num_channels)
+			break;
+	}
+
+	switch (num_channels * 16 + m) {
+	case 0x11:
+		wave_pack_columns_n(dst, columns, count, scale, offset, 1, 1);
+		break;
+	case 0x22:
+		wave_pack_columns_n(dst, columns, count, scale, offset, 2, 2);
+		break;
+	case 0x42:
+		wave_pack_columns_n(dst, columns, count, scale, offset, 4, 2);
+		break;
+	case 0x44:
+		wave_pack_columns_n(dst, columns, count, scale, offset, 4, 4);
+		break;
+	case 0x82:
+		wave_pack_columns_n(dst, columns, count, scale, offset, 8, 2);
+		break;
+	case 0x84:
+		wave_pack_columns_n(dst, columns, count, scale, offset, 8, 4);
+		break;
+	case 0x88:
+		wave_pack_columns_n(dst, columns, count, scale, offset, 8, 8);
+		break;
+	default:
+		wave_pack_columns_generic(dst, columns, num_channels, count,
+				scale, offset);
+		break;
+	}
+}
+
+void wave_pack_rows(uint16_t *dst, const float *rows, unsigned int row_len,
+		unsigned int num_channels, unsigned int count,
+		unsigned int repeat, double scale, double offset)
+{
+	double lo, hi;
+	unsigned int i, c, r;
+
+	/* The layouts of the text waveforms */
+	if (row_len == 4) {
+		switch (num_channels) {
+		case 1:
+			wave_pack_rows_n(dst, rows, count, repeat,
+					scale, offset, 4, 1);
+			return;
+		case 2:
+			wave_pack_rows_n(dst, rows, count, repeat,
+					scale, offset, 4, 2);
+			return;
+		case 4:
+			wave_pack_rows_n(dst, rows, count, repeat,
+					scale, offset, 4, 4);
+			return;
+		case 8:
+			wave_pack_rows_n(dst, rows, count, repeat,
+					scale, offset, 4, 8);
+			return;
+		}
+	}
+
+	wave_pack_range(offset, &lo, &hi);
+	for (i = 0; i < count; i++) {
+		for (c = 0; c < num_channels; c++)
+			dst[c] = wave_pack_value(rows[i * row_len + c % row_len] *
+					scale + offset, lo, hi);
+		for (r = 1; r < repeat; r++)
+			memcpy(dst + r * num_channels, dst,
+					num_channels * sizeof(*dst));
+		dst += repeat * num_channels;
+	}
+}
@@ -0,0 +1,30 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __WAVE_PACK_H__
+#define __WAVE_PACK_H__
+
+#include <stdint.h>
+
+/* Conversion of waveforms to the words a DAC buffer holds. Every value is
+ * scaled, offset, saturated to the 16 bits around the offset and stored
+ * with the other channels of its frame, one word per channel.
+ */
+
+/* @dst gets @count frames of @num_channels words; word c of frame i is
+ * columns[c][i]. A column can be given for several channels. */
+void wave_pack_columns(uint16_t *dst, const double *const *columns,
+		unsigned int num_channels, unsigned int count,
+		double scale, double offset);
+
+/* @rows holds @count rows of @row_len values; word c of a frame is value
+ * c % row_len of its row. Each frame is stored @repeat times. */
+void wave_pack_rows(uint16_t *dst, const float *rows, unsigned int row_len,
+		unsigned int num_channels, unsigned int count,
+		unsigned int repeat, double scale, double offset);
+
+#endif /* __WAVE_PACK_H__ */
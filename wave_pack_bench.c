@@ -0,0 +1,165 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+/* Microbenchmark of the waveform packing kernels: "make wave_pack_bench",
+ * then run it with the number of frames (default 4M). Each layout is timed
+ * against the per-sample conversion it replaced, and their outputs are
+ * compared. */
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "wave_pack.h"
+
+#define BENCH_RUNS 5
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned short convert(double scale, float val, double offset)
+{
+	return (short) (val * scale + offset);
+}
+
+/* What analyse_wavefile() did for MAT files */
+static void reference_columns(uint16_t *dst, const double *const *columns,
+		unsigned int num_channels, unsigned int count,
+		double scale, double offset)
+{
+	unsigned int i, c;
+
+	for (i = 0; i < count; i++)
+		for (c = 0; c < num_channels; c++)
+			*dst++ = convert(scale, columns[c][i], offset);
+}
+
+/* What analyse_wavefile() did for text files */
+static void reference_rows(uint16_t *dst, const float *rows,
+		unsigned int row_len, unsigned int num_channels,
+		unsigned int count, unsigned int repeat,
+		double scale, double offset)
+{
+	unsigned int i, c, r;
+
+	for (i = 0; i < count; i++)
+		for (r = 0; r < repeat; r++)
+			for (c = 0; c < num_channels; c++)
+				*dst++ = convert(scale,
+						rows[i * row_len + c % row_len],
+						offset);
+}
+
+static void report(const char *name, unsigned int channels,
+		unsigned int repeat, size_t bytes, double t_ref, double t_new,
+		bool same)
+{
+	printf("%-8s %u ch x%-3u %8.1f MB/s %8.1f MB/s  %5.1fx  %s\n",
+			name, channels, repeat, bytes / t_ref / 1e6,
+			bytes / t_new / 1e6, t_ref / t_new,
+			same ? "ok" : "MISMATCH");
+}
+
+int main(int argc, char **argv)
+{
+	static const unsigned int layouts[] = { 1, 2, 4, 8 };
+	static const unsigned int repeats[] = { 1, 8 };
+	unsigned int frames = argc > 1 ? strtoul(argv[1], NULL, 0) : 4 << 20;
+	const double scale = 32752.0, offset = 0.0;
+	double *data[8], best_ref, best_new, t;
+	const double *columns[8];
+	float *rows;
+	uint16_t *ref, *out;
+	unsigned int i, l, r, run;
+	int ret = EXIT_SUCCESS;
+	size_t bytes;
+
+	/* The largest output: 8 channels, repeated */
+	ref = malloc((size_t)frames * 8 * 8 * sizeof(*ref));
+	out = malloc((size_t)frames * 8 * 8 * sizeof(*out));
+	rows = malloc((size_t)frames * 4 * sizeof(*rows));
+	for (i = 0; i < 8; i++) {
+		data[i] = malloc(frames * sizeof(**data));
+		if (!data[i])
+			ref = NULL;
+	}
+	if (!ref || !out || !rows) {
+		fprintf(stderr, "Out of memory\n");
+		return EXIT_FAILURE;
+	}
+
+	srand(1);
+	for (i = 0; i < frames; i++) {
+		for (l = 0; l < 8; l++)
+			data[l][i] = 2.0 * rand() / RAND_MAX - 1.0;
+		for (l = 0; l < 4; l++)
+			rows[i * 4 + l] = data[l][i];
+	}
+
+	printf("layout   channels     reference       kernel  speedup\n");
+
+	for (l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+		/* The MAT layout: I and Q of each TX, fanned out to 8 */
+		for (i = 0; i < layouts[l]; i++)
+			columns[i] = data[i % 4];
+
+		bytes = (size_t)frames * layouts[l] * sizeof(*out);
+		best_ref = best_new = 1e9;
+		for (run = 0; run < BENCH_RUNS; run++) {
+			t = now();
+			reference_columns(ref, columns, layouts[l], frames,
+					scale, offset);
+			best_ref = MIN(best_ref, now() - t);
+			t = now();
+			wave_pack_columns(out, columns, layouts[l], frames,
+					scale, offset);
+			best_new = MIN(best_new, now() - t);
+		}
+		if (memcmp(ref, out, bytes))
+			ret = EXIT_FAILURE;
+		report("columns", layouts[l], 1, bytes, best_ref, best_new,
+				!memcmp(ref, out, bytes));
+	}
+
+	for (l = 0; l < sizeof(layouts) / sizeof(layouts[0]); l++) {
+		for (r = 0; r < sizeof(repeats) / sizeof(repeats[0]); r++) {
+			bytes = (size_t)frames * layouts[l] * repeats[r] *
+				sizeof(*out);
+			best_ref = best_new = 1e9;
+			for (run = 0; run < BENCH_RUNS; run++) {
+				t = now();
+				reference_rows(ref, rows, 4, layouts[l], frames,
+						repeats[r], scale, offset);
+				best_ref = MIN(best_ref, now() - t);
+				t = now();
+				wave_pack_rows(out, rows, 4, layouts[l], frames,
+						repeats[r], scale, offset);
+				best_new = MIN(best_new, now() - t);
+			}
+			if (memcmp(ref, out, bytes))
+				ret = EXIT_FAILURE;
+			report("rows", layouts[l], repeats[r], bytes,
+					best_ref, best_new, !memcmp(ref, out, bytes));
+		}
+	}
+
+	for (i = 0; i < 8; i++)
+		free(data[i]);
+	free(rows);
+	free(out);
+	free(ref);
+
+	return ret;
+}
@@ -0,0 +1,509 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <glib.h>
+
+#include "wave_synth.h"
+
+#define WAVE_SYNTH_DEFAULT_LENGTH 65536
+#define WAVE_SYNTH_MAX_LENGTH (1 << 26)
+#define WAVE_SYNTH_MAX_SPS 64
+#define WAVE_SYNTH_MAX_SPAN 64
+
+struct wave_synth {
+	struct wave_synth_params params;
+	unsigned int length;
+
+	/* Tones: each one is the NCO of a bin of the period. Per block, its
+	 * phase is computed exactly, then rotated along the block by a table
+	 * of the rotations within a block. */
+	unsigned int num_tones;
+	unsigned long long *bins;
+	double *phases;
+	double *rot_i, *rot_q;		/* num_tones * WAVE_SYNTH_BLOCK */
+
+	/* QAM: the symbols of the period, extended at both ends with those
+	 * the filter reaches across the loop, and the filter taps, taps[t][p]
+	 * weighting symbol m + t - half_span for phase p of symbol m */
+	unsigned int num_symbols;
+	unsigned int half_span;
+	double *sym_i, *sym_q;
+	double *taps;
+};
+
+void wave_synth_params_init(struct wave_synth_params *params)
+{
+	memset(params, 0, sizeof(*params));
+	params->type = WAVE_SYNTH_TONES;
+	params->num_tones = 1;
+	params->start = 1e6;
+	params->step = 1e6;
+	params->stop = 10e6;
+	params->newman = true;
+	params->order = 4;
+	params->sps = 4;
+	params->rolloff = 0.35;
+	params->span = 16;
+	params->prbs = 9;
+}
+
+static int parse_uint(const char *value, unsigned int *result)
+{
+	char *end;
+	unsigned long val = strtoul(value, &end, 0);
+
+	if (end == value || *end || val > G_MAXUINT)
+		return -EINVAL;
+	*result = val;
+	return 0;
+}
+
+static int parse_double(const char *value, double *result)
+{
+	char *end;
+	double val = g_ascii_strtod(value, &end);
+
+	if (end == value || *end)
+		return -EINVAL;
+	*result = val;
+	return 0;
+}
+
+int wave_synth_params_parse(struct wave_synth_params *params,
+		const char *spec)
+{
+	gchar **tokens, **tok;
+	int ret = 0;
+
+	tokens = g_strsplit_set(spec, " \t", -1);
+	for (tok = tokens; *tok && !**tok; tok++);
+
+	if (!*tok) {
+		ret = -EINVAL;
+	} else if (!strcmp(*tok, "tones")) {
+		params->type = WAVE_SYNTH_TONES;
+	} else if (!strcmp(*tok, "chirp")) {
+		params->type = WAVE_SYNTH_CHIRP;
+	} else if (!strcmp(*tok, "qam")) {
+		params->type = WAVE_SYNTH_QAM;
+	} else if (!strcmp(*tok, "qpsk")) {
+		params->type = WAVE_SYNTH_QAM;
+		params->order = 4;
+	} else {
+		ret = -EINVAL;
+	}
+
+	for (tok = *tok ? tok + 1 : tok; !ret && *tok; tok++) {
+		char *key = *tok, *value = strchr(key, '=');
+
+		if (!*key)
+			continue;
+		if (!value) {
+			ret = -EINVAL;
+			break;
+		}
+		*value++ = '\0';
+
+		if (!strcmp(key, "rate"))
+			ret = parse_double(value, &params->sample_rate);
+		else if (!strcmp(key, "length"))
+			ret = parse_uint(value, &params->length);
+		else if (!strcmp(key, "level"))
+			ret = parse_double(value, &params->level);
+		else if (!strcmp(key, "count"))
+			ret = parse_uint(value, &params->num_tones);
+		else if (!strcmp(key, "start"))
+			ret = parse_double(value, &params->start);
+		else if (!strcmp(key, "step"))
+			ret = parse_double(value, &params->step);
+		else if (!strcmp(key, "stop"))
+			ret = parse_double(value, &params->stop);
+		else if (!strcmp(key, "phase") && !strcmp(value, "newman"))
+			params->newman = true;
+		else if (!strcmp(key, "phase") && !strcmp(value, "zero"))
+			params->newman = false;
+		else if (!strcmp(key, "sweep") && !strcmp(value, "linear"))
+			params->log = false;
+		else if (!strcmp(key, "sweep") && !strcmp(value, "log"))
+			params->log = true;
+		else if (!strcmp(key, "order"))
+			ret = parse_uint(value, &params->order);
+		else if (!strcmp(key, "sps"))
+			ret = parse_uint(value, &params->sps);
+		else if (!strcmp(key, "rolloff"))
+			ret = parse_double(value, &params->rolloff);
+		else if (!strcmp(key, "span"))
+			ret = parse_uint(value, &params->span);
+		else if (!strcmp(key, "prbs"))
+			ret = parse_uint(value, &params->prbs);
+		else if (!strcmp(key, "symbols"))
+			ret = parse_uint(value, &params->num_symbols);
+		else
+			ret = -EINVAL;
+	}
+
+	g_strfreev(tokens);
+	return ret;
+}
+
+static int wave_synth_tones_init(struct wave_synth *synth)
+{
+	const struct wave_synth_params *p = &synth->params;
+	long long start_bin, step_bins;
+	unsigned int k, n;
+
+	if (!p->num_tones || p->num_tones > WAVE_SYNTH_MAX_TONES ||
+			p->sample_rate <= 0.0)
+		return -EINVAL;
+
+	synth->length = p->length ? p->length : WAVE_SYNTH_DEFAULT_LENGTH;
+	synth->num_tones = p->num_tones;
+
+	/* The spacing is rounded once so that the tones stay evenly spaced,
+	 * which the Newman phases rely on */
+	start_bin = llround(p->start * synth->length / p->sample_rate);
+	step_bins = llround(p->step * synth->length / p->sample_rate);
+	if (p->num_tones > 1 && !step_bins)
+		return -EINVAL;
+
+	synth->bins = g_new(unsigned long long, p->num_tones);
+	synth->phases = g_new(double, p->num_tones);
+	synth->rot_i = g_try_new(double, p->num_tones * WAVE_SYNTH_BLOCK);
+	synth->rot_q = g_try_new(double, p->num_tones * WAVE_SYNTH_BLOCK);
+	if (!synth->rot_i || !synth->rot_q)
+		return -ENOMEM;
+
+	for (k = 0; k < p->num_tones; k++) {
+		long long bin = start_bin + k * step_bins;
+		double *rot_i = synth->rot_i + k * WAVE_SYNTH_BLOCK;
+		double *rot_q = synth->rot_q + k * WAVE_SYNTH_BLOCK;
+
+		/* Negative frequencies are the bins from the top */
+		bin %= (long long)synth->length;
+		if (bin < 0)
+			bin += synth->length;
+		synth->bins[k] = bin;
+
+		/* Newman's phases: quadratic in the index of the tone */
+		synth->phases[k] = p->newman ?
+			M_PI * k * k / p->num_tones : 0.0;
+
+		for (n = 0; n < WAVE_SYNTH_BLOCK; n++) {
+			double phase = 2.0 * M_PI *
+				(double)((bin * n) % synth->length) / synth->length;
+
+			rot_i[n] = cos(phase);
+			rot_q[n] = sin(phase);
+		}
+	}
+
+	return 0;
+}
+
+static void wave_synth_tones(struct wave_synth *synth, unsigned int start,
+		unsigned int count, double * __restrict out_i,
+		double * __restrict out_q)
+{
+	unsigned int k, n;
+
+	memset(out_i, 0, count * sizeof(*out_i));
+	memset(out_q, 0, count * sizeof(*out_q));
+
+	for (k = 0; k < synth->num_tones; k++) {
+		const double * __restrict rot_i =
+			synth->rot_i + k * WAVE_SYNTH_BLOCK;
+		const double * __restrict rot_q =
+			synth->rot_q + k * WAVE_SYNTH_BLOCK;
+		double phase = synth->phases[k] + 2.0 * M_PI *
+			(double)((synth->bins[k] * start) % synth->length) /
+			synth->length;
+		double ph_i = cos(phase), ph_q = sin(phase);
+
+		for (n = 0; n < count; n++) {
+			out_i[n] += ph_i * rot_i[n] - ph_q * rot_q[n];
+			out_q[n] += ph_i * rot_q[n] + ph_q * rot_i[n];
+		}
+	}
+}
+
+static int wave_synth_chirp_init(struct wave_synth *synth)
+{
+	const struct wave_synth_params *p = &synth->params;
+
+	if (p->sample_rate <= 0.0)
+		return -EINVAL;
+	if (p->log && (p->start == 0.0 || p->stop / p->start <= 0.0))
+		return -EINVAL;
+
+	synth->length = p->length ? p->length : WAVE_SYNTH_DEFAULT_LENGTH;
+	return 0;
+}
+
+static void wave_synth_chirp(struct wave_synth *synth, unsigned int start,
+		unsigned int count, double *out_i, double *out_q)
+{
+	const struct wave_synth_params *p = &synth->params;
+	double period = synth->length / p->sample_rate;
+	double ratio = p->stop / p->start;
+	bool sweep_log = p->log && ratio != 1.0;
+	double t, phase;
+	unsigned int n;
+
+	for (n = 0; n < count; n++) {
+		t = (start + n) / p->sample_rate;
+		if (sweep_log)
+			phase = p->start * period / log(ratio) *
+				(pow(ratio, t / period) - 1.0);
+		else
+			phase = p->start * t +
+				(p->stop - p->start) * t * t / (2.0 * period);
+		phase = 2.0 * M_PI * (phase - floor(phase));
+
+		out_i[n] = cos(phase);
+		out_q[n] = sin(phase);
+	}
+}
+
+/* Root raised cosine, @t in symbols */
+static double rrc(double t, double beta)
+{
+	double x;
+
+	if (fabs(t) < 1e-9)
+		return 1.0 - beta + 4.0 * beta / M_PI;
+	if (beta > 0.0 && fabs(fabs(t) - 0.25 / beta) < 1e-9)
+		return beta / M_SQRT2 * ((1.0 + 2.0 / M_PI) * sin(M_PI / 4.0 / beta) +
+				(1.0 - 2.0 / M_PI) * cos(M_PI / 4.0 / beta));
+
+	x = 4.0 * beta * t;
+	return (sin(M_PI * t * (1.0 - beta)) +
+			x * cos(M_PI * t * (1.0 + beta))) /
+		(M_PI * t * (1.0 - x * x));
+}
+
+/* Fibonacci LFSR of the usual PRBS polynomials, x^n + x^tap + 1 */
+static int prbs_tap(unsigned int n)
+{
+	switch (n) {
+	case 7:
+		return 6;
+	case 9:
+		return 5;
+	case 15:
+		return 14;
+	case 23:
+		return 18;
+	case 31:
+		return 28;
+	default:
+		return -EINVAL;
+	}
+}
+
+static unsigned int prbs_bits(unsigned int *state, unsigned int n,
+		unsigned int tap, unsigned int count)
+{
+	unsigned int i, bit, bits = 0;
+
+	for (i = 0; i < count; i++) {
+		bit = ((*state >> (n - 1)) ^ (*state >> (tap - 1))) & 1;
+		*state = ((*state << 1) | bit) & ((1u << (n - 1) << 1) - 1);
+		bits = (bits << 1) | bit;
+	}
+
+	return bits;
+}
+
+/* Level of a Gray coded index on an axis of @levels points */
+static double qam_level(unsigned int gray, unsigned int levels)
+{
+	unsigned int shift, index = gray;
+
+	for (shift = 1; shift < 32; shift <<= 1)
+		index ^= index >> shift;
+
+	return 2.0 * index - (levels - 1);
+}
+
+static int wave_synth_qam_init(struct wave_synth *synth)
+{
+	const struct wave_synth_params *p = &synth->params;
+	unsigned int bits, levels, half, state, s, t, i, num;
+	int tap = prbs_tap(p->prbs);
+
+	for (bits = 2; bits <= 8 && (1u << bits) != p->order; bits += 2);
+	if (bits > 8 || tap < 0 || p->sps < 1 || p->sps > WAVE_SYNTH_MAX_SPS ||
+			p->span < 2 || p->span > WAVE_SYNTH_MAX_SPAN ||
+			p->rolloff < 0.0 || p->rolloff > 1.0)
+		return -EINVAL;
+
+	/* By default, one period of the shorter sequences */
+	num = p->num_symbols ? p->num_symbols :
+		(1u << MIN(p->prbs, 12)) - 1;
+	if (num > WAVE_SYNTH_MAX_LENGTH / p->sps)
+		return -EINVAL;
+
+	levels = 1 << (bits / 2);
+	half = p->span / 2 + 1;
+	synth->num_symbols = num;
+	synth->half_span = half;
+	synth->length = num * p->sps;
+	synth->sym_i = g_try_new(double, num + 2 * half);
+	synth->sym_q = g_try_new(double, num + 2 * half);
+	synth->taps = g_new0(double, (2 * half + 1) * p->sps);
+	if (!synth->sym_i || !synth->sym_q)
+		return -ENOMEM;
+
+	state = (1u << (p->prbs - 1) << 1) - 1;
+	for (s = 0; s < num; s++) {
+		synth->sym_i[half + s] = qam_level(prbs_bits(&state, p->prbs,
+					tap, bits / 2), levels);
+		synth->sym_q[half + s] = qam_level(prbs_bits(&state, p->prbs,
+					tap, bits / 2), levels);
+	}
+
+	/* The period loops: the ends see the symbols of the other end */
+	for (s = 0; s < half; s++) {
+		synth->sym_i[s] = synth->sym_i[half + (num - half % num + s) % num];
+		synth->sym_q[s] = synth->sym_q[half + (num - half % num + s) % num];
+		synth->sym_i[half + num + s] = synth->sym_i[half + s % num];
+		synth->sym_q[half + num + s] = synth->sym_q[half + s % num];
+	}
+
+	for (t = 0; t <= 2 * half; t++) {
+		for (i = 0; i < p->sps; i++) {
+			int d = (int)i + ((int)half - (int)t) * (int)p->sps;
+
+			if ((unsigned int)abs(d) * 2 <= p->span * p->sps)
+				synth->taps[t * p->sps + i] =
+					rrc((double)d / p->sps, p->rolloff);
+		}
+	}
+
+	return 0;
+}
+
+static void wave_synth_qam(struct wave_synth *synth, unsigned int start,
+		unsigned int count, double *out_i, double *out_q)
+{
+	const unsigned int sps = synth->params.sps;
+	double frame_i[WAVE_SYNTH_MAX_SPS], frame_q[WAVE_SYNTH_MAX_SPS];
+	unsigned int m, t, i, first, last, n = 0;
+
+	for (m = start / sps; n < count; m++) {
+		for (i = 0; i < sps; i++)
+			frame_i[i] = frame_q[i] = 0.0;
+
+		for (t = 0; t <= 2 * synth->half_span; t++) {
+			const double * __restrict taps = synth->taps + t * sps;
+			double sym_i = synth->sym_i[m + t];
+			double sym_q = synth->sym_q[m + t];
+
+			for (i = 0; i < sps; i++) {
+				frame_i[i] += sym_i * taps[i];
+				frame_q[i] += sym_q * taps[i];
+			}
+		}
+
+		first = m == start / sps ? start % sps : 0;
+		last = MIN(sps, first + count - n);
+		for (i = first; i < last; i++, n++) {
+			out_i[n] = frame_i[i];
+			out_q[n] = frame_q[i];
+		}
+	}
+}
+
+void wave_synth_free(struct wave_synth *synth)
+{
+	if (!synth)
+		return;
+
+	g_free(synth->bins);
+	g_free(synth->phases);
+	g_free(synth->rot_i);
+	g_free(synth->rot_q);
+	g_free(synth->sym_i);
+	g_free(synth->sym_q);
+	g_free(synth->taps);
+	g_free(synth);
+}
+
+struct wave_synth * wave_synth_new(const struct wave_synth_params *params)
+{
+	struct wave_synth *synth;
+	int ret;
+
+	synth = g_new0(struct wave_synth, 1);
+	synth->params = *params;
+
+	switch (params->type) {
+	case WAVE_SYNTH_TONES:
+		ret = wave_synth_tones_init(synth);
+		break;
+	case WAVE_SYNTH_CHIRP:
+		ret = wave_synth_chirp_init(synth);
+		break;
+	case WAVE_SYNTH_QAM:
+		ret = wave_synth_qam_init(synth);
+		break;
+	default:
+		ret = -EINVAL;
+		break;
+	}
+
+	if (!ret && (!synth->length || synth->length > WAVE_SYNTH_MAX_LENGTH))
+		ret = -EINVAL;
+	if (ret) {
+		wave_synth_free(synth);
+		errno = -ret;
+		return NULL;
+	}
+
+	return synth;
+}
+
+unsigned int wave_synth_length(const struct wave_synth *synth)
+{
+	return synth->length;
+}
+
+void wave_synth_generate(struct wave_synth *synth, unsigned int start,
+		unsigned int count, double *i, double *q)
+{
+	switch (synth->params.type) {
+	case WAVE_SYNTH_TONES:
+		wave_synth_tones(synth, start, count, i, q);
+		break;
+	case WAVE_SYNTH_CHIRP:
+		wave_synth_chirp(synth, start, count, i, q);
+		break;
+	case WAVE_SYNTH_QAM:
+		wave_synth_qam(synth, start, count, i, q);
+		break;
+	}
+}
+
+double wave_synth_peak(struct wave_synth *synth)
+{
+	double i[WAVE_SYNTH_BLOCK], q[WAVE_SYNTH_BLOCK], peak = 0.0;
+	unsigned int start, count, n;
+
+	for (start = 0; start < synth->length; start += count) {
+		count = MIN(synth->length - start, WAVE_SYNTH_BLOCK);
+		wave_synth_generate(synth, start, count, i, q);
+		for (n = 0; n < count; n++) {
+			peak = MAX(peak, fabs(i[n]));
+			peak = MAX(peak, fabs(q[n]));
+		}
+	}
+
+	return peak;
+}
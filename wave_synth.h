@@ -0,0 +1,81 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __WAVE_SYNTH_H__
+#define __WAVE_SYNTH_H__
+
+#include <stdbool.h>
+
+/* Synthesis of test waveforms as complex baseband I/Q. A waveform is one
+ * period of the signal, generated in blocks, so that it can fill a cyclic
+ * DAC buffer without being held in memory in full.
+ *
+ * A waveform is described by a line of text: its type, then "key=value"
+ * settings, e.g. "tones count=16 start=1e6 step=250e3". Keys of all types:
+ * rate (sample rate, Hz), length (frames), level (dBFS of the peak).
+ *   tones: count, start, step (Hz), phase=newman|zero; start and step are
+ *          moved to the nearest frequencies that loop without a seam, so
+ *          the tones stay evenly spaced. Newman phases keep the crest
+ *          factor of many tones low.
+ *   chirp: start, stop (Hz), sweep=linear|log
+ *   qam:   order (4 for QPSK, 16, 64, 256), sps (samples per symbol),
+ *          rolloff, span (symbols) of the root raised cosine filter,
+ *          prbs (7, 9, 15, 23 or 31) driving the bits, symbols
+ */
+enum wave_synth_type {
+	WAVE_SYNTH_TONES,
+	WAVE_SYNTH_CHIRP,
+	WAVE_SYNTH_QAM,
+};
+
+struct wave_synth_params {
+	enum wave_synth_type type;
+	double sample_rate;		/* Hz, 0 if not given */
+	unsigned int length;		/* frames, 0 for the default */
+	double level;			/* dBFS */
+
+	unsigned int num_tones;
+	double start, step, stop;	/* Hz */
+	bool newman;
+	bool log;
+
+	unsigned int order;
+	unsigned int sps;
+	double rolloff;
+	unsigned int span;
+	unsigned int prbs;
+	unsigned int num_symbols;
+};
+
+#define WAVE_SYNTH_MAX_TONES 4096
+
+struct wave_synth;
+
+void wave_synth_params_init(struct wave_synth_params *params);
+
+/* Returns 0, or -EINVAL for an invalid description. Settings left out of
+ * @spec keep their value in @params. */
+int wave_synth_params_parse(struct wave_synth_params *params,
+		const char *spec);
+
+/* NULL if the parameters are invalid, with errno set */
+struct wave_synth * wave_synth_new(const struct wave_synth_params *params);
+void wave_synth_free(struct wave_synth *synth);
+
+/* Frames in one period */
+unsigned int wave_synth_length(const struct wave_synth *synth);
+
+/* Frames [start, start + count) of the period; count is at most
+ * WAVE_SYNTH_BLOCK */
+#define WAVE_SYNTH_BLOCK 1024
+void wave_synth_generate(struct wave_synth *synth, unsigned int start,
+		unsigned int count, double *i, double *q);
+
+/* Largest magnitude of I or Q over the period */
+double wave_synth_peak(struct wave_synth *synth);
+
+#endif /* __WAVE_SYNTH_H__ */
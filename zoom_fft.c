@@ -0,0 +1,211 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+#include <stdlib.h>
+#include <math.h>
+
+#include "zoom_fft.h"
+
+/* Filter length, per output sample of the decimator: enough for the
+ * transition band to fit between the cutoff and the first image */
+#define ZOOM_TAPS_PER_PHASE 24
+
+/* Cutoff, relative to the decimated sample rate */
+#define ZOOM_CUTOFF 0.4
+
+static unsigned int zoom_fft_num_taps(unsigned int decimation)
+{
+	return decimation * ZOOM_TAPS_PER_PHASE + 1;
+}
+
+/* Number of input samples needed to produce @out_count decimated samples */
+unsigned int zoom_fft_input_count(unsigned int out_count,
+		unsigned int decimation)
+{
+	if (!out_count || !decimation)
+		return 0;
+
+	return (out_count - 1) * decimation + zoom_fft_num_taps(decimation);
+}
+
+/* Blackman windowed-sinc low-pass, cut inside the decimated band so that
+ * what folds back from beyond its edges is attenuated */
+static void zoom_fft_design_taps(float *taps, unsigned int num_taps,
+		unsigned int decimation)
+{
+	double fc = ZOOM_CUTOFF / decimation;
+	double mid = (num_taps - 1) / 2.0;
+	double sum = 0.0;
+	unsigned int i;
+
+	for (i = 0; i < num_taps; i++) {
+		double t = i - mid;
+		double sinc = (t == 0.0) ? 2.0 * fc :
+			sin(2.0 * M_PI * fc * t) / (M_PI * t);
+		double win = 0.42 - 0.5 * cos(2.0 * M_PI * i / (num_taps - 1)) +
+			0.08 * cos(4.0 * M_PI * i / (num_taps - 1));
+
+		taps[num_taps - 1 - i] = sinc * win;
+		sum += sinc * win;
+	}
+
+	/* Unity gain at DC */
+	for (i = 0; i < num_taps; i++)
+		taps[i] /= sum;
+}
+
+struct zoom_fft * zoom_fft_new(unsigned int out_count, unsigned int decimation)
+{
+	struct zoom_fft *zoom;
+
+	if (!out_count || decimation < 2)
+		return NULL;
+
+	zoom = calloc(1, sizeof(*zoom));
+	if (!zoom)
+		return NULL;
+
+	zoom->decimation = decimation;
+	zoom->out_count = out_count;
+	zoom->in_count = zoom_fft_input_count(out_count, decimation);
+	zoom->num_taps = zoom_fft_num_taps(decimation);
+
+	zoom->taps = malloc(zoom->num_taps * sizeof(float));
+	zoom->nco_cos = malloc(zoom->in_count * sizeof(float));
+	zoom->nco_sin = malloc(zoom->in_count * sizeof(float));
+	zoom->mix_i = malloc(zoom->in_count * sizeof(float));
+	zoom->mix_q = malloc(zoom->in_count * sizeof(float));
+	if (!zoom->taps || !zoom->nco_cos || !zoom->nco_sin ||
+			!zoom->mix_i || !zoom->mix_q) {
+		zoom_fft_destroy(zoom);
+		return NULL;
+	}
+
+	zoom_fft_design_taps(zoom->taps, zoom->num_taps, decimation);
+	zoom->center = NAN;
+	zoom_fft_set_center(zoom, 0.0);
+
+	return zoom;
+}
+
+void zoom_fft_destroy(struct zoom_fft *zoom)
+{
+	if (!zoom)
+		return;
+
+	free(zoom->taps);
+	free(zoom->nco_cos);
+	free(zoom->nco_sin);
+	free(zoom->mix_i);
+	free(zoom->mix_q);
+	free(zoom);
+}
+
+/* @center is the frequency moved to DC, normalized to the sample rate */
+void zoom_fft_set_center(struct zoom_fft *zoom, double center)
+{
+	double step, c, s;
+	unsigned int i;
+
+	if (center == zoom->center)
+		return;
+
+	zoom->center = center;
+	step = -2.0 * M_PI * center;
+
+	/* Every capture is a new block, so the NCO always starts at phase 0
+	 * and its output can be tabulated once for the whole block. */
+	for (i = 0; i < zoom->in_count; i++) {
+		/* Keep the argument small so the error doesn't build up */
+		double phase = fmod(step * i, 2.0 * M_PI);
+
+		c = cos(phase);
+		s = sin(phase);
+		zoom->nco_cos[i] = c;
+		zoom->nco_sin[i] = s;
+	}
+}
+
+static void zoom_fft_mix_real(struct zoom_fft *zoom, const float * __restrict in)
+{
+	const float * __restrict nco_cos = zoom->nco_cos;
+	const float * __restrict nco_sin = zoom->nco_sin;
+	float * __restrict mix_i = zoom->mix_i;
+	float * __restrict mix_q = zoom->mix_q;
+	unsigned int i, n = zoom->in_count;
+
+	/* Mixing a real signal drops half of the power into the image,
+	 * which the filter removes; make up for it here. */
+	for (i = 0; i < n; i++) {
+		mix_i[i] = 2.0f * in[i] * nco_cos[i];
+		mix_q[i] = 2.0f * in[i] * nco_sin[i];
+	}
+}
+
+static void zoom_fft_mix_complex(struct zoom_fft *zoom,
+		const float * __restrict in_i, const float * __restrict in_q)
+{
+	const float * __restrict nco_cos = zoom->nco_cos;
+	const float * __restrict nco_sin = zoom->nco_sin;
+	float * __restrict mix_i = zoom->mix_i;
+	float * __restrict mix_q = zoom->mix_q;
+	unsigned int i, n = zoom->in_count;
+
+	for (i = 0; i < n; i++) {
+		mix_i[i] = in_i[i] * nco_cos[i] - in_q[i] * nco_sin[i];
+		mix_q[i] = in_i[i] * nco_sin[i] + in_q[i] * nco_cos[i];
+	}
+}
+
+/* The partial sums are kept in separate lanes so that the compiler may
+ * vectorize the loop without reordering a single floating-point sum. */
+#define DOT_LANES 8
+
+static float dot_product(const float * __restrict a,
+		const float * __restrict b, unsigned int n)
+{
+	float acc[DOT_LANES] = { 0 };
+	float sum = 0.0f;
+	unsigned int i, j;
+
+	for (i = 0; i + DOT_LANES <= n; i += DOT_LANES)
+		for (j = 0; j < DOT_LANES; j++)
+			acc[j] += a[i + j] * b[i + j];
+
+	for (; i < n; i++)
+		sum += a[i] * b[i];
+	for (j = 0; j < DOT_LANES; j++)
+		sum += acc[j];
+
+	return sum;
+}
+
+/*
+ * @in_q may be NULL for a real input. @out_i and @out_q receive out_count
+ * samples; the input has to hold zoom_fft_input_count() samples.
+ */
+void zoom_fft_process(struct zoom_fft *zoom, const float *in_i,
+		const float *in_q, float *out_i, float *out_q)
+{
+	unsigned int k;
+
+	if (in_q)
+		zoom_fft_mix_complex(zoom, in_i, in_q);
+	else
+		zoom_fft_mix_real(zoom, in_i);
+
+	/* Only the outputs that survive decimation are computed, which is
+	 * the whole saving of the polyphase form: each one is a dot product
+	 * of the filter with the window starting at k * decimation. */
+	for (k = 0; k < zoom->out_count; k++) {
+		unsigned int start = k * zoom->decimation;
+
+		out_i[k] = dot_product(zoom->taps, zoom->mix_i + start,
+				zoom->num_taps);
+		out_q[k] = dot_product(zoom->taps, zoom->mix_q + start,
+				zoom->num_taps);
+	}
+}
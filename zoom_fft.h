@@ -0,0 +1,49 @@
+/**
+ * Copyright (C) 2016 Analog Devices, Inc.
+ *
+ * Licensed under the GPL-2.
+ *
+ **/
+
+#ifndef __ZOOM_FFT_H__
+#define __ZOOM_FFT_H__
+
+#include <stdbool.h>
+
+/* Digital downconverter feeding a zoom FFT: the input is mixed down so the
+ * zoom center lands on DC, then low-pass filtered and decimated. The FFT of
+ * the decimated stream shows (sample rate / decimation) around the center
+ * with the resolution of a (decimation) times bigger FFT.
+ *
+ * Usable span: the filter is flat to within 1 dB over the central 70% of
+ * the band and is 6 dB down at 80% of it; the outer bins roll off further.
+ * Images folding back into the band are at least 55 dB down.
+ */
+struct zoom_fft {
+	unsigned int decimation;
+	unsigned int out_count;
+	unsigned int in_count;
+
+	/* Low-pass prototype, stored reversed */
+	unsigned int num_taps;
+	float *taps;
+
+	/* NCO output for a whole block, recomputed when the center moves */
+	double center;
+	float *nco_cos;
+	float *nco_sin;
+
+	/* Mixer output */
+	float *mix_i;
+	float *mix_q;
+};
+
+unsigned int zoom_fft_input_count(unsigned int out_count,
+		unsigned int decimation);
+struct zoom_fft * zoom_fft_new(unsigned int out_count, unsigned int decimation);
+void zoom_fft_destroy(struct zoom_fft *zoom);
+void zoom_fft_set_center(struct zoom_fft *zoom, double center);
+void zoom_fft_process(struct zoom_fft *zoom, const float *in_i,
+		const float *in_q, float *out_i, float *out_q);
+
+#endif /* __ZOOM_FFT_H__ */